@@ -0,0 +1,240 @@
+#ifndef ASYNCLOADER_H
+#define ASYNCLOADER_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "glstate.h"
+#include "model.h"
+#include "spscqueue.h"
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+// loads models in the background. Load returns an empty Model right away, worker threads run the
+// Assimp import and decode the textures, and the finished CPU data is handed back to the GL thread
+// through lock-free queues. Update, called once per frame, does the GL upload.
+class AsyncModelLoader {
+public:
+    // with a streamer the model textures are streamed in after the meshes are uploaded
+    AsyncModelLoader(unsigned int workerCount = 2, TextureStreamer* streamer = nullptr)
+        : running(true), nextWorker(0), pending(0), streamer(streamer), proxyVAO(0), proxyVBO(0)
+    {
+        for (unsigned int i = 0; i < workerCount; i++)
+        {
+            workers.push_back(unique_ptr<Worker>(new Worker()));
+            workers[i]->thread = thread(&AsyncModelLoader::run, workers[i].get(), &running);
+        }
+    }
+
+    ~AsyncModelLoader()
+    {
+        running = false;
+        for (unsigned int i = 0; i < workers.size(); i++)
+            workers[i]->thread.join();
+
+        // the imports of reloads belong to the loader wherever they got to, the models Load returned belong to the caller
+        for (map<Model*, Model*>::iterator reload = reloads.begin(); reload != reloads.end(); ++reload)
+            delete reload->first;
+    }
+
+    // queues a model for loading, the returned model is not ready to draw until Update uploaded it
+    Model* Load(const string& path, bool flipTextures = false)
+    {
+        Request request;
+        request.model = new Model();
+        request.path = path;
+        request.flipTextures = flipTextures;
+        request.importOnly = false;
+        push(request);
+        return request.model;
+    }
+
+    // imports the file of a loaded model again in the background, after it changed on disk. the next
+    // Update that finds it done merges it into model (Model::ApplyReload), which stays drawable meanwhile.
+    void Reload(Model* model, const string& path, bool flipTextures = false)
+    {
+        Request request;
+        request.model = new Model();
+        request.path = path;
+        request.flipTextures = flipTextures;
+        request.importOnly = true;
+        reloads[request.model] = model;
+        push(request);
+    }
+
+    // collects the models the workers finished and uploads at most maxUploads of them, so one frame
+    // never pays for more than a few uploads at once
+    void Update(unsigned int maxUploads = 1)
+    {
+        for (unsigned int i = 0; i < workers.size(); i++)
+        {
+            Model* model;
+            while (workers[i]->finished.Pop(model))
+            {
+                // reloads only touch what changed, they don't wait for an upload slot
+                map<Model*, Model*>::iterator reload = reloads.find(model);
+                if (reload != reloads.end())
+                {
+                    reload->second->ApplyReload(*model, streamer);
+                    reloads.erase(reload);
+                    delete model;
+                    pending--;
+                }
+                else
+                    imported.push_back(model);
+            }
+        }
+
+        unsigned int uploads = 0;
+        while (!imported.empty() && uploads < maxUploads)
+        {
+            imported.front()->FinishUpload(streamer);
+            imported.erase(imported.begin());
+            pending--;
+            uploads++;
+        }
+    }
+
+    // true while any model is still being imported or waiting for its upload
+    bool Busy() const
+    {
+        return pending > 0;
+    }
+
+    // transform that fits the proxy box around a loading model. the bounds are only known once the
+    // import finished, until then the proxy is a unit box at the model origin.
+    glm::mat4 ProxyTransform(Model* model) const
+    {
+        for (unsigned int i = 0; i < imported.size(); i++)
+        {
+            if (imported[i] == model)
+            {
+                glm::vec3 center = (model->bounds.min + model->bounds.max) * 0.5f;
+                glm::vec3 extent = (model->bounds.max - model->bounds.min) * 0.5f;
+                return glm::scale(glm::translate(glm::mat4(1.0f), center), extent);
+            }
+        }
+        return glm::mat4(1.0f);
+    }
+
+    // draws a box from -1 to 1 with normals, using whatever program and world matrix are set
+    void DrawProxy()
+    {
+        if (proxyVAO == 0)
+            createProxyBox();
+
+        glState.BindVertexArray(proxyVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 36);
+    }
+
+    // deletes the proxy box, has to happen while the GL context is still there
+    void Release()
+    {
+        if (proxyVAO)
+        {
+            glDeleteVertexArrays(1, &proxyVAO);
+            glState.VertexArrayDeleted(proxyVAO);
+        }
+        proxyVAO = 0;
+        DeleteTrackedBuffer(proxyVBO);
+    }
+
+private:
+    struct Request {
+        Model* model;
+        string path;
+        bool flipTextures;
+        bool importOnly; // a reload, the images are decoded by ApplyReload if they are new
+    };
+
+    struct Worker {
+        SpscQueue<Request, 64> requests;
+        SpscQueue<Model*, 64> finished;
+        std::thread thread;
+    };
+
+    vector<unique_ptr<Worker>> workers;
+    atomic<bool> running;
+    unsigned int nextWorker;
+    unsigned int pending;
+    TextureStreamer* streamer;
+    // models whose CPU data is done, waiting for their turn to upload (GL thread only)
+    vector<Model*> imported;
+    // fresh imports of models that are being reloaded, and the model each one goes into
+    map<Model*, Model*> reloads;
+
+    unsigned int proxyVAO, proxyVBO;
+
+    void push(const Request& request)
+    {
+        // hand out the requests round robin, every worker has its own queue so each queue keeps one producer and one consumer
+        Worker* worker = workers[nextWorker++ % workers.size()].get();
+        while (!worker->requests.Push(request))
+            this_thread::yield();
+
+        pending++;
+    }
+
+    static void run(Worker* worker, atomic<bool>* running)
+    {
+        while (*running)
+        {
+            Request request;
+            if (!worker->requests.Pop(request))
+            {
+                this_thread::sleep_for(chrono::milliseconds(1));
+                continue;
+            }
+
+            if (request.importOnly)
+                request.model->ImportDeferred(request.path, request.flipTextures);
+            else
+                request.model->LoadDeferred(request.path, request.flipTextures);
+
+            // nobody drains finished once the loader shuts down, the destructor frees what was left behind
+            while (*running && !worker->finished.Push(request.model))
+                this_thread::yield();
+        }
+    }
+
+    void createProxyBox()
+    {
+        // position, normal
+        float vertices[] = {
+            -1, -1, -1,  0, 0, -1,   1,  1, -1,  0, 0, -1,   1, -1, -1,  0, 0, -1,
+             1,  1, -1,  0, 0, -1,  -1, -1, -1,  0, 0, -1,  -1,  1, -1,  0, 0, -1,
+            -1, -1,  1,  0, 0,  1,   1, -1,  1,  0, 0,  1,   1,  1,  1,  0, 0,  1,
+             1,  1,  1,  0, 0,  1,  -1,  1,  1,  0, 0,  1,  -1, -1,  1,  0, 0,  1,
+            -1,  1,  1, -1, 0,  0,  -1,  1, -1, -1, 0,  0,  -1, -1, -1, -1, 0,  0,
+            -1, -1, -1, -1, 0,  0,  -1, -1,  1, -1, 0,  0,  -1,  1,  1, -1, 0,  0,
+             1,  1,  1,  1, 0,  0,   1, -1, -1,  1, 0,  0,   1,  1, -1,  1, 0,  0,
+             1, -1, -1,  1, 0,  0,   1,  1,  1,  1, 0,  0,   1, -1,  1,  1, 0,  0,
+            -1, -1, -1,  0, -1, 0,   1, -1, -1,  0, -1, 0,   1, -1,  1,  0, -1, 0,
+             1, -1,  1,  0, -1, 0,  -1, -1,  1,  0, -1, 0,  -1, -1, -1,  0, -1, 0,
+            -1,  1, -1,  0, 1,  0,   1,  1,  1,  0, 1,  0,   1,  1, -1,  0, 1,  0,
+             1,  1,  1,  0, 1,  0,  -1,  1, -1,  0, 1,  0,  -1,  1,  1,  0, 1,  0
+        };
+
+        glGenVertexArrays(1, &proxyVAO);
+        glGenBuffers(1, &proxyVBO);
+        glState.BindVertexArray(proxyVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, proxyVBO);
+        gpuMemory.Track(GPU_BUFFER, proxyVBO, MEMORY_MODELS, "loading proxy box");
+        TrackedBufferData(GL_ARRAY_BUFFER, proxyVBO, sizeof(vertices), vertices, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
+        glState.BindVertexArray(0);
+    }
+};
+#endif
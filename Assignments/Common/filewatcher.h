@@ -0,0 +1,170 @@
+#ifndef FILEWATCHER_H
+#define FILEWATCHER_H
+
+#include "vfs.h"
+
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+using namespace std;
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// calls back when watched files change on disk, so assets can be reloaded while the program runs.
+// on linux the directories of the watched files are registered with inotify and only the kernel's events
+// are read, elsewhere (or if inotify isn't available) the modification times are compared every interval.
+// callbacks run from Poll, on whatever thread calls it, so they may touch GL when that is the GL thread.
+class FileWatcher {
+public:
+    typedef function<void(const string& path)> Callback;
+
+    // seconds between modification time checks when there is no inotify
+    float interval;
+
+    FileWatcher(float interval = 0.5f) : interval(interval), notifyFd(-1), lastCheck(chrono::steady_clock::now())
+    {
+#ifdef __linux__
+        notifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+    }
+
+    ~FileWatcher()
+    {
+#ifdef __linux__
+        if (notifyFd >= 0)
+            close(notifyFd);
+#endif
+    }
+
+    // calls callback with path every time the file is written. a file can have several callbacks
+    void Watch(const string& path, Callback callback)
+    {
+        string key = normalize(path);
+        WatchedFile& file = files[key];
+        if (file.callbacks.empty())
+        {
+            file.path = path;
+            std::error_code error;
+            file.time = std::filesystem::last_write_time(key, error);
+            watchDirectory(std::filesystem::path(key).parent_path().string());
+        }
+        file.callbacks.push_back(callback);
+    }
+
+    bool IsWatched(const string& path) const
+    {
+        return files.find(normalize(path)) != files.end();
+    }
+
+    // looks for changes and runs the callbacks of every file that changed since the last call, once per file
+    void Poll()
+    {
+        set<string> changed;
+#ifdef __linux__
+        if (notifyFd >= 0)
+            readEvents(changed);
+        else
+#endif
+            checkTimes(changed);
+
+        for (set<string>::iterator it = changed.begin(); it != changed.end(); ++it)
+        {
+            // copied, a callback may watch more files and invalidate the reference
+            WatchedFile file = files[*it];
+            // the pack has the file as it was when the pack was built, the reload wants the edit
+            assets.Override(file.path);
+            for (unsigned int i = 0; i < file.callbacks.size(); i++)
+                file.callbacks[i](file.path);
+        }
+    }
+
+private:
+    struct WatchedFile {
+        string path; // as it was passed to Watch
+        vector<Callback> callbacks;
+        std::filesystem::file_time_type time;
+    };
+
+    // by absolute path
+    map<string, WatchedFile> files;
+    int notifyFd;
+    // inotify watch descriptor of every directory with watched files
+    map<int, string> directories;
+    chrono::steady_clock::time_point lastCheck;
+
+    static string normalize(const string& path)
+    {
+        std::error_code error;
+        std::filesystem::path absolute = std::filesystem::absolute(path, error);
+        return (error ? std::filesystem::path(path) : absolute).lexically_normal().generic_string();
+    }
+
+    void watchDirectory(const string& directory)
+    {
+#ifdef __linux__
+        if (notifyFd < 0)
+            return;
+        for (map<int, string>::iterator it = directories.begin(); it != directories.end(); ++it)
+        {
+            if (it->second == directory)
+                return;
+        }
+        // editors either write the file in place (close after write) or write a copy and rename it over
+        int wd = inotify_add_watch(notifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+        if (wd >= 0)
+            directories[wd] = directory;
+#endif
+    }
+
+#ifdef __linux__
+    void readEvents(set<string>& changed)
+    {
+        alignas(inotify_event) char buffer[4096];
+        for (;;)
+        {
+            ssize_t length = read(notifyFd, buffer, sizeof(buffer));
+            if (length <= 0)
+                return; // EAGAIN, nothing more to read
+
+            for (char* p = buffer; p < buffer + length; p += sizeof(inotify_event) + ((inotify_event*)p)->len)
+            {
+                const inotify_event* event = (const inotify_event*)p;
+                map<int, string>::iterator directory = directories.find(event->wd);
+                if (directory == directories.end() || event->len == 0)
+                    continue;
+
+                string path = directory->second + "/" + event->name;
+                if (files.find(path) != files.end())
+                    changed.insert(path);
+            }
+        }
+    }
+#endif
+
+    void checkTimes(set<string>& changed)
+    {
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        if (chrono::duration<float>(now - lastCheck).count() < interval)
+            return;
+        lastCheck = now;
+
+        for (map<string, WatchedFile>::iterator it = files.begin(); it != files.end(); ++it)
+        {
+            // a file that is being replaced can be missing for a moment, it is picked up on a later check
+            std::error_code error;
+            std::filesystem::file_time_type time = std::filesystem::last_write_time(it->first, error);
+            if (error || time == it->second.time)
+                continue;
+            it->second.time = time;
+            changed.insert(it->first);
+        }
+    }
+};
+#endif
@@ -0,0 +1,93 @@
+#ifndef FRAMEUNIFORMS_H
+#define FRAMEUNIFORMS_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "gpumemory.h"
+
+#include <cstring>
+using namespace std;
+
+// uniform buffer binding point of the FrameUniforms block, shared by every program
+#define FRAME_UNIFORMS_BINDING 0
+
+// the FrameUniforms block as the shaders declare it, in std140 layout:
+//
+// layout(std140) uniform FrameUniforms {
+//     mat4 view;
+//     mat4 projection;
+//     vec3 cameraPosition;
+//     vec3 lightDirection;
+// };
+//
+// a vec3 is aligned like a vec4, the padding floats fill the rest of its 16 bytes
+struct FrameUniformData {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec3 cameraPosition;
+    float padding0;
+    glm::vec3 lightDirection;
+    float padding1;
+};
+
+// the camera and light of the frame in one uniform buffer. it's written once per frame and stays bound
+// to its binding point, so programs only set what changes per draw.
+class FrameUniformBuffer {
+public:
+    unsigned int UBO;
+
+    FrameUniformBuffer() : UBO(0), uploaded(false) {}
+
+    // points the FrameUniforms block of a linked program at the shared binding, programs without it are left alone
+    void BindProgram(GLuint program)
+    {
+        GLuint index = glGetUniformBlockIndex(program, "FrameUniforms");
+        if (index != GL_INVALID_INDEX)
+            glUniformBlockBinding(program, index, FRAME_UNIFORMS_BINDING);
+    }
+
+    // uploads this frame's values, nothing when the camera and light haven't moved since the last one
+    void Update(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& cameraPosition, const glm::vec3& lightDirection)
+    {
+        if (UBO == 0)
+        {
+            glGenBuffers(1, &UBO);
+            gpuMemory.Track(GPU_BUFFER, UBO, MEMORY_OTHER, "frame uniforms");
+            glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+            TrackedBufferData(GL_UNIFORM_BUFFER, UBO, sizeof(FrameUniformData), nullptr, GL_DYNAMIC_DRAW);
+            glBindBuffer(GL_UNIFORM_BUFFER, 0);
+            glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_UNIFORMS_BINDING, UBO);
+        }
+
+        FrameUniformData data;
+        data.view = view;
+        data.projection = projection;
+        data.cameraPosition = cameraPosition;
+        data.padding0 = 0.0f;
+        data.lightDirection = lightDirection;
+        data.padding1 = 0.0f;
+        if (uploaded && memcmp(&data, &current, sizeof(data)) == 0)
+            return;
+
+        glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(data), &data);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        current = data;
+        uploaded = true;
+    }
+
+    void Release()
+    {
+        DeleteTrackedBuffer(UBO);
+        uploaded = false;
+    }
+
+private:
+    FrameUniformData current;
+    bool uploaded;
+};
+
+FrameUniformBuffer frameUniforms;
+#endif
@@ -0,0 +1,128 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+using namespace std;
+
+struct BoundingBox {
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+struct BoundingSphere {
+    glm::vec3 center;
+    float radius;
+};
+
+// the six clip planes of a camera, stored as (normal, distance) with the normals pointing inwards.
+// when built from projection * view * world the planes end up in the object space of that world matrix,
+// so bounds that were computed at import can be tested without transforming them first.
+class Frustum {
+public:
+    glm::vec4 planes[6];
+
+    Frustum() {}
+
+    explicit Frustum(const glm::mat4& clip)
+    {
+        // Gribb/Hartmann plane extraction, glm is column major so row i is (m[0][i], m[1][i], m[2][i], m[3][i])
+        glm::vec4 row0(clip[0][0], clip[1][0], clip[2][0], clip[3][0]);
+        glm::vec4 row1(clip[0][1], clip[1][1], clip[2][1], clip[3][1]);
+        glm::vec4 row2(clip[0][2], clip[1][2], clip[2][2], clip[3][2]);
+        glm::vec4 row3(clip[0][3], clip[1][3], clip[2][3], clip[3][3]);
+
+        planes[0] = row3 + row0; // left
+        planes[1] = row3 - row0; // right
+        planes[2] = row3 + row1; // bottom
+        planes[3] = row3 - row1; // top
+        planes[4] = row3 + row2; // near
+        planes[5] = row3 - row2; // far
+
+        // normalize so the plane distance is a real distance and sphere radii can be compared against it
+        for (int i = 0; i < 6; i++)
+            planes[i] /= glm::length(glm::vec3(planes[i]));
+    }
+
+    // true if any part of the box can be inside the frustum (tests the corner furthest along each plane normal)
+    bool IsBoxVisible(const BoundingBox& box) const
+    {
+        for (int i = 0; i < 6; i++)
+        {
+            glm::vec3 positive(planes[i].x >= 0 ? box.max.x : box.min.x,
+                               planes[i].y >= 0 ? box.max.y : box.min.y,
+                               planes[i].z >= 0 ? box.max.z : box.min.z);
+            if (glm::dot(glm::vec3(planes[i]), positive) + planes[i].w < 0)
+                return false;
+        }
+        return true;
+    }
+
+    bool IsSphereVisible(const BoundingSphere& sphere) const
+    {
+        for (int i = 0; i < 6; i++)
+        {
+            if (glm::dot(glm::vec3(planes[i]), sphere.center) + planes[i].w < -sphere.radius)
+                return false;
+        }
+        return true;
+    }
+};
+
+// structure-of-arrays copy of a list of bounding spheres. keeping every component in its own
+// tightly packed array lets the culling loop below run 4/8 spheres per instruction once vectorized.
+struct SphereList {
+    vector<float> x, y, z, radius;
+
+    void Clear()
+    {
+        x.clear(); y.clear(); z.clear(); radius.clear();
+    }
+
+    void Add(const BoundingSphere& sphere)
+    {
+        x.push_back(sphere.center.x);
+        y.push_back(sphere.center.y);
+        z.push_back(sphere.center.z);
+        radius.push_back(sphere.radius);
+    }
+
+    size_t Size() const { return x.size(); }
+};
+
+// tests every sphere in the list against the frustum in one batch and writes 1 (visible) or 0 (culled)
+// per sphere into visible. the loops are branch free and walk the arrays linearly one plane at a time,
+// so the compiler can auto-vectorize them. returns the number of visible spheres.
+size_t CullSpheres(const Frustum& frustum, const SphereList& spheres, vector<unsigned char>& visible)
+{
+    size_t count = spheres.Size();
+    visible.assign(count, 1);
+    if (count == 0) return 0;
+
+    const float* xs = spheres.x.data();
+    const float* ys = spheres.y.data();
+    const float* zs = spheres.z.data();
+    const float* rs = spheres.radius.data();
+    unsigned char* out = visible.data();
+
+    for (int p = 0; p < 6; p++)
+    {
+        const float a = frustum.planes[p].x;
+        const float b = frustum.planes[p].y;
+        const float c = frustum.planes[p].z;
+        const float d = frustum.planes[p].w;
+
+        for (size_t i = 0; i < count; i++)
+        {
+            float distance = a * xs[i] + b * ys[i] + c * zs[i] + d + rs[i];
+            out[i] &= (unsigned char)(distance >= 0.0f);
+        }
+    }
+
+    size_t visibleCount = 0;
+    for (size_t i = 0; i < count; i++)
+        visibleCount += out[i];
+    return visibleCount;
+}
+#endif
@@ -0,0 +1,239 @@
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+#include <glad/glad.h>
+
+using namespace std;
+
+// texture units whose bindings are remembered, binds to higher units always go to the driver
+#define GL_STATE_TEXTURE_UNITS 32
+
+// the GL state the renderer changes most, remembered on the CPU so setting what is already set costs
+// nothing. every change to this state has to go through glState, a call made directly to GL leaves the
+// cache believing the old value; after code that does that, Invalidate makes the next set of everything
+// reach the driver again.
+class GLStateCache {
+public:
+    // calls passed on to the driver and calls dropped because the state already had the value
+    unsigned long long issued, skipped;
+
+    GLStateCache() : issued(0), skipped(0)
+    {
+        Invalidate();
+    }
+
+    // forgets every value, the next set of each one goes to the driver
+    void Invalidate()
+    {
+        for (int i = 0; i < CAPABILITY_COUNT; i++)
+            capabilities[i] = UNKNOWN;
+        depthFunc = depthMask = colorMask = cullFace = blendSource = blendDestination = UNKNOWN;
+        program = vertexArray = activeUnit = UNKNOWN;
+        for (int i = 0; i < GL_STATE_TEXTURE_UNITS; i++)
+        {
+            for (int j = 0; j < TARGET_COUNT; j++)
+                textures[i][j] = UNKNOWN;
+        }
+    }
+
+    void Enable(GLenum capability)
+    {
+        Set(capability, true);
+    }
+
+    void Disable(GLenum capability)
+    {
+        Set(capability, false);
+    }
+
+    void Set(GLenum capability, bool enabled)
+    {
+        int index = capabilityIndex(capability);
+        if (index >= 0 && capabilities[index] == (GLuint)enabled)
+        {
+            skipped++;
+            return;
+        }
+        if (enabled)
+            glEnable(capability);
+        else
+            glDisable(capability);
+        if (index >= 0)
+            capabilities[index] = enabled;
+        issued++;
+    }
+
+    // from the cache when the capability is tracked and known, asking the driver otherwise
+    bool IsEnabled(GLenum capability) const
+    {
+        int index = capabilityIndex(capability);
+        if (index >= 0 && capabilities[index] != UNKNOWN)
+            return capabilities[index] != 0;
+        return glIsEnabled(capability) == GL_TRUE;
+    }
+
+    void DepthFunc(GLenum function)
+    {
+        if (change(depthFunc, function))
+            glDepthFunc(function);
+    }
+
+    void DepthMask(bool write)
+    {
+        if (change(depthMask, write))
+            glDepthMask(write ? GL_TRUE : GL_FALSE);
+    }
+
+    // all four channels together, the passes only ever write all of them or none
+    void ColorMask(bool write)
+    {
+        if (change(colorMask, write))
+        {
+            GLboolean value = write ? GL_TRUE : GL_FALSE;
+            glColorMask(value, value, value, value);
+        }
+    }
+
+    void CullFace(GLenum face)
+    {
+        if (change(cullFace, face))
+            glCullFace(face);
+    }
+
+    void BlendFunc(GLenum source, GLenum destination)
+    {
+        if (blendSource == source && blendDestination == destination)
+        {
+            skipped++;
+            return;
+        }
+        glBlendFunc(source, destination);
+        blendSource = source;
+        blendDestination = destination;
+        issued++;
+    }
+
+    void UseProgram(GLuint id)
+    {
+        if (change(program, id))
+            glUseProgram(id);
+    }
+
+    // the program in use, 0 when it isn't known
+    GLuint Program() const
+    {
+        return program == UNKNOWN ? 0 : program;
+    }
+
+    void BindVertexArray(GLuint id)
+    {
+        if (change(vertexArray, id))
+            glBindVertexArray(id);
+    }
+
+    // binds to the given unit, switching the active unit only when the binding changes
+    void BindTexture(GLuint unit, GLenum target, GLuint id)
+    {
+        int index = targetIndex(target);
+        if (unit < GL_STATE_TEXTURE_UNITS && index >= 0 && textures[unit][index] == id)
+        {
+            skipped++;
+            return;
+        }
+        ActiveTexture(unit);
+        glBindTexture(target, id);
+        if (unit < GL_STATE_TEXTURE_UNITS && index >= 0)
+            textures[unit][index] = id;
+        issued++;
+    }
+
+    // binds to the active unit, for code that creates or uploads a texture and doesn't care which unit
+    void BindTexture(GLenum target, GLuint id)
+    {
+        BindTexture(activeUnit == UNKNOWN ? 0 : activeUnit, target, id);
+    }
+
+    void ActiveTexture(GLuint unit)
+    {
+        if (change(activeUnit, unit))
+            glActiveTexture(GL_TEXTURE0 + unit);
+    }
+
+    // a deleted texture is unbound from every unit, the name may come back for a new one
+    void TextureDeleted(GLuint id)
+    {
+        for (int i = 0; i < GL_STATE_TEXTURE_UNITS; i++)
+        {
+            for (int j = 0; j < TARGET_COUNT; j++)
+            {
+                if (textures[i][j] == id)
+                    textures[i][j] = 0;
+            }
+        }
+    }
+
+    // the same for a vertex array, deleting the bound one binds 0
+    void VertexArrayDeleted(GLuint id)
+    {
+        if (vertexArray == id)
+            vertexArray = 0;
+    }
+
+    void ResetCounters()
+    {
+        issued = skipped = 0;
+    }
+
+private:
+    // a value no GL name or enum takes, for state that hasn't been set through the cache yet
+    static const GLuint UNKNOWN = 0xFFFFFFFF;
+
+    static const int CAPABILITY_COUNT = 6;
+    static const int TARGET_COUNT = 3;
+
+    GLuint capabilities[CAPABILITY_COUNT];
+    GLuint depthFunc, depthMask, colorMask, cullFace, blendSource, blendDestination;
+    GLuint program, vertexArray, activeUnit;
+    GLuint textures[GL_STATE_TEXTURE_UNITS][TARGET_COUNT];
+
+    static int capabilityIndex(GLenum capability)
+    {
+        switch (capability)
+        {
+        case GL_DEPTH_TEST: return 0;
+        case GL_CULL_FACE: return 1;
+        case GL_BLEND: return 2;
+        case GL_STENCIL_TEST: return 3;
+        case GL_SCISSOR_TEST: return 4;
+        case GL_POLYGON_OFFSET_FILL: return 5;
+        default: return -1;
+        }
+    }
+
+    static int targetIndex(GLenum target)
+    {
+        switch (target)
+        {
+        case GL_TEXTURE_2D: return 0;
+        case GL_TEXTURE_2D_ARRAY: return 1;
+        case GL_TEXTURE_CUBE_MAP: return 2;
+        default: return -1;
+        }
+    }
+
+    // stores value, true when it differs from what was there and the call has to be made
+    bool change(GLuint& current, GLuint value)
+    {
+        if (current == value)
+        {
+            skipped++;
+            return false;
+        }
+        current = value;
+        issued++;
+        return true;
+    }
+};
+
+GLStateCache glState;
+#endif
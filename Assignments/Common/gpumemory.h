@@ -0,0 +1,304 @@
+#ifndef GPUMEMORY_H
+#define GPUMEMORY_H
+
+#include <glad/glad.h>
+
+#include "glstate.h"
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+using namespace std;
+
+// the subsystem a GPU resource belongs to, usage and budgets are kept per category
+enum MemoryCategory {
+    MEMORY_TERRAIN,
+    MEMORY_MODELS,
+    MEMORY_SKYBOX,
+    MEMORY_UI,
+    MEMORY_OTHER, // render targets, scratch buffers and anything not labeled yet
+    MEMORY_CATEGORY_COUNT
+};
+
+const char* MemoryCategoryName(MemoryCategory category)
+{
+    static const char* names[MEMORY_CATEGORY_COUNT] = { "terrain", "models", "skybox", "ui", "other" };
+    return names[category];
+}
+
+enum GpuResourceKind {
+    GPU_BUFFER,
+    GPU_TEXTURE,
+    GPU_RENDERBUFFER
+};
+
+// bytes one image of a texture or renderbuffer takes. drivers pad 3 byte texels to 4, so RGB8 counts as 4
+size_t TextureImageBytes(GLenum internalFormat, int width, int height, int depth = 1)
+{
+    size_t blocks = (size_t)((width + 3) / 4) * ((height + 3) / 4) * depth;
+    size_t texels = (size_t)width * height * depth;
+    switch (internalFormat)
+    {
+    case 0x83F0: // GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+        return blocks * 8;
+    case 0x83F3: // GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+    case 0x8E8C: // GL_COMPRESSED_RGBA_BPTC_UNORM
+    case GL_COMPRESSED_RG_RGTC2:
+        return blocks * 16;
+    case GL_R8:
+        return texels;
+    case GL_RG8:
+        return texels * 2;
+    case GL_RGBA16F:
+    case GL_RG32F:
+        return texels * 8;
+    case GL_RGBA32F:
+        return texels * 16;
+    default: // RGB8, RGBA8, depth 24 (+ stencil 8) and friends
+        return texels * 4;
+    }
+}
+
+// one tracked resource in the per asset breakdown
+struct GpuAllocation {
+    GpuResourceKind kind;
+    GLuint id;
+    MemoryCategory category;
+    string name;
+    size_t bytes;
+};
+
+// keeps a record of every buffer, texture and renderbuffer the program allocates: how big it is, what it is
+// and which subsystem owns it. the GL calls themselves stay where they are, the code that allocates reports
+// the sizes here (or goes through the Tracked* helpers below).
+class GpuMemoryTracker {
+public:
+    // called with the category (MEMORY_CATEGORY_COUNT for the total), the bytes in use and the budget,
+    // every time the usage goes from within the budget to over it
+    typedef function<void(MemoryCategory category, size_t used, size_t budget)> BudgetCallback;
+
+    GpuMemoryTracker() : total(0), totalPeak(0), totalBudget(0)
+    {
+        for (int i = 0; i < MEMORY_CATEGORY_COUNT; i++)
+        {
+            used[i] = peak[i] = budget[i] = 0;
+        }
+    }
+
+    // names a resource and puts it in a category, its bytes move along if it was sized before
+    void Track(GpuResourceKind kind, GLuint id, MemoryCategory category, const string& name)
+    {
+        Resource& resource = find(kind, id);
+        if (resource.category != category)
+        {
+            size_t bytes = resource.Bytes();
+            remove(resource.category, bytes);
+            resource.category = category;
+            add(category, bytes);
+        }
+        resource.name = name;
+    }
+
+    // sets the size of one image of a resource, 0 frees it. buffers and renderbuffers have a single image 0,
+    // textures one per level and face (see TextureImageIndex)
+    void SetImage(GpuResourceKind kind, GLuint id, int image, size_t bytes)
+    {
+        if (id == 0)
+            return;
+
+        Resource& resource = find(kind, id);
+        size_t& current = resource.images[image];
+        remove(resource.category, current);
+        current = bytes;
+        add(resource.category, bytes);
+        if (bytes == 0)
+            resource.images.erase(image);
+    }
+
+    // forgets a deleted resource
+    void Release(GpuResourceKind kind, GLuint id)
+    {
+        map<pair<int, GLuint>, Resource>::iterator it = resources.find(make_pair((int)kind, id));
+        if (it == resources.end())
+            return;
+
+        remove(it->second.category, it->second.Bytes());
+        resources.erase(it);
+    }
+
+    size_t Used(MemoryCategory category) const { return used[category]; }
+    size_t Peak(MemoryCategory category) const { return peak[category]; }
+    size_t TotalUsed() const { return total; }
+    size_t TotalPeak() const { return totalPeak; }
+
+    void SetBudget(MemoryCategory category, size_t bytes, BudgetCallback callback)
+    {
+        budget[category] = bytes;
+        callbacks[category] = callback;
+    }
+
+    void SetTotalBudget(size_t bytes, BudgetCallback callback)
+    {
+        totalBudget = bytes;
+        totalCallback = callback;
+    }
+
+    // every resource with its current size, for the per asset breakdown
+    vector<GpuAllocation> Allocations() const
+    {
+        vector<GpuAllocation> allocations;
+        for (map<pair<int, GLuint>, Resource>::const_iterator it = resources.begin(); it != resources.end(); ++it)
+        {
+            GpuAllocation allocation;
+            allocation.kind = (GpuResourceKind)it->first.first;
+            allocation.id = it->first.second;
+            allocation.category = it->second.category;
+            allocation.name = it->second.name;
+            allocation.bytes = it->second.Bytes();
+            allocations.push_back(allocation);
+        }
+        return allocations;
+    }
+
+    // writes the totals, peaks, budgets and every allocation to a JSON file
+    bool DumpJson(const string& path) const
+    {
+        std::ofstream file(path);
+        if (!file.is_open())
+            return false;
+
+        static const char* kinds[] = { "buffer", "texture", "renderbuffer" };
+        file << "{\n  \"total\": " << total << ",\n  \"peak\": " << totalPeak << ",\n  \"budget\": " << totalBudget << ",\n";
+        file << "  \"categories\": {\n";
+        for (int i = 0; i < MEMORY_CATEGORY_COUNT; i++)
+        {
+            file << "    \"" << MemoryCategoryName((MemoryCategory)i) << "\": { \"used\": " << used[i] << ", \"peak\": " << peak[i]
+                 << ", \"budget\": " << budget[i] << " }" << (i + 1 < MEMORY_CATEGORY_COUNT ? "," : "") << "\n";
+        }
+        file << "  },\n  \"allocations\": [\n";
+
+        vector<GpuAllocation> allocations = Allocations();
+        for (unsigned int i = 0; i < allocations.size(); i++)
+        {
+            file << "    { \"kind\": \"" << kinds[allocations[i].kind] << "\", \"id\": " << allocations[i].id
+                 << ", \"category\": \"" << MemoryCategoryName(allocations[i].category) << "\", \"name\": \"" << escape(allocations[i].name)
+                 << "\", \"bytes\": " << allocations[i].bytes << " }" << (i + 1 < allocations.size() ? "," : "") << "\n";
+        }
+        file << "  ]\n}\n";
+        return true;
+    }
+
+private:
+    struct Resource {
+        MemoryCategory category;
+        string name;
+        map<int, size_t> images;
+
+        Resource() : category(MEMORY_OTHER) {}
+
+        size_t Bytes() const
+        {
+            size_t bytes = 0;
+            for (map<int, size_t>::const_iterator it = images.begin(); it != images.end(); ++it)
+                bytes += it->second;
+            return bytes;
+        }
+    };
+
+    map<pair<int, GLuint>, Resource> resources;
+    size_t used[MEMORY_CATEGORY_COUNT];
+    size_t peak[MEMORY_CATEGORY_COUNT];
+    size_t budget[MEMORY_CATEGORY_COUNT];
+    BudgetCallback callbacks[MEMORY_CATEGORY_COUNT];
+    size_t total, totalPeak, totalBudget;
+    BudgetCallback totalCallback;
+
+    Resource& find(GpuResourceKind kind, GLuint id)
+    {
+        return resources[make_pair((int)kind, id)];
+    }
+
+    void add(MemoryCategory category, size_t bytes)
+    {
+        if (bytes == 0)
+            return;
+
+        size_t before = used[category], totalBefore = total;
+        used[category] += bytes;
+        total += bytes;
+        peak[category] = std::max(peak[category], used[category]);
+        totalPeak = std::max(totalPeak, total);
+
+        // only report crossing the line, not every allocation while over it
+        if (budget[category] > 0 && before <= budget[category] && used[category] > budget[category] && callbacks[category])
+            callbacks[category](category, used[category], budget[category]);
+        if (totalBudget > 0 && totalBefore <= totalBudget && total > totalBudget && totalCallback)
+            totalCallback(MEMORY_CATEGORY_COUNT, total, totalBudget);
+    }
+
+    void remove(MemoryCategory category, size_t bytes)
+    {
+        used[category] -= bytes;
+        total -= bytes;
+    }
+
+    static string escape(const string& text)
+    {
+        string result;
+        for (unsigned int i = 0; i < text.size(); i++)
+        {
+            if (text[i] == '"' || text[i] == '\\')
+                result += '\\';
+            result += text[i];
+        }
+        return result;
+    }
+};
+
+GpuMemoryTracker gpuMemory;
+
+// image index of one level of one face, cube maps have 6 faces per level
+int TextureImageIndex(int level, int face = 0)
+{
+    return level * 6 + face;
+}
+
+// glBufferData on the buffer bound to target, which has to be buffer, recording its new size
+void TrackedBufferData(GLenum target, GLuint buffer, GLsizeiptr size, const void* data, GLenum usage)
+{
+    glBufferData(target, size, data, usage);
+    gpuMemory.SetImage(GPU_BUFFER, buffer, 0, (size_t)size);
+}
+
+void DeleteTrackedBuffer(GLuint& buffer)
+{
+    if (buffer == 0)
+        return;
+    glDeleteBuffers(1, &buffer);
+    gpuMemory.Release(GPU_BUFFER, buffer);
+    buffer = 0;
+}
+
+void DeleteTrackedTexture(GLuint& texture)
+{
+    if (texture == 0)
+        return;
+    glDeleteTextures(1, &texture);
+    glState.TextureDeleted(texture);
+    gpuMemory.Release(GPU_TEXTURE, texture);
+    texture = 0;
+}
+
+void DeleteTrackedRenderbuffer(GLuint& renderbuffer)
+{
+    if (renderbuffer == 0)
+        return;
+    glDeleteRenderbuffers(1, &renderbuffer);
+    gpuMemory.Release(GPU_RENDERBUFFER, renderbuffer);
+    renderbuffer = 0;
+}
+#endif
@@ -0,0 +1,270 @@
+#ifndef GPUPROFILER_H
+#define GPUPROFILER_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+using namespace std;
+
+// frames whose queries can be in flight at once, a frame is read back this many frames after it was drawn
+#define GPU_PROFILER_FRAMES 4
+// frames the averages and percentiles are taken over
+#define GPU_PROFILER_HISTORY 240
+
+// measures how long the GPU spends in named scopes. a scope writes a GL_TIMESTAMP when it begins and when it
+// ends, so scopes can nest (GL_TIME_ELAPSED queries can't), and the whole frame is one GL_TIME_ELAPSED query.
+// the queries of a frame are only read GPU_PROFILER_FRAMES frames later, when the GPU has long finished them,
+// so reading never waits; a frame that still isn't done by then is dropped instead.
+// a scope that is opened more than once in a frame, like a pass the unsorted queue comes back to, adds up.
+class GpuProfiler {
+public:
+    // frames read back, and frames dropped because their queries weren't done in time
+    unsigned int resolved, dropped;
+
+    GpuProfiler() : resolved(0), dropped(0), frame(0), inFrame(false) {}
+
+    // starts the queries of a frame and reads back the frame that used the same slot before
+    void BeginFrame()
+    {
+        Slot& slot = slots[frame % GPU_PROFILER_FRAMES];
+        if (slot.elapsedQuery == 0)
+            glGenQueries(1, &slot.elapsedQuery);
+        if (slot.used)
+            resolve(slot);
+        slot.used = false;
+        slot.frame = frame;
+        slot.queriesUsed = 0;
+        slot.scopes.clear();
+        open.clear();
+
+        glBeginQuery(GL_TIME_ELAPSED, slot.elapsedQuery);
+        inFrame = true;
+    }
+
+    void EndFrame()
+    {
+        if (!inFrame)
+            return;
+        while (!open.empty())
+            End();
+        glEndQuery(GL_TIME_ELAPSED);
+        slots[frame % GPU_PROFILER_FRAMES].used = true;
+        inFrame = false;
+        frame++;
+    }
+
+    // opens a scope inside the innermost open one, its name in the results is the path of the scopes
+    // it is in, like "opaque/terrain"
+    void Begin(const char* name)
+    {
+        if (!inFrame)
+            return;
+        Slot& slot = slots[frame % GPU_PROFILER_FRAMES];
+        Scope scope;
+        scope.name = open.empty() ? string(name) : slot.scopes[open.back()].name + "/" + name;
+        scope.begin = timestamp(slot);
+        scope.end = 0;
+        open.push_back((unsigned int)slot.scopes.size());
+        slot.scopes.push_back(scope);
+    }
+
+    void End()
+    {
+        if (!inFrame || open.empty())
+            return;
+        Slot& slot = slots[frame % GPU_PROFILER_FRAMES];
+        slot.scopes[open.back()].end = timestamp(slot);
+        open.pop_back();
+    }
+
+    // the names measured so far, "frame" is the whole frame
+    vector<string> Names() const
+    {
+        vector<string> names;
+        for (map<string, History>::const_iterator it = history.begin(); it != history.end(); ++it)
+            names.push_back(it->first);
+        return names;
+    }
+
+    // milliseconds averaged over the last GPU_PROFILER_HISTORY frames the scope was in
+    double Average(const string& name) const
+    {
+        map<string, History>::const_iterator it = history.find(name);
+        if (it == history.end() || it->second.times.empty())
+            return 0.0;
+        double total = 0.0;
+        for (unsigned int i = 0; i < it->second.times.size(); i++)
+            total += it->second.times[i];
+        return total / it->second.times.size();
+    }
+
+    // the time in milliseconds that percentile (0 to 100) of those frames stayed under
+    double Percentile(const string& name, double percentile) const
+    {
+        map<string, History>::const_iterator it = history.find(name);
+        if (it == history.end() || it->second.times.empty())
+            return 0.0;
+        vector<float> sorted = it->second.times;
+        size_t index = (size_t)(min(max(percentile, 0.0), 100.0) / 100.0 * (sorted.size() - 1) + 0.5);
+        nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+        return sorted[index];
+    }
+
+    // from now on every frame read back is appended to path, one row per scope. false when it can't be written
+    bool StartCsv(const string& path)
+    {
+        csv.close();
+        csv.clear();
+        csv.open(path.c_str(), ios::out | ios::trunc);
+        if (!csv)
+            return false;
+        csv << "frame,scope,ms\n";
+        return true;
+    }
+
+    void StopCsv()
+    {
+        csv.close();
+    }
+
+    bool WritingCsv() const
+    {
+        return csv.is_open();
+    }
+
+    // deletes the queries, has to happen while the GL context is still there
+    void Release()
+    {
+        for (int i = 0; i < GPU_PROFILER_FRAMES; i++)
+        {
+            Slot& slot = slots[i];
+            if (!slot.queries.empty())
+                glDeleteQueries((GLsizei)slot.queries.size(), &slot.queries[0]);
+            if (slot.elapsedQuery)
+                glDeleteQueries(1, &slot.elapsedQuery);
+            slot = Slot();
+        }
+        csv.close();
+        inFrame = false;
+    }
+
+private:
+    struct Scope {
+        string name;
+        // indices into the timestamp queries of the slot
+        unsigned int begin, end;
+    };
+
+    // the queries of one frame in flight. the timestamp queries are kept from frame to frame and only grow
+    struct Slot {
+        GLuint elapsedQuery;
+        vector<GLuint> queries;
+        unsigned int queriesUsed;
+        vector<Scope> scopes;
+        unsigned long long frame;
+        bool used;
+
+        Slot() : elapsedQuery(0), queriesUsed(0), frame(0), used(false) {}
+    };
+
+    struct History {
+        vector<float> times;
+        // where the next time goes once times holds GPU_PROFILER_HISTORY of them
+        unsigned int next;
+
+        History() : next(0) {}
+
+        void Add(float time)
+        {
+            if (times.size() < GPU_PROFILER_HISTORY)
+                times.push_back(time);
+            else
+                times[next] = time;
+            next = (next + 1) % GPU_PROFILER_HISTORY;
+        }
+    };
+
+    Slot slots[GPU_PROFILER_FRAMES];
+    unsigned long long frame;
+    bool inFrame;
+    // indices into the scopes of the current slot that haven't ended yet
+    vector<unsigned int> open;
+    map<string, History> history;
+    ofstream csv;
+
+    unsigned int timestamp(Slot& slot)
+    {
+        if (slot.queriesUsed == slot.queries.size())
+        {
+            GLuint query;
+            glGenQueries(1, &query);
+            slot.queries.push_back(query);
+        }
+        glQueryCounter(slot.queries[slot.queriesUsed], GL_TIMESTAMP);
+        return slot.queriesUsed++;
+    }
+
+    // reads the queries of a finished frame into the histories and the CSV, unless the GPU isn't done with them
+    void resolve(const Slot& slot)
+    {
+        GLint available = GL_TRUE;
+        glGetQueryObjectiv(slot.elapsedQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available && slot.queriesUsed > 0)
+            glGetQueryObjectiv(slot.queries[slot.queriesUsed - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+        {
+            dropped++;
+            return;
+        }
+
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(slot.elapsedQuery, GL_QUERY_RESULT, &elapsed);
+        vector<GLuint64> stamps(slot.queriesUsed);
+        for (unsigned int i = 0; i < slot.queriesUsed; i++)
+            glGetQueryObjectui64v(slot.queries[i], GL_QUERY_RESULT, &stamps[i]);
+
+        // the same scope opened again in this frame adds to the first time, in the order they first began
+        vector<pair<string, double> > times;
+        times.push_back(make_pair(string("frame"), elapsed / 1000000.0));
+        for (unsigned int i = 0; i < slot.scopes.size(); i++)
+        {
+            const Scope& scope = slot.scopes[i];
+            double time = (stamps[scope.end] - stamps[scope.begin]) / 1000000.0;
+            unsigned int j = 1;
+            while (j < times.size() && times[j].first != scope.name)
+                j++;
+            if (j == times.size())
+                times.push_back(make_pair(scope.name, 0.0));
+            times[j].second += time;
+        }
+
+        for (unsigned int i = 0; i < times.size(); i++)
+        {
+            history[times[i].first].Add((float)times[i].second);
+            if (csv.is_open())
+                csv << slot.frame << "," << times[i].first << "," << times[i].second << "\n";
+        }
+        resolved++;
+    }
+};
+
+GpuProfiler gpuProfiler;
+
+// a scope that ends where the block it's declared in ends
+class GpuScope {
+public:
+    GpuScope(const char* name)
+    {
+        gpuProfiler.Begin(name);
+    }
+
+    ~GpuScope()
+    {
+        gpuProfiler.End();
+    }
+};
+#endif
@@ -0,0 +1,99 @@
+#ifndef INSTANCING_H
+#define INSTANCING_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "gpumemory.h"
+
+#include <algorithm>
+#include <vector>
+using namespace std;
+
+// first attribute location used by the per-instance data, locations 0-6 are taken by Vertex
+#define INSTANCE_ATTRIB_LOCATION 7
+
+// per-instance vertex data: the world matrix (locations 7-10) and its normal matrix (locations 11-13).
+// the normal matrix is computed on the CPU once per instance instead of once per vertex in the shader.
+struct InstanceData {
+    glm::mat4 world;
+    glm::mat3 normalMatrix;
+};
+
+// a vertex buffer that is refilled every frame with the transforms of all instances of a model.
+// the upload is a single orphan + sub data call no matter how many instances there are.
+class InstanceBuffer {
+public:
+    unsigned int VBO;
+    unsigned int count;
+
+    InstanceBuffer() : VBO(0), count(0), capacity(0) {}
+
+    void Upload(const vector<glm::mat4>& transforms)
+    {
+        data.resize(transforms.size());
+        for (unsigned int i = 0; i < transforms.size(); i++)
+        {
+            data[i].world = transforms[i];
+            data[i].normalMatrix = glm::transpose(glm::inverse(glm::mat3(transforms[i])));
+        }
+        count = static_cast<unsigned int>(data.size());
+
+        if (VBO == 0)
+        {
+            glGenBuffers(1, &VBO);
+            gpuMemory.Track(GPU_BUFFER, VBO, MEMORY_MODELS, "instance transforms");
+        }
+
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        if (count > capacity)
+        {
+            // grow geometrically so a slowly rising instance count doesn't reallocate every frame
+            capacity = std::max(count, capacity * 2);
+            TrackedBufferData(GL_ARRAY_BUFFER, VBO, capacity * sizeof(InstanceData), nullptr, GL_STREAM_DRAW);
+        }
+        else
+        {
+            // orphan the old storage so we don't wait for the GPU to finish reading last frame's data
+            glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(InstanceData), nullptr, GL_STREAM_DRAW);
+        }
+        if (count > 0)
+            glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(InstanceData), &data[0]);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    void Release()
+    {
+        DeleteTrackedBuffer(VBO);
+        count = capacity = 0;
+    }
+
+private:
+    unsigned int capacity;
+    vector<InstanceData> data;
+};
+
+// adds the per-instance attributes of an instance buffer to a vertex array object (which has to be bound)
+void SetupInstanceAttributes(unsigned int instanceVBO)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+    // world matrix, one vec4 column per location
+    for (unsigned int i = 0; i < 4; i++)
+    {
+        unsigned int location = INSTANCE_ATTRIB_LOCATION + i;
+        glEnableVertexAttribArray(location);
+        glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(offsetof(InstanceData, world) + sizeof(glm::vec4) * i));
+        glVertexAttribDivisor(location, 1);
+    }
+    // normal matrix, one vec3 column per location
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        unsigned int location = INSTANCE_ATTRIB_LOCATION + 4 + i;
+        glEnableVertexAttribArray(location);
+        glVertexAttribPointer(location, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(offsetof(InstanceData, normalMatrix) + sizeof(glm::vec3) * i));
+        glVertexAttribDivisor(location, 1);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+#endif
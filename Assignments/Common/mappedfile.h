@@ -0,0 +1,123 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cstddef>
+
+// a read only file mapped into memory. the OS pages the contents in on first access,
+// so nothing is copied into a buffer of our own.
+class MappedFile {
+public:
+    MappedFile() : data(nullptr), size(0)
+    {
+#ifdef _WIN32
+        file = INVALID_HANDLE_VALUE;
+        mapping = NULL;
+#endif
+    }
+
+    ~MappedFile()
+    {
+        Close();
+    }
+
+    bool Open(const char* path)
+    {
+        Close();
+#ifdef _WIN32
+        file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER fileSize;
+        GetFileSizeEx(file, &fileSize);
+        size = (size_t)fileSize.QuadPart;
+        if (size == 0)
+            return true;
+
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping == NULL)
+        {
+            Close();
+            return false;
+        }
+        data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+        int descriptor = open(path, O_RDONLY);
+        if (descriptor < 0)
+            return false;
+
+        struct stat info;
+        fstat(descriptor, &info);
+        size = (size_t)info.st_size;
+        if (size > 0)
+        {
+            void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+            data = mapped == MAP_FAILED ? nullptr : (const unsigned char*)mapped;
+        }
+        // the mapping stays valid after the descriptor is closed
+        close(descriptor);
+#endif
+        if (data == nullptr && size > 0)
+        {
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    void Close()
+    {
+#ifdef _WIN32
+        if (data)
+            UnmapViewOfFile(data);
+        if (mapping != NULL)
+            CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+        mapping = NULL;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (data)
+            munmap((void*)data, size);
+#endif
+        data = nullptr;
+        size = 0;
+    }
+
+    // tells the OS the whole mapping is about to be read, so it reads ahead in large sequential requests
+    // instead of faulting the pages in one by one. on windows the file is opened for sequential scans already
+    void WillNeed() const
+    {
+#ifndef _WIN32
+        if (data)
+            madvise((void*)data, size, MADV_WILLNEED);
+#endif
+    }
+
+    const unsigned char* Data() const { return data; }
+    size_t Size() const { return size; }
+
+private:
+    const unsigned char* data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+
+    // a mapping can't be shared between two owners
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+};
+#endif
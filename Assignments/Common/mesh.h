@@ -0,0 +1,444 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include <glad/glad.h> // holds all OpenGL type declarations
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "frustum.h"
+#include "glstate.h"
+#include "gpumemory.h"
+#include "instancing.h"
+#include "meshlet.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+using namespace std;
+
+#define MAX_BONE_INFLUENCE 4
+// size of the bone palette a skinned model can use
+#define MAX_BONES 100
+
+struct Vertex {
+    // position
+    glm::vec3 Position;
+    // normal
+    glm::vec3 Normal;
+    // texCoords
+    glm::vec2 TexCoords;
+    // tangent
+    glm::vec3 Tangent;
+    // bitangent
+    glm::vec3 Bitangent;
+    //bone indexes which will influence this vertex
+    int m_BoneIDs[MAX_BONE_INFLUENCE];
+    //weights from each bone
+    float m_Weights[MAX_BONE_INFLUENCE];
+};
+
+struct Texture {
+    unsigned int id;
+    string type;
+    string path;
+};
+
+// smallest index type that can address every vertex, 16 bit indices take half the memory and bandwidth
+GLenum ChooseIndexType(size_t vertexCount)
+{
+    return vertexCount <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+size_t IndexSize(GLenum indexType)
+{
+    return indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+}
+
+// fills the element buffer bound to GL_ELEMENT_ARRAY_BUFFER, narrowing the indices to indexType first
+void UploadIndexBuffer(GLuint EBO, const unsigned int* indices, size_t count, GLenum indexType, GLenum usage = GL_STATIC_DRAW)
+{
+    if (indexType == GL_UNSIGNED_SHORT)
+    {
+        vector<unsigned short> narrow(indices, indices + count);
+        TrackedBufferData(GL_ELEMENT_ARRAY_BUFFER, EBO, count * sizeof(unsigned short), count ? &narrow[0] : nullptr, usage);
+    }
+    else
+        TrackedBufferData(GL_ELEMENT_ARRAY_BUFFER, EBO, count * sizeof(unsigned int), indices, usage);
+}
+
+// units the model shaders sample texture_diffuse1, texture_specular1, texture_normal1, texture_roughness1
+// and texture_ao1 from, in that order
+#define MATERIAL_TEXTURE_UNITS 5
+
+// unit a mesh binds a texture of the given type to, -1 for types no shader samples
+int MaterialTextureUnit(const string& type)
+{
+    static const char* types[MATERIAL_TEXTURE_UNITS] = { "texture_diffuse", "texture_specular", "texture_normal", "texture_roughness", "texture_ao" };
+    for (int i = 0; i < MATERIAL_TEXTURE_UNITS; i++)
+    {
+        if (type == types[i])
+            return i;
+    }
+    return -1;
+}
+
+// optional maps of a material, the model shaders only sample the ones whose HAS_ define is set
+#define MATERIAL_HAS_SPECULAR  1
+#define MATERIAL_HAS_ROUGHNESS 2
+#define MATERIAL_HAS_AO        4
+
+class Mesh {
+public:
+    // mesh Data
+    vector<Vertex>       vertices;
+    vector<unsigned int> indices;
+    vector<Texture>      textures;
+    unsigned int VAO;
+    // type of the indices in the element buffer, picked from the vertex count when it is built
+    GLenum indexType;
+    // object space bounds, computed once at import
+    BoundingBox    bounds;
+    BoundingSphere sphere;
+    // clusters of the triangles, indices is sorted so each one is a contiguous range of it
+    vector<Meshlet> meshlets;
+
+    // constructor, pass upload = false to only keep the data on the CPU until Upload is called
+    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures, bool upload = true)
+    {
+        this->vertices = vertices;
+        this->indices = indices;
+        this->textures = textures;
+        this->instanceVBO = 0;
+
+        computeBounds();
+        buildMeshlets();
+
+        // now that we have all the required data, set the vertex buffers and its attribute pointers.
+        VAO = VBO = EBO = meshletEBO = 0;
+        meshletCapacity = 0;
+        visibleCount = 0;
+        culledBy = nullptr;
+        indexType = ChooseIndexType(this->vertices.size());
+        if (upload)
+            setupMesh();
+    }
+
+    // creates the GPU buffers for a mesh that was constructed without them
+    void Upload()
+    {
+        if (VAO == 0)
+            setupMesh();
+    }
+
+    // MATERIAL_HAS_ bits of the maps this mesh has a texture for, picks the shader variant it's drawn with
+    unsigned int MaterialFeatures() const
+    {
+        unsigned int features = 0;
+        for (unsigned int i = 0; i < textures.size(); i++)
+        {
+            if (textures[i].type == "texture_specular")
+                features |= MATERIAL_HAS_SPECULAR;
+            else if (textures[i].type == "texture_roughness")
+                features |= MATERIAL_HAS_ROUGHNESS;
+            else if (textures[i].type == "texture_ao")
+                features |= MATERIAL_HAS_AO;
+        }
+        return features;
+    }
+
+    // true if other has exactly the same vertices and indices
+    bool SameGeometry(const Mesh& other) const
+    {
+        return vertices.size() == other.vertices.size() && indices == other.indices
+            && (vertices.empty() || memcmp(&vertices[0], &other.vertices[0], vertices.size() * sizeof(Vertex)) == 0);
+    }
+
+    // takes over the data of other, a reimport of this mesh. the buffers are refilled in place,
+    // so the VAO and buffer names stay the same
+    void Replace(const Mesh& other)
+    {
+        vertices = other.vertices;
+        indices = other.indices;
+        textures = other.textures;
+        bounds = other.bounds;
+        sphere = other.sphere;
+        meshlets = other.meshlets;
+        // the index type follows the new vertex count even before the first upload, which uses it
+        indexType = ChooseIndexType(vertices.size());
+        culledBy = nullptr;
+        if (VAO == 0)
+            return;
+
+        glState.BindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        TrackedBufferData(GL_ARRAY_BUFFER, VBO, vertices.size() * sizeof(Vertex), vertices.empty() ? nullptr : &vertices[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        UploadIndexBuffer(EBO, indices.empty() ? nullptr : &indices[0], indices.size(), indexType);
+        glState.BindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // uploads the element buffer again with the indices as type, to compare it against the type the mesh picked
+    void SetIndexType(GLenum type)
+    {
+        indexType = type;
+        culledBy = nullptr;
+        if (VAO == 0)
+            return;
+
+        glState.BindVertexArray(VAO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        UploadIndexBuffer(EBO, indices.empty() ? nullptr : &indices[0], indices.size(), indexType);
+        glState.BindVertexArray(0);
+    }
+
+    // deletes the GPU buffers, the vertex data stays so the mesh can be uploaded again
+    void Release()
+    {
+        if (VAO)
+        {
+            glDeleteVertexArrays(1, &VAO);
+            glState.VertexArrayDeleted(VAO);
+        }
+        VAO = 0;
+        DeleteTrackedBuffer(VBO);
+        DeleteTrackedBuffer(EBO);
+        DeleteTrackedBuffer(meshletEBO);
+        meshletCapacity = 0;
+        culledBy = nullptr;
+        instanceVBO = 0;
+    }
+
+    // render the mesh. program has to be current, with its samplers on the units of MaterialTextureUnit
+    void Draw()
+    {
+        bindTextures();
+
+        DrawGeometry();
+    }
+
+    // draws the triangles only, for passes that bring their own program and don't sample the textures
+    void DrawGeometry()
+    {
+        glState.BindVertexArray(VAO);
+        // the VAO stays bound, the next draw of the same mesh doesn't have to bind it again
+        glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), indexType, 0);
+    }
+
+    // draws only the meshlets that are inside the frustum and face the camera. the culler compacts their
+    // indices into a buffer that is refilled when the view changes. frustum and camera are in object space.
+    void DrawMeshlets(MeshletCuller& culler, const Frustum& frustum, const glm::vec3& camera)
+    {
+        bindTextures();
+
+        DrawMeshletGeometry(culler, frustum, camera);
+    }
+
+    // DrawMeshlets without the textures, like DrawGeometry. the depth prepass and the shading pass draw with the
+    // same culler and view, so the second one reuses the indices the first one culled and uploaded
+    void DrawMeshletGeometry(MeshletCuller& culler, const Frustum& frustum, const glm::vec3& camera)
+    {
+        bool culled = culledBy == &culler && culledCamera == camera && memcmp(culledFrustum.planes, frustum.planes, sizeof(frustum.planes)) == 0;
+        if (culled && visibleCount == 0)
+            return;
+
+        glState.BindVertexArray(VAO);
+        if (meshletEBO == 0)
+        {
+            glGenBuffers(1, &meshletEBO);
+            gpuMemory.Track(GPU_BUFFER, meshletEBO, MEMORY_MODELS, "visible meshlet indices");
+        }
+        // the element buffer binding is part of the VAO, swap in the visible indices for this draw only
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshletEBO);
+        if (!culled)
+        {
+            visibleCount = culler.Cull(meshlets, indices, frustum, camera, visibleIndices);
+            uploadVisibleIndices();
+            culledBy = &culler;
+            culledFrustum = frustum;
+            culledCamera = camera;
+        }
+        if (visibleCount > 0)
+            glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(visibleCount), indexType, 0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    }
+
+    // render one copy of the mesh per instance in the buffer with a single draw call
+    void DrawInstanced(const InstanceBuffer& instances)
+    {
+        if (instances.count == 0)
+            return;
+
+        bindTextures();
+
+        DrawInstancedGeometry(instances);
+    }
+
+    // DrawInstanced without the textures, like DrawGeometry
+    void DrawInstancedGeometry(const InstanceBuffer& instances)
+    {
+        if (instances.count == 0)
+            return;
+
+        glState.BindVertexArray(VAO);
+        // the instance attributes only have to be pointed at the buffer once, it is refilled in place
+        if (instanceVBO != instances.VBO)
+        {
+            SetupInstanceAttributes(instances.VBO);
+            instanceVBO = instances.VBO;
+        }
+        glDrawElementsInstanced(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), indexType, 0, instances.count);
+    }
+
+private:
+    // render data 
+    unsigned int VBO, EBO;
+    // index buffer of DrawMeshlets, its size in bytes and how many indices it holds. the CPU side is kept
+    // between frames, with the 16 bit copy it is narrowed into, so refilling them doesn't allocate
+    unsigned int meshletEBO;
+    size_t meshletCapacity, visibleCount;
+    vector<unsigned int> visibleIndices;
+    vector<unsigned short> narrowIndices;
+    // what the indices in meshletEBO were culled with, a draw with the same culler and view skips culling
+    const MeshletCuller* culledBy;
+    Frustum culledFrustum;
+    glm::vec3 culledCamera;
+    // instance buffer currently hooked up to the VAO
+    unsigned int instanceVBO;
+
+    // refills meshletEBO, which has to be bound, with visibleIndices in the mesh's index type. the buffer is sized
+    // for every index of the mesh once and orphaned after that, like InstanceBuffer does
+    void uploadVisibleIndices()
+    {
+        size_t bytes = visibleCount * IndexSize(indexType);
+        if (bytes > meshletCapacity)
+        {
+            meshletCapacity = std::max(bytes, indices.size() * IndexSize(indexType));
+            TrackedBufferData(GL_ELEMENT_ARRAY_BUFFER, meshletEBO, meshletCapacity, nullptr, GL_STREAM_DRAW);
+        }
+        else
+        {
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, meshletCapacity, nullptr, GL_STREAM_DRAW);
+        }
+        if (visibleCount == 0)
+            return;
+
+        if (indexType == GL_UNSIGNED_SHORT)
+        {
+            narrowIndices.resize(visibleCount);
+            for (size_t i = 0; i < visibleCount; i++)
+                narrowIndices[i] = (unsigned short)visibleIndices[i];
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, bytes, &narrowIndices[0]);
+        }
+        else
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, bytes, &visibleIndices[0]);
+    }
+
+    // binds the first texture of every kind to its unit from MaterialTextureUnit. the programs' samplers point
+    // at those units once, when the program is set up, so a draw sets no uniforms
+    void bindTextures()
+    {
+        bool bound[MATERIAL_TEXTURE_UNITS] = {};
+        for (unsigned int i = 0; i < textures.size(); i++)
+        {
+            int unit = MaterialTextureUnit(textures[i].type);
+            if (unit < 0 || bound[unit])
+                continue;
+            // a unit that already holds the texture is left alone
+            glState.BindTexture(unit, GL_TEXTURE_2D, textures[i].id);
+            bound[unit] = true;
+        }
+    }
+
+    // computes an axis aligned box around all vertices and a sphere around the box center that encloses them
+    void computeBounds()
+    {
+        if (vertices.empty())
+        {
+            bounds.min = bounds.max = glm::vec3(0.0f);
+            sphere.center = glm::vec3(0.0f);
+            sphere.radius = 0.0f;
+            return;
+        }
+
+        bounds.min = bounds.max = vertices[0].Position;
+        for (unsigned int i = 1; i < vertices.size(); i++)
+        {
+            bounds.min = glm::min(bounds.min, vertices[i].Position);
+            bounds.max = glm::max(bounds.max, vertices[i].Position);
+        }
+
+        // the radius is measured against the actual vertices, which is tighter than half the box diagonal
+        sphere.center = (bounds.min + bounds.max) * 0.5f;
+        float radiusSq = 0.0f;
+        for (unsigned int i = 0; i < vertices.size(); i++)
+        {
+            glm::vec3 offset = vertices[i].Position - sphere.center;
+            radiusSq = std::max(radiusSq, glm::dot(offset, offset));
+        }
+        sphere.radius = sqrt(radiusSq);
+    }
+
+    // cuts the triangles into meshlets and puts the indices in meshlet order, which draws the same triangles
+    void buildMeshlets()
+    {
+        vector<glm::vec3> positions(vertices.size());
+        for (unsigned int i = 0; i < vertices.size(); i++)
+            positions[i] = vertices[i].Position;
+
+        vector<unsigned int> ordered;
+        meshlets = BuildMeshlets(positions, indices, ordered);
+        indices.swap(ordered);
+    }
+
+    // initializes all the buffer objects/arrays
+    void setupMesh()
+    {
+        // create buffers/arrays
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &EBO);
+        gpuMemory.Track(GPU_BUFFER, VBO, MEMORY_MODELS, "mesh vertices");
+        gpuMemory.Track(GPU_BUFFER, EBO, MEMORY_MODELS, "mesh indices");
+
+        glState.BindVertexArray(VAO);
+        // load data into vertex buffers
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        // A great thing about structs is that their memory layout is sequential for all its items.
+        // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
+        // again translates to 3/2 floats which translates to a byte array.
+        TrackedBufferData(GL_ARRAY_BUFFER, VBO, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        indexType = ChooseIndexType(vertices.size());
+        UploadIndexBuffer(EBO, &indices[0], indices.size(), indexType);
+
+        // set the vertex attribute pointers
+        // vertex Positions
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+        // vertex normals
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+        // vertex texture coords
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+        // vertex tangent
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
+        // vertex bitangent
+        glEnableVertexAttribArray(4);
+        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+        // ids
+        glEnableVertexAttribArray(5);
+        glVertexAttribIPointer(5, 4, GL_INT, sizeof(Vertex), (void*)offsetof(Vertex, m_BoneIDs));
+
+        // weights
+        glEnableVertexAttribArray(6);
+        glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, m_Weights));
+        glState.BindVertexArray(0);
+    }
+};
+#endif
\ No newline at end of file
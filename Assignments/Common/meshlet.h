@@ -0,0 +1,230 @@
+#ifndef MESHLET_H
+#define MESHLET_H
+
+#include <glm/glm.hpp>
+
+#include "frustum.h"
+#include "workerpool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+using namespace std;
+
+// cluster size limits, 64 vertices and 124 triangles is what mesh shader hardware is tuned for and
+// keeps the clusters small enough for their normal cones to be tight
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+
+// a small cluster of neighbouring triangles with its own bounds, so parts of a big mesh can be culled
+// instead of all or nothing
+struct Meshlet {
+    unsigned int firstIndex;    // first of the cluster's indices in the mesh's meshlet index list
+    unsigned int triangleCount;
+    BoundingSphere sphere;
+    // every triangle normal lies within the cone around axis. cutoff is the sine of the cone's half angle
+    // seen from the back, 1 or more when the cone is too wide for the cluster to ever be fully backfacing
+    glm::vec3 coneAxis;
+    float coneCutoff;
+};
+
+// closes the cluster made of the triangles in indices[first, first + count * 3)
+Meshlet finishMeshlet(const vector<glm::vec3>& positions, const vector<unsigned int>& indices, unsigned int first, unsigned int count)
+{
+    Meshlet meshlet;
+    meshlet.firstIndex = first;
+    meshlet.triangleCount = count;
+
+    glm::vec3 min = positions[indices[first]], max = min;
+    for (unsigned int i = first; i < first + count * 3; i++)
+    {
+        min = glm::min(min, positions[indices[i]]);
+        max = glm::max(max, positions[indices[i]]);
+    }
+    meshlet.sphere.center = (min + max) * 0.5f;
+    float radiusSq = 0.0f;
+    for (unsigned int i = first; i < first + count * 3; i++)
+    {
+        glm::vec3 offset = positions[indices[i]] - meshlet.sphere.center;
+        radiusSq = std::max(radiusSq, glm::dot(offset, offset));
+    }
+    meshlet.sphere.radius = sqrt(radiusSq);
+
+    // the cone axis is the average of the face normals, its opening the widest angle to any of them
+    vector<glm::vec3> normals;
+    glm::vec3 sum(0.0f);
+    for (unsigned int t = 0; t < count; t++)
+    {
+        const glm::vec3& a = positions[indices[first + t * 3]];
+        const glm::vec3& b = positions[indices[first + t * 3 + 1]];
+        const glm::vec3& c = positions[indices[first + t * 3 + 2]];
+        glm::vec3 normal = glm::cross(b - a, c - a);
+        float length = glm::length(normal);
+        if (length <= 1e-12f)
+            continue; // degenerate triangles face nowhere
+        normals.push_back(normal / length);
+        sum += normals.back();
+    }
+
+    meshlet.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+    meshlet.coneCutoff = 1.0f;
+    float sumLength = glm::length(sum);
+    if (normals.empty() || sumLength <= 1e-6f)
+        return meshlet;
+
+    meshlet.coneAxis = sum / sumLength;
+    float minDot = 1.0f;
+    for (unsigned int i = 0; i < normals.size(); i++)
+        minDot = std::min(minDot, glm::dot(normals[i], meshlet.coneAxis));
+
+    // past roughly 85 degrees the cone practically never culls, keep those clusters out of the test
+    if (minDot > 0.1f)
+        meshlet.coneCutoff = sqrt(1.0f - minDot * minDot);
+    return meshlet;
+}
+
+// cuts a triangle list into meshlets. triangles are taken in index order and a new cluster is started
+// whenever the next one would go over either limit, which keeps the clusters spatially coherent for
+// meshes whose indices are ordered for the vertex cache (assimp's import does that).
+// meshletIndices receives the triangles regrouped per cluster, ready to be copied into an index buffer.
+vector<Meshlet> BuildMeshlets(const vector<glm::vec3>& positions, const vector<unsigned int>& indices, vector<unsigned int>& meshletIndices)
+{
+    vector<Meshlet> meshlets;
+    meshletIndices.clear();
+    meshletIndices.reserve(indices.size());
+
+    // which cluster last used a vertex, so vertices shared within a cluster are only counted once
+    vector<int> usedBy(positions.size(), -1);
+    int current = 0;
+    unsigned int vertexCount = 0, triangleCount = 0, first = 0;
+
+    for (size_t t = 0; t + 2 < indices.size(); t += 3)
+    {
+        unsigned int newVertices = 0;
+        for (int k = 0; k < 3; k++)
+        {
+            if (usedBy[indices[t + k]] != current)
+                newVertices++;
+        }
+        // a triangle repeating a vertex would count it twice, that only makes the cluster a little smaller
+
+        if (triangleCount > 0 && (vertexCount + newVertices > MESHLET_MAX_VERTICES || triangleCount + 1 > MESHLET_MAX_TRIANGLES))
+        {
+            meshlets.push_back(finishMeshlet(positions, meshletIndices, first, triangleCount));
+            current++;
+            vertexCount = triangleCount = 0;
+            first = (unsigned int)meshletIndices.size();
+        }
+
+        for (int k = 0; k < 3; k++)
+        {
+            unsigned int index = indices[t + k];
+            if (usedBy[index] != current)
+            {
+                usedBy[index] = current;
+                vertexCount++;
+            }
+            meshletIndices.push_back(index);
+        }
+        triangleCount++;
+    }
+    if (triangleCount > 0)
+        meshlets.push_back(finishMeshlet(positions, meshletIndices, first, triangleCount));
+    return meshlets;
+}
+
+// true when every triangle of the cluster faces away from the camera (in the cluster's object space)
+inline bool IsMeshletBackfacing(const Meshlet& meshlet, const glm::vec3& camera)
+{
+    glm::vec3 toCenter = meshlet.sphere.center - camera;
+    return glm::dot(toCenter, meshlet.coneAxis) >= meshlet.coneCutoff * glm::length(toCenter) + meshlet.sphere.radius;
+}
+
+// clusters culled by one task of the worker pool
+#define MESHLET_CULL_GRAIN 256
+
+// culls meshlets against the frustum and their normal cones on the worker pool and compacts the
+// indices of the surviving clusters into one list for a single draw. keeps a running count of the
+// triangles rejected by each test.
+class MeshletCuller {
+public:
+    // triangles tested, rejected by the frustum and rejected by the backface cones since the last ResetStats
+    size_t trianglesTested, trianglesFrustumCulled, trianglesConeCulled;
+
+    MeshletCuller() : trianglesTested(0), trianglesFrustumCulled(0), trianglesConeCulled(0) {}
+
+    // writes the indices of the visible meshlets to visibleIndices and returns how many there are.
+    // frustum and camera have to be in the object space of the mesh, like the meshlet bounds.
+    size_t Cull(const vector<Meshlet>& meshlets, const vector<unsigned int>& meshletIndices, const Frustum& frustum, const glm::vec3& camera,
+                vector<unsigned int>& visibleIndices)
+    {
+        // a part per MESHLET_CULL_GRAIN clusters, a mesh smaller than that is culled on the calling thread
+        unsigned int count = (unsigned int)meshlets.size();
+        unsigned int partCount = (count + MESHLET_CULL_GRAIN - 1) / MESHLET_CULL_GRAIN;
+        parts.resize(partCount);
+        workerPool.ParallelFor(count, MESHLET_CULL_GRAIN, [&](unsigned int begin, unsigned int end) {
+            cullRange(meshlets, meshletIndices, frustum, camera, begin, end, parts[begin / MESHLET_CULL_GRAIN]);
+        });
+
+        // every part compacted its own range, stitching them together in order keeps the draw order stable
+        visibleIndices.clear();
+        for (unsigned int t = 0; t < partCount; t++)
+        {
+            visibleIndices.insert(visibleIndices.end(), parts[t].indices.begin(), parts[t].indices.end());
+            trianglesTested += parts[t].tested;
+            trianglesFrustumCulled += parts[t].frustumCulled;
+            trianglesConeCulled += parts[t].coneCulled;
+        }
+        return visibleIndices.size();
+    }
+
+    // share of the tested triangles the backface cones rejected, in percent
+    float ConeCulledPercentage() const
+    {
+        return trianglesTested > 0 ? 100.0f * trianglesConeCulled / trianglesTested : 0.0f;
+    }
+
+    float FrustumCulledPercentage() const
+    {
+        return trianglesTested > 0 ? 100.0f * trianglesFrustumCulled / trianglesTested : 0.0f;
+    }
+
+    void ResetStats()
+    {
+        trianglesTested = trianglesFrustumCulled = trianglesConeCulled = 0;
+    }
+
+private:
+    struct Part {
+        vector<unsigned int> indices;
+        size_t tested, frustumCulled, coneCulled;
+    };
+
+    // one output per part, kept between frames so the vectors don't reallocate
+    vector<Part> parts;
+
+    void cullRange(const vector<Meshlet>& meshlets, const vector<unsigned int>& meshletIndices, const Frustum& frustum, const glm::vec3& camera,
+                   unsigned int begin, unsigned int end, Part& part)
+    {
+        part.indices.clear();
+        part.tested = part.frustumCulled = part.coneCulled = 0;
+        for (unsigned int i = begin; i < end; i++)
+        {
+            const Meshlet& meshlet = meshlets[i];
+            part.tested += meshlet.triangleCount;
+            if (!frustum.IsSphereVisible(meshlet.sphere))
+            {
+                part.frustumCulled += meshlet.triangleCount;
+                continue;
+            }
+            if (IsMeshletBackfacing(meshlet, camera))
+            {
+                part.coneCulled += meshlet.triangleCount;
+                continue;
+            }
+            const unsigned int* first = &meshletIndices[meshlet.firstIndex];
+            part.indices.insert(part.indices.end(), first, first + meshlet.triangleCount * 3);
+        }
+    }
+};
+#endif
@@ -0,0 +1,277 @@
+#ifndef MIPGEN_H
+#define MIPGEN_H
+
+#include "workerpool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+using namespace std;
+
+// SSE2 is always there on x64, the scalar path is only for other targets
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MIPGEN_SSE
+#include <emmintrin.h>
+#endif
+
+enum MipFilter {
+    MIP_FILTER_BOX,   // 2x2 average, fastest
+    MIP_FILTER_KAISER // 6 tap Kaiser windowed sinc, keeps the smaller levels sharper without aliasing
+};
+
+// how the texels are interpreted while filtering
+enum MipContent {
+    MIP_LINEAR, // plain values, filtered as they are
+    MIP_SRGB,   // gamma encoded color, filtered in linear light. alpha is always linear
+    MIP_NORMAL  // normals in rgb, renormalized on every level
+};
+
+// filter used for every mip chain built on the CPU
+MipFilter mipFilter = MIP_FILTER_KAISER;
+
+struct MipLevel {
+    int width, height;
+    vector<unsigned char> data;
+};
+
+// conversions between 8 bit sRGB and linear values, built once
+struct MipTables {
+    float srgbToLinear[256];
+    unsigned char linearToSrgb[4096];
+
+    MipTables()
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            float c = i / 255.0f;
+            srgbToLinear[i] = c <= 0.04045f ? c / 12.92f : pow((c + 0.055f) / 1.055f, 2.4f);
+        }
+        for (int i = 0; i < 4096; i++)
+        {
+            float l = i / 4095.0f;
+            float s = l <= 0.0031308f ? l * 12.92f : 1.055f * pow(l, 1.0f / 2.4f) - 0.055f;
+            linearToSrgb[i] = (unsigned char)(s * 255.0f + 0.5f);
+        }
+    }
+};
+
+const MipTables& GetMipTables()
+{
+    static MipTables tables;
+    return tables;
+}
+
+// weights of a separable 2:1 reduction. output pixel x reads source pixels 2x + first ... 2x + first + taps - 1
+struct MipKernel {
+    int first;
+    int taps;
+    float weights[8];
+};
+
+float besselI0(float x)
+{
+    float sum = 1.0f, term = 1.0f;
+    for (int k = 1; k < 20; k++)
+    {
+        float t = x / (2.0f * k);
+        term *= t * t;
+        sum += term;
+    }
+    return sum;
+}
+
+MipKernel MakeMipKernel(MipFilter filter)
+{
+    MipKernel kernel;
+    if (filter == MIP_FILTER_BOX)
+    {
+        kernel.first = 0;
+        kernel.taps = 2;
+        kernel.weights[0] = kernel.weights[1] = 0.5f;
+        return kernel;
+    }
+
+    // sinc scaled for a reduction by 2, windowed to a radius of 3 source pixels
+    const float alpha = 4.0f, radius = 3.0f, pi = 3.14159265f;
+    kernel.first = -2;
+    kernel.taps = 6;
+    float sum = 0.0f;
+    for (int k = 0; k < kernel.taps; k++)
+    {
+        // distance from the source pixel center to the center of the output pixel
+        float d = k + kernel.first - 0.5f;
+        float x = pi * d * 0.5f;
+        float sinc = sin(x) / x;
+        float window = besselI0(alpha * sqrt(1.0f - (d / radius) * (d / radius))) / besselI0(alpha);
+        kernel.weights[k] = sinc * window;
+        sum += kernel.weights[k];
+    }
+    for (int k = 0; k < kernel.taps; k++)
+        kernel.weights[k] /= sum;
+    return kernel;
+}
+
+// out = the sum of weights[k] * sources[k], all four channels at once
+inline void filterPixel(const float* const* sources, const float* weights, int taps, float* out)
+{
+#ifdef MIPGEN_SSE
+    __m128 sum = _mm_setzero_ps();
+    for (int k = 0; k < taps; k++)
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(sources[k])));
+    _mm_storeu_ps(out, sum);
+#else
+    float r = 0.0f, g = 0.0f, b = 0.0f, a = 0.0f;
+    for (int k = 0; k < taps; k++)
+    {
+        r += weights[k] * sources[k][0];
+        g += weights[k] * sources[k][1];
+        b += weights[k] * sources[k][2];
+        a += weights[k] * sources[k][3];
+    }
+    out[0] = r; out[1] = g; out[2] = b; out[3] = a;
+#endif
+}
+
+// expands a row of 8 bit texels to linear RGBA floats
+void decodeMipRow(const unsigned char* row, int width, int channels, MipContent content, const MipTables& tables, float* out)
+{
+    for (int x = 0; x < width; x++)
+    {
+        const unsigned char* texel = row + x * channels;
+        float* pixel = out + x * 4;
+        pixel[0] = pixel[1] = pixel[2] = 0.0f;
+        pixel[3] = 1.0f;
+        for (int c = 0; c < channels; c++)
+        {
+            if (content == MIP_SRGB && c < 3)
+                pixel[c] = tables.srgbToLinear[texel[c]];
+            else if (content == MIP_NORMAL && c < 3)
+                pixel[c] = texel[c] / 127.5f - 1.0f;
+            else
+                pixel[c] = texel[c] / 255.0f;
+        }
+    }
+}
+
+// renormalizes normals and writes a finished row of floats back as 8 bit texels
+void encodeMipRow(float* row, int width, int channels, MipContent content, const MipTables& tables, unsigned char* out)
+{
+    for (int x = 0; x < width; x++)
+    {
+        float* pixel = row + x * 4;
+        unsigned char* texel = out + x * channels;
+        if (content == MIP_NORMAL)
+        {
+            // averaged normals get shorter, which would darken the lighting on distant surfaces
+            float length = sqrt(pixel[0] * pixel[0] + pixel[1] * pixel[1] + pixel[2] * pixel[2]);
+            float scale = length > 1e-6f ? 1.0f / length : 0.0f;
+            pixel[0] *= scale;
+            pixel[1] *= scale;
+            pixel[2] = length > 1e-6f ? pixel[2] * scale : 1.0f;
+        }
+        for (int c = 0; c < channels; c++)
+        {
+            float value = pixel[c];
+            if (content == MIP_SRGB && c < 3)
+                texel[c] = tables.linearToSrgb[(int)(std::min(std::max(value, 0.0f), 1.0f) * 4095.0f + 0.5f)];
+            else if (content == MIP_NORMAL && c < 3)
+                texel[c] = (unsigned char)(std::min(std::max(value * 127.5f + 127.5f, 0.0f), 255.0f) + 0.5f);
+            else
+                texel[c] = (unsigned char)(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+        }
+    }
+}
+
+// runs function(begin, end) over ranges of 32 rows on the worker pool, smaller levels stay on the calling thread
+template<typename Function>
+void parallelRows(int rows, Function function)
+{
+    workerPool.ParallelFor((unsigned int)rows, 32, [&function](unsigned int begin, unsigned int end) {
+        function((int)begin, (int)end);
+    });
+}
+
+// horizontally filtered source rows are kept in a small ring, a row is shared by several output rows
+#define MIP_RING_ROWS 8
+
+// halves one level. the source is either the 8 bit base image (bytes) or the float result of the
+// previous level (floats), result receives the new level as floats for the next reduction.
+void downsampleLevel(const unsigned char* bytes, const float* floats, int width, int height, int channels,
+                     MipContent content, const MipKernel& kernel, MipLevel& level, vector<float>& result)
+{
+    int outWidth = level.width, outHeight = level.height;
+    parallelRows(outHeight, [&](int begin, int end) {
+        const MipTables& tables = GetMipTables();
+        vector<float> decoded(bytes ? width * 4 : 0);
+        vector<float> ring((size_t)MIP_RING_ROWS * outWidth * 4);
+        int ringRow[MIP_RING_ROWS];
+        std::fill(ringRow, ringRow + MIP_RING_ROWS, -1);
+
+        const float* rows[8];
+        const float* sources[8];
+        for (int y = begin; y < end; y++)
+        {
+            for (int k = 0; k < kernel.taps; k++)
+            {
+                int row = std::min(std::max(2 * y + kernel.first + k, 0), height - 1);
+                int slot = row % MIP_RING_ROWS;
+                float* filtered = &ring[(size_t)slot * outWidth * 4];
+                if (ringRow[slot] != row)
+                {
+                    const float* source = floats ? floats + (size_t)row * width * 4 : &decoded[0];
+                    if (!floats)
+                        decodeMipRow(bytes + (size_t)row * width * channels, width, channels, content, tables, &decoded[0]);
+
+                    for (int x = 0; x < outWidth; x++)
+                    {
+                        for (int j = 0; j < kernel.taps; j++)
+                            sources[j] = source + std::min(std::max(2 * x + kernel.first + j, 0), width - 1) * 4;
+                        filterPixel(sources, kernel.weights, kernel.taps, filtered + x * 4);
+                    }
+                    ringRow[slot] = row;
+                }
+                rows[k] = filtered;
+            }
+
+            float* out = &result[(size_t)y * outWidth * 4];
+            for (int x = 0; x < outWidth; x++)
+            {
+                for (int k = 0; k < kernel.taps; k++)
+                    sources[k] = rows[k] + x * 4;
+                filterPixel(sources, kernel.weights, kernel.taps, out + x * 4);
+            }
+            encodeMipRow(out, outWidth, channels, content, tables, &level.data[(size_t)y * outWidth * channels]);
+        }
+    });
+}
+
+// builds every level below the base image down to 1x1. each level is filtered from the float result of
+// the one above it, so rounding to 8 bits doesn't add up along the chain.
+vector<MipLevel> GenerateMipmaps(const unsigned char* pixels, int width, int height, int channels, MipContent content, MipFilter filter)
+{
+    // two channel normal maps have no z to renormalize with
+    if (content == MIP_NORMAL && channels < 3)
+        content = MIP_LINEAR;
+
+    MipKernel kernel = MakeMipKernel(filter);
+    vector<MipLevel> levels;
+    vector<float> current, next;
+    while (width > 1 || height > 1)
+    {
+        MipLevel level;
+        level.width = std::max(1, width / 2);
+        level.height = std::max(1, height / 2);
+        level.data.resize((size_t)level.width * level.height * channels);
+        next.resize((size_t)level.width * level.height * 4);
+
+        downsampleLevel(levels.empty() ? pixels : nullptr, levels.empty() ? nullptr : &current[0],
+                        width, height, channels, content, kernel, level, next);
+
+        width = level.width;
+        height = level.height;
+        levels.push_back(std::move(level));
+        current.swap(next);
+    }
+    return levels;
+}
+#endif
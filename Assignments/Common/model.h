@@ -0,0 +1,842 @@
+#ifndef MODEL_H
+#define MODEL_H
+
+#include <glad/glad.h> 
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "stb_image.h"
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+
+#include "mesh.h"
+#include "frustum.h"
+#include "renderqueue.h"
+#include "texstream.h"
+#include "texarray.h"
+#include "vfs.h"
+#include "workerpool.h"
+
+#include <string>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <iostream>
+#include <map>
+#include <vector>
+using namespace std;
+
+// a bone referenced by the meshes: its index into the bone palette and the matrix that takes
+// a vertex from mesh space into the bone's space
+struct BoneInfo {
+    int id;
+    glm::mat4 offset;
+};
+
+// assimp matrices are row major, glm's are column major
+glm::mat4 AssimpToGlm(const aiMatrix4x4& from)
+{
+    glm::mat4 to;
+    to[0][0] = from.a1; to[1][0] = from.a2; to[2][0] = from.a3; to[3][0] = from.a4;
+    to[0][1] = from.b1; to[1][1] = from.b2; to[2][1] = from.b3; to[3][1] = from.b4;
+    to[0][2] = from.c1; to[1][2] = from.c2; to[2][2] = from.c3; to[3][2] = from.c4;
+    to[0][3] = from.d1; to[1][3] = from.d2; to[2][3] = from.d3; to[3][3] = from.d4;
+    return to;
+}
+
+// an image prepared on the CPU (decoded and converted, or mapped from the texture cache), waiting to be uploaded
+struct DecodedImage {
+    string path;
+    TextureUsage usage;
+    TextureData texture;
+};
+
+DecodedImage DecodeImage(const char* path, const string& directory, TextureUsage usage, bool flip = false);
+unsigned int UploadTexture(DecodedImage& image, unsigned int textureID = 0);
+unsigned int TextureFromFile(const char* path, const string& directory, bool gamma = false, TextureUsage usage = TEXTURE_COLOR, bool flip = false);
+
+class Model
+{
+public:
+    // model data 
+    vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
+    vector<Mesh>    meshes;
+    string directory;
+    bool gammaCorrection;
+    // object space bounds of the whole model, the union of all mesh bounds
+    BoundingBox    bounds;
+    BoundingSphere sphere;
+    // true once all meshes and textures exist on the GPU and the model can be drawn
+    bool ready;
+    // bones used by the meshes, by name, filled while importing
+    map<string, BoneInfo> boneInfoMap;
+    int boneCounter;
+    // goes up every time ApplyReload changed the model
+    unsigned int version;
+
+    // constructor, expects a filepath to a 3D model.
+    Model(string const& path, bool gamma = false, bool flipTextures = false) : gammaCorrection(gamma), ready(false), boneCounter(0), version(0), deferUpload(false), flipTextures(flipTextures)
+    {
+        loadModel(path);
+        ready = true;
+    }
+
+    // empty model to be filled later by LoadDeferred and FinishUpload
+    Model() : gammaCorrection(false), ready(false), boneCounter(0), version(0), deferUpload(true), flipTextures(false)
+    {
+        bounds.min = bounds.max = glm::vec3(0.0f);
+        sphere.center = glm::vec3(0.0f);
+        sphere.radius = 0.0f;
+    }
+
+    // CPU half of loading: runs the import and decodes every texture without touching OpenGL,
+    // so it can run on a worker thread. FinishUpload has to be called on the GL thread afterwards.
+    void LoadDeferred(string const& path, bool flip = false)
+    {
+        ImportDeferred(path, flip);
+
+        // the images don't depend on each other, decode them in parallel
+        workerPool.ParallelFor((unsigned int)pendingImages.size(), 1, [this](unsigned int begin, unsigned int end) {
+            for (unsigned int i = begin; i < end; i++)
+                pendingImages[i] = DecodeImage(pendingImages[i].path.c_str(), directory, pendingImages[i].usage, flipTextures);
+        });
+    }
+
+    // only the import part of LoadDeferred, the images are left for whoever uses the result (see ApplyReload)
+    void ImportDeferred(string const& path, bool flip = false)
+    {
+        deferUpload = true;
+        flipTextures = flip;
+        loadModel(path);
+    }
+
+    // GL half of loading: creates the textures and buffers from the data LoadDeferred produced.
+    // with a streamer the textures only start out with a placeholder and get their levels over the next frames.
+    void FinishUpload(TextureStreamer* streamer = nullptr)
+    {
+        for (unsigned int i = 0; i < pendingImages.size(); i++)
+        {
+            unsigned int id;
+            if (streamer && !pendingImages[i].texture.Empty())
+            {
+                id = streamer->Stream(pendingImages[i].texture, pendingImages[i].usage, MEMORY_MODELS, directory + '/' + pendingImages[i].path);
+                pendingImages[i].texture = TextureData();
+            }
+            else
+            {
+                id = UploadTexture(pendingImages[i]);
+            }
+
+            // the meshes hold copies of the texture structs, patch every one that refers to this image
+            for (unsigned int j = 0; j < textures_loaded.size(); j++)
+            {
+                if (textures_loaded[j].path == pendingImages[i].path)
+                    textures_loaded[j].id = id;
+            }
+            for (unsigned int j = 0; j < meshes.size(); j++)
+            {
+                for (unsigned int k = 0; k < meshes[j].textures.size(); k++)
+                {
+                    if (meshes[j].textures[k].path == pendingImages[i].path)
+                        meshes[j].textures[k].id = id;
+                }
+            }
+        }
+        pendingImages.clear();
+
+        for (unsigned int i = 0; i < meshes.size(); i++)
+            meshes[i].Upload();
+
+        ready = true;
+    }
+
+    // takes over a fresh import of the same file (ImportDeferred) after it changed on disk. meshes whose
+    // geometry is the same are left alone, changed ones are refilled in their existing buffers and only
+    // textures the model didn't use before are loaded. the model and its GL objects stay valid throughout.
+    void ApplyReload(Model& fresh, TextureStreamer* streamer = nullptr)
+    {
+        // a file caught halfway through being saved doesn't import, keep what there is
+        if (fresh.meshes.empty())
+            return;
+
+        for (unsigned int i = 0; i < fresh.pendingImages.size(); i++)
+        {
+            const DecodedImage& pending = fresh.pendingImages[i];
+            if (findTexture(pending.path) != nullptr)
+                continue;
+
+            DecodedImage image = DecodeImage(pending.path.c_str(), directory, pending.usage, flipTextures);
+            Texture texture;
+            if (streamer && !image.texture.Empty())
+                texture.id = streamer->Stream(image.texture, image.usage, MEMORY_MODELS, directory + '/' + image.path);
+            else
+                texture.id = UploadTexture(image);
+            texture.path = pending.path;
+            for (unsigned int j = 0; j < fresh.textures_loaded.size(); j++)
+            {
+                if (fresh.textures_loaded[j].path == pending.path)
+                    texture.type = fresh.textures_loaded[j].type;
+            }
+            textures_loaded.push_back(texture);
+        }
+        fresh.pendingImages.clear();
+
+        unsigned int changed = 0;
+        for (unsigned int i = 0; i < fresh.meshes.size(); i++)
+        {
+            Mesh& mesh = fresh.meshes[i];
+            for (unsigned int j = 0; j < mesh.textures.size(); j++)
+                mesh.textures[j].id = findTexture(mesh.textures[j].path)->id;
+
+            if (i >= meshes.size())
+            {
+                meshes.push_back(mesh);
+                meshes.back().Upload();
+                changed++;
+            }
+            else if (!meshes[i].SameGeometry(mesh))
+            {
+                meshes[i].Replace(mesh);
+                changed++;
+            }
+            else
+                meshes[i].textures = mesh.textures; // the material may have changed all the same
+        }
+        while (meshes.size() > fresh.meshes.size())
+        {
+            meshes.back().Release();
+            meshes.pop_back();
+            changed++;
+        }
+
+        // meshes that are new to the packed materials draw without textures until PackMaterials runs again
+        if (!meshMaterials.empty())
+            meshMaterials.resize(meshes.size());
+        boneInfoMap = fresh.boneInfoMap;
+        boneCounter = fresh.boneCounter;
+        computeBounds();
+        version++;
+
+        std::cout << "Reloaded " << directory << ": " << changed << " of " << meshes.size() << " meshes changed" << std::endl;
+    }
+
+    // decodes a texture file of this model again and swaps it into the texture that already uses it.
+    // path is the full path, as TexturePaths returns it. false if the model doesn't use the file
+    bool ReloadTexture(const string& path, TextureStreamer* streamer = nullptr)
+    {
+        for (unsigned int i = 0; i < textures_loaded.size(); i++)
+        {
+            const Texture& texture = textures_loaded[i];
+            if (directory + '/' + texture.path != path)
+                continue;
+            // released while the material arrays stand in, they reload their own copy
+            if (texture.id == 0)
+                return true;
+
+            DecodedImage image = DecodeImage(texture.path.c_str(), directory, texture.type == "texture_normal" ? TEXTURE_NORMAL : TEXTURE_COLOR, flipTextures);
+            if (image.texture.Empty())
+            {
+                std::cout << "Texture failed to load at path: " << path << std::endl;
+                return false;
+            }
+            if (streamer && streamer->Data(texture.id))
+                streamer->Replace(texture.id, image.texture);
+            else
+                UploadTexture(image, texture.id);
+            return true;
+        }
+        return false;
+    }
+
+    // deletes the textures of the meshes while the packed material arrays stand in for them, so the maps
+    // aren't in video memory twice. the meshes keep the paths and types, RestoreTextures loads them again
+    void ReleaseTextures(TextureStreamer* streamer = nullptr)
+    {
+        for (unsigned int i = 0; i < textures_loaded.size(); i++)
+        {
+            if (textures_loaded[i].id == 0)
+                continue;
+            if (streamer)
+                streamer->Release(textures_loaded[i].id);
+            else
+                DeleteTrackedTexture(textures_loaded[i].id);
+            textures_loaded[i].id = 0;
+        }
+        for (unsigned int i = 0; i < meshes.size(); i++)
+        {
+            for (unsigned int j = 0; j < meshes[i].textures.size(); j++)
+                meshes[i].textures[j].id = 0;
+        }
+    }
+
+    // loads the textures ReleaseTextures deleted again, nothing happens when they are all there
+    void RestoreTextures(TextureStreamer* streamer = nullptr)
+    {
+        vector<unsigned int> missing;
+        for (unsigned int i = 0; i < textures_loaded.size(); i++)
+        {
+            if (textures_loaded[i].id == 0)
+                missing.push_back(i);
+        }
+        if (missing.empty())
+            return;
+
+        vector<DecodedImage> images(missing.size());
+        workerPool.ParallelFor((unsigned int)missing.size(), 1, [this, &images, &missing](unsigned int begin, unsigned int end) {
+            for (unsigned int i = begin; i < end; i++)
+            {
+                const Texture& texture = textures_loaded[missing[i]];
+                images[i] = DecodeImage(texture.path.c_str(), directory, texture.type == "texture_normal" ? TEXTURE_NORMAL : TEXTURE_COLOR, flipTextures);
+            }
+        });
+
+        for (unsigned int i = 0; i < missing.size(); i++)
+        {
+            Texture& texture = textures_loaded[missing[i]];
+            if (streamer && !images[i].texture.Empty())
+                texture.id = streamer->Stream(images[i].texture, images[i].usage, MEMORY_MODELS, directory + '/' + images[i].path);
+            else
+                texture.id = UploadTexture(images[i]);
+        }
+        for (unsigned int i = 0; i < meshes.size(); i++)
+        {
+            for (unsigned int j = 0; j < meshes[i].textures.size(); j++)
+                meshes[i].textures[j].id = findTexture(meshes[i].textures[j].path)->id;
+        }
+    }
+
+    // the files of every texture the model uses
+    vector<string> TexturePaths() const
+    {
+        vector<string> paths;
+        for (unsigned int i = 0; i < textures_loaded.size(); i++)
+            paths.push_back(directory + '/' + textures_loaded[i].path);
+        return paths;
+    }
+
+    // deletes the textures and buffers of the model. textures that were streamed have to go back
+    // through the same streamer so it forgets their source data.
+    void Release(TextureStreamer* streamer = nullptr)
+    {
+        for (unsigned int i = 0; i < textures_loaded.size(); i++)
+        {
+            if (streamer)
+                streamer->Release(textures_loaded[i].id);
+            else
+                DeleteTrackedTexture(textures_loaded[i].id);
+            textures_loaded[i].id = 0;
+        }
+        for (unsigned int i = 0; i < meshes.size(); i++)
+        {
+            for (unsigned int j = 0; j < meshes[i].textures.size(); j++)
+                meshes[i].textures[j].id = 0;
+            meshes[i].Release();
+        }
+        ready = false;
+    }
+
+    // draws the model, and thus all its meshes
+    void Draw()
+    {
+        for (unsigned int i = 0; i < meshes.size(); i++)
+            meshes[i].Draw();
+    }
+
+    // draws only the meshes that intersect the frustum. the frustum has to be built from
+    // projection * view * world so its planes are in the object space of this model.
+    // with a culler the visible meshes are culled again per meshlet, camera is then the camera position
+    // in object space (the cone test assumes the world matrix scales uniformly).
+    void Draw(const Frustum& frustum, MeshletCuller* culler = nullptr, const glm::vec3& camera = glm::vec3(0.0f))
+    {
+        if (!frustum.IsBoxVisible(bounds))
+            return;
+
+        CullSpheres(frustum, meshSpheres, meshVisible);
+        for (unsigned int i = 0; i < meshes.size(); i++)
+        {
+            if (!meshVisible[i])
+                continue;
+            if (culler)
+                meshes[i].DrawMeshlets(*culler, frustum, camera);
+            else
+                meshes[i].Draw();
+        }
+    }
+
+    // picks the program of a mesh from its MATERIAL_HAS_ bits, makes it current and returns it
+    typedef function<unsigned int(unsigned int features)> ProgramSelector;
+
+    // like Draw, but every visible mesh is drawn with the program select gives it for its material
+    void DrawVariants(const ProgramSelector& select, const Frustum& frustum, MeshletCuller* culler = nullptr, const glm::vec3& camera = glm::vec3(0.0f))
+    {
+        if (!frustum.IsBoxVisible(bounds))
+            return;
+
+        CullSpheres(frustum, meshSpheres, meshVisible);
+        for (unsigned int i = 0; i < meshes.size(); i++)
+        {
+            if (!meshVisible[i])
+                continue;
+            select(meshes[i].MaterialFeatures());
+            if (culler)
+                meshes[i].DrawMeshlets(*culler, frustum, camera);
+            else
+                meshes[i].Draw();
+        }
+    }
+
+    // puts the textures of every mesh into the packer's arrays and remembers their layers in meshMaterials.
+    // the model has to be ready, packer.Build uploads the arrays afterwards.
+    void PackMaterials(MaterialPacker& packer)
+    {
+        meshMaterials.assign(meshes.size(), MeshMaterial());
+        for (unsigned int i = 0; i < meshes.size(); i++)
+        {
+            for (unsigned int j = 0; j < meshes[i].textures.size(); j++)
+            {
+                const Texture& texture = meshes[i].textures[j];
+                int slot = -1;
+                if (texture.type == "texture_diffuse") slot = MATERIAL_DIFFUSE;
+                else if (texture.type == "texture_specular") slot = MATERIAL_SPECULAR;
+                else if (texture.type == "texture_normal") slot = MATERIAL_NORMAL;
+                else if (texture.type == "texture_roughness") slot = MATERIAL_ROUGHNESS;
+                else if (texture.type == "texture_ao") slot = MATERIAL_AO;
+
+                // only the first texture of each kind is sampled, like texture_diffuse1 in the regular shader
+                if (slot < 0 || meshMaterials[i].layers[slot].array >= 0)
+                    continue;
+
+                TextureUsage usage = slot == MATERIAL_NORMAL ? TEXTURE_NORMAL : TEXTURE_COLOR;
+                meshMaterials[i].layers[slot] = packer.Add(directory + '/' + texture.path, usage, flipTextures);
+            }
+        }
+    }
+
+    // draws the visible meshes with the packed material program. the packer's arrays have to be bound already,
+    // every mesh only sets which layers it uses, so no textures change between meshes or models.
+    void DrawPacked(ShaderProgram& program, const Frustum& frustum, MeshletCuller* culler = nullptr, const glm::vec3& camera = glm::vec3(0.0f))
+    {
+        if (!frustum.IsBoxVisible(bounds) || meshMaterials.size() != meshes.size())
+            return;
+
+        CullSpheres(frustum, meshSpheres, meshVisible);
+        for (unsigned int i = 0; i < meshes.size(); i++)
+        {
+            if (!meshVisible[i])
+                continue;
+            MaterialPacker::SetMaterial(program, meshMaterials[i]);
+            if (culler)
+                meshes[i].DrawMeshletGeometry(*culler, frustum, camera);
+            else
+                meshes[i].DrawGeometry();
+        }
+    }
+
+    // the program a mesh is going to be drawn with, from its MATERIAL_HAS_ bits, without making it current
+    typedef function<unsigned int(unsigned int features)> ProgramLookup;
+
+    // queues the meshes DrawVariants would draw. lookup gives the program for the key, select runs when the
+    // draw comes up and sets the per object uniforms. the distance of a mesh is measured from eye, in world
+    // space, to the center of its sphere moved by world. in PASS_DEPTH only the geometry is drawn. scope is
+    // the name the draws are timed under in the profiler. select, frustum and camera are copied once into the
+    // queue, each mesh only queues its index
+    void SubmitVariants(RenderQueue& queue, RenderPass pass, const ProgramLookup& lookup, const ProgramSelector& select, const glm::mat4& world, const glm::vec3& eye,
+                        const Frustum& frustum, MeshletCuller* culler = nullptr, const glm::vec3& camera = glm::vec3(0.0f), const char* scope = "model")
+    {
+        if (!frustum.IsBoxVisible(bounds))
+            return;
+
+        CullSpheres(frustum, meshSpheres, meshVisible);
+        bool textured = pass != PASS_DEPTH;
+        const SubmittedDraw* shared = nullptr;
+        for (unsigned int i = 0; i < meshes.size(); i++)
+        {
+            if (!meshVisible[i])
+                continue;
+            if (!shared)
+                shared = queue.Keep(SubmittedDraw{ this, select, frustum, culler, camera, nullptr, textured });
+            const Mesh& mesh = meshes[i];
+            float distance = glm::length(glm::vec3(world * glm::vec4(mesh.sphere.center, 1.0f)) - eye);
+            queue.Submit(pass, lookup(mesh.MaterialFeatures()), textured ? materialKey(mesh) : 0, mesh.VAO, distance, drawSubmitted, shared, i, scope);
+        }
+    }
+
+    // queues one instanced draw per mesh, with the program select picks for it, all of them at the given
+    // distance. instances has to stay valid until the queue is flushed
+    void SubmitInstancedVariants(RenderQueue& queue, RenderPass pass, const ProgramLookup& lookup, const ProgramSelector& select, const InstanceBuffer& instances, float distance,
+                                 const char* scope = "instanced models")
+    {
+        if (instances.count == 0 || meshes.empty())
+            return;
+
+        bool textured = pass != PASS_DEPTH;
+        const SubmittedDraw* shared = queue.Keep(SubmittedDraw{ this, select, Frustum(), nullptr, glm::vec3(0.0f), &instances, textured });
+        for (unsigned int i = 0; i < meshes.size(); i++)
+        {
+            const Mesh& mesh = meshes[i];
+            queue.Submit(pass, lookup(mesh.MaterialFeatures()), textured ? materialKey(mesh) : 0, mesh.VAO, distance, drawSubmitted, shared, i, scope);
+        }
+    }
+
+private:
+    // when set the import only produces CPU data, see LoadDeferred
+    bool deferUpload;
+    // flip the textures vertically while decoding
+    bool flipTextures;
+    // images decoded by LoadDeferred that still need a texture
+    vector<DecodedImage> pendingImages;
+    // array layers of every mesh's textures, filled by PackMaterials
+    vector<MeshMaterial> meshMaterials;
+
+    // per mesh bounding spheres in the layout CullSpheres expects, and its output
+    SphereList meshSpheres;
+    vector<unsigned char> meshVisible;
+
+    // what all the draws of one SubmitVariants or SubmitInstancedVariants call share
+    struct SubmittedDraw {
+        Model* model;
+        ProgramSelector select;
+        Frustum frustum;
+        MeshletCuller* culler;
+        glm::vec3 camera;
+        const InstanceBuffer* instances; // set for instanced draws
+        bool textured;
+    };
+
+    // the RenderQueue::DrawFunction of the submitted meshes, index is the mesh
+    static void drawSubmitted(const void* data, unsigned int index)
+    {
+        const SubmittedDraw& draw = *(const SubmittedDraw*)data;
+        Mesh& mesh = draw.model->meshes[index];
+        draw.select(mesh.MaterialFeatures());
+        if (draw.instances && draw.textured)
+            mesh.DrawInstanced(*draw.instances);
+        else if (draw.instances)
+            mesh.DrawInstancedGeometry(*draw.instances);
+        else if (draw.culler && draw.textured)
+            mesh.DrawMeshlets(*draw.culler, draw.frustum, draw.camera);
+        else if (draw.culler)
+            mesh.DrawMeshletGeometry(*draw.culler, draw.frustum, draw.camera);
+        else if (draw.textured)
+            mesh.Draw();
+        else
+            mesh.DrawGeometry();
+    }
+
+    static unsigned int materialKey(const Mesh& mesh)
+    {
+        GLuint textures[16];
+        unsigned int count = (unsigned int)min(mesh.textures.size(), (size_t)16);
+        for (unsigned int i = 0; i < count; i++)
+            textures[i] = mesh.textures[i].id;
+        return RenderQueue::MaterialKey(textures, count);
+    }
+
+    Texture* findTexture(const string& path)
+    {
+        for (unsigned int i = 0; i < textures_loaded.size(); i++)
+        {
+            if (textures_loaded[i].path == path)
+                return &textures_loaded[i];
+        }
+        return nullptr;
+    }
+
+    // merges the mesh bounds into the model bounds and fills the sphere list used for culling
+    void computeBounds()
+    {
+        meshSpheres.Clear();
+        bounds.min = bounds.max = glm::vec3(0.0f);
+        for (unsigned int i = 0; i < meshes.size(); i++)
+        {
+            if (i == 0)
+                bounds = meshes[i].bounds;
+            bounds.min = glm::min(bounds.min, meshes[i].bounds.min);
+            bounds.max = glm::max(bounds.max, meshes[i].bounds.max);
+            meshSpheres.Add(meshes[i].sphere);
+        }
+
+        // enclose every mesh sphere in one sphere around the box center
+        sphere.center = (bounds.min + bounds.max) * 0.5f;
+        sphere.radius = 0.0f;
+        for (unsigned int i = 0; i < meshes.size(); i++)
+            sphere.radius = std::max(sphere.radius, glm::length(meshes[i].sphere.center - sphere.center) + meshes[i].sphere.radius);
+    }
+
+    // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
+    void loadModel(string const& path)
+    {
+        // read file via ASSIMP
+        Assimp::Importer importer;
+        // the model and its material files come from the pack when there is one
+        importer.SetIOHandler(new AssetIOSystem());
+        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace | aiProcess_LimitBoneWeights);
+        // check for errors
+        if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
+        {
+            cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
+            return;
+        }
+        // retrieve the directory path of the filepath
+        directory = path.substr(0, path.find_last_of('/'));
+
+        // process ASSIMP's root node recursively
+        processNode(scene->mRootNode, scene);
+
+        computeBounds();
+    }
+
+    // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
+    void processNode(aiNode* node, const aiScene* scene)
+    {
+        // process each mesh located at the current node
+        for (unsigned int i = 0; i < node->mNumMeshes; i++)
+        {
+            // the node object only contains indices to index the actual objects in the scene. 
+            // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
+            aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
+            meshes.push_back(processMesh(mesh, scene));
+        }
+        // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
+        for (unsigned int i = 0; i < node->mNumChildren; i++)
+        {
+            processNode(node->mChildren[i], scene);
+        }
+
+    }
+
+    Mesh processMesh(aiMesh* mesh, const aiScene* scene)
+    {
+        // data to fill
+        vector<Vertex> vertices;
+        vector<unsigned int> indices;
+        vector<Texture> textures;
+
+        // walk through each of the mesh's vertices
+        for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+        {
+            Vertex vertex;
+            // no bone influences until extractBoneWeights fills them in
+            for (int j = 0; j < MAX_BONE_INFLUENCE; j++)
+            {
+                vertex.m_BoneIDs[j] = -1;
+                vertex.m_Weights[j] = 0.0f;
+            }
+            glm::vec3 vector; // we declare a placeholder vector since assimp uses its own vector class that doesn't directly convert to glm's vec3 class so we transfer the data to this placeholder glm::vec3 first.
+            // positions
+            vector.x = mesh->mVertices[i].x;
+            vector.y = mesh->mVertices[i].y;
+            vector.z = mesh->mVertices[i].z;
+            vertex.Position = vector;
+            // normals
+            if (mesh->HasNormals())
+            {
+                vector.x = mesh->mNormals[i].x;
+                vector.y = mesh->mNormals[i].y;
+                vector.z = mesh->mNormals[i].z;
+                vertex.Normal = vector;
+            }
+            // texture coordinates
+            if (mesh->mTextureCoords[0]) // does the mesh contain texture coordinates?
+            {
+                glm::vec2 vec;
+                // a vertex can contain up to 8 different texture coordinates. We thus make the assumption that we won't 
+                // use models where a vertex can have multiple texture coordinates so we always take the first set (0).
+                vec.x = mesh->mTextureCoords[0][i].x;
+                vec.y = mesh->mTextureCoords[0][i].y;
+                vertex.TexCoords = vec;
+                // tangent
+                vector.x = mesh->mTangents[i].x;
+                vector.y = mesh->mTangents[i].y;
+                vector.z = mesh->mTangents[i].z;
+                vertex.Tangent = vector;
+                // bitangent
+                vector.x = mesh->mBitangents[i].x;
+                vector.y = mesh->mBitangents[i].y;
+                vector.z = mesh->mBitangents[i].z;
+                vertex.Bitangent = vector;
+            }
+            else
+                vertex.TexCoords = glm::vec2(0.0f, 0.0f);
+
+            vertices.push_back(vertex);
+        }
+        // bone ids and weights for skinned meshes
+        extractBoneWeights(vertices, mesh);
+
+        // now wak through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
+        for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+        {
+            aiFace face = mesh->mFaces[i];
+            // retrieve all indices of the face and store them in the indices vector
+            for (unsigned int j = 0; j < face.mNumIndices; j++)
+                indices.push_back(face.mIndices[j]);
+        }
+        // process materials
+        aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
+        // we assume a convention for sampler names in the shaders. Each diffuse texture should be named
+        // as 'texture_diffuseN' where N is a sequential number ranging from 1 to MAX_SAMPLER_NUMBER. 
+        // Same applies to other texture as the following list summarizes:
+        // diffuse: texture_diffuseN
+        // specular: texture_specularN
+        // normal: texture_normalN
+
+        // 1. diffuse maps
+        vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
+        textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
+        // 2. specular maps
+        vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
+        textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+        // 3. normal maps
+        std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
+        textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
+        // 4. height maps
+        std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_DISPLACEMENT, "texture_height");
+        textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
+        // 5. roughness maps
+        std::vector<Texture> roughMaps = loadMaterialTextures(material, aiTextureType_SHININESS, "texture_roughness");
+        textures.insert(textures.end(), roughMaps.begin(), roughMaps.end());
+        // 6. ao maps
+        std::vector<Texture> aoMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_ao");
+        textures.insert(textures.end(), aoMaps.begin(), aoMaps.end());
+
+        // return a mesh object created from the extracted mesh data
+        return Mesh(vertices, indices, textures, !deferUpload);
+    }
+
+    // registers every bone of the mesh in boneInfoMap and stores its id and weight in the vertices it influences
+    void extractBoneWeights(vector<Vertex>& vertices, aiMesh* mesh)
+    {
+        for (unsigned int i = 0; i < mesh->mNumBones; i++)
+        {
+            aiBone* bone = mesh->mBones[i];
+            string name = bone->mName.C_Str();
+
+            int boneId;
+            map<string, BoneInfo>::iterator it = boneInfoMap.find(name);
+            if (it == boneInfoMap.end())
+            {
+                BoneInfo info;
+                info.id = boneCounter++;
+                info.offset = AssimpToGlm(bone->mOffsetMatrix);
+                boneInfoMap[name] = info;
+                boneId = info.id;
+            }
+            else
+                boneId = it->second.id;
+
+            for (unsigned int j = 0; j < bone->mNumWeights; j++)
+            {
+                Vertex& vertex = vertices[bone->mWeights[j].mVertexId];
+                // take the first free slot, aiProcess_LimitBoneWeights guarantees there are at most four
+                for (int k = 0; k < MAX_BONE_INFLUENCE; k++)
+                {
+                    if (vertex.m_BoneIDs[k] < 0)
+                    {
+                        vertex.m_BoneIDs[k] = boneId;
+                        vertex.m_Weights[k] = bone->mWeights[j].mWeight;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    // checks all material textures of a given type and loads the textures if they're not loaded yet.
+    // the required info is returned as a Texture struct.
+    vector<Texture> loadMaterialTextures(aiMaterial* mat, aiTextureType type, string typeName)
+    {
+        vector<Texture> textures;
+        for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
+        {
+            aiString str;
+            mat->GetTexture(type, i, &str);
+            // check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
+            bool skip = false;
+            for (unsigned int j = 0; j < textures_loaded.size(); j++)
+            {
+                if (std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
+                {
+                    textures.push_back(textures_loaded[j]);
+                    skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
+                    break;
+                }
+            }
+            if (!skip)
+            {   // if texture hasn't been loaded already, load it
+                Texture texture;
+                // normal maps only need two channels and compress to BC5, everything else is treated as color
+                TextureUsage usage = typeName == "texture_normal" ? TEXTURE_NORMAL : TEXTURE_COLOR;
+                if (deferUpload)
+                {
+                    // only remember the path, the image is decoded and uploaded later
+                    DecodedImage image;
+                    image.path = str.C_Str();
+                    image.usage = usage;
+                    pendingImages.push_back(image);
+                    texture.id = 0;
+                }
+                else
+                    texture.id = TextureFromFile(str.C_Str(), this->directory, gammaCorrection, usage, flipTextures);
+                texture.type = typeName;
+                texture.path = str.C_Str();
+                textures.push_back(texture);
+                textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
+            }
+        }
+        return textures;
+    }
+};
+
+
+DecodedImage DecodeImage(const char* path, const string& directory, TextureUsage usage, bool flip)
+{
+    string filename = string(path);
+    filename = directory + '/' + filename;
+
+    DecodedImage image;
+    image.path = path;
+    image.usage = usage;
+    image.texture = LoadTextureData(filename.c_str(), 0, usage, true, flip);
+    return image;
+}
+
+// uploads into textureID, or a new texture when it is 0
+unsigned int UploadTexture(DecodedImage& image, unsigned int textureID)
+{
+    if (textureID == 0)
+    {
+        glGenTextures(1, &textureID);
+        gpuMemory.Track(GPU_TEXTURE, textureID, MEMORY_MODELS, image.path);
+    }
+
+    if (!image.texture.Empty())
+    {
+        // the whole mip chain is already built, no glGenerateMipmap needed
+        glState.BindTexture(GL_TEXTURE_2D, textureID);
+        UploadTextureData(textureID, GL_TEXTURE_2D, image.texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, image.texture.levelCount - 1);
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        // drop the pixels (or the mapping) now that they live on the GPU
+        image.texture = TextureData();
+    }
+    else
+    {
+        std::cout << "Texture failed to load at path: " << image.path << std::endl;
+    }
+
+    return textureID;
+}
+
+unsigned int TextureFromFile(const char* path, const string& directory, bool gamma, TextureUsage usage, bool flip)
+{
+    DecodedImage image = DecodeImage(path, directory, usage, flip);
+    return UploadTexture(image);
+}
+#endif
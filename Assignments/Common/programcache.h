@@ -0,0 +1,176 @@
+#ifndef PROGRAMCACHE_H
+#define PROGRAMCACHE_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include "mappedfile.h"
+#include "texcache.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// program binaries are core in GL 4.1 and ARB_get_program_binary, glad is generated for plain 3.3
+// so the entry points and enums are looked up by hand
+#define PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define PROGRAM_BINARY_LENGTH 0x8741
+#define NUM_PROGRAM_BINARY_FORMATS 0x87FE
+
+typedef void (APIENTRYP GetProgramBinaryProc)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+typedef void (APIENTRYP ProgramBinaryProc)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+typedef void (APIENTRYP ProgramParameteriProc)(GLuint program, GLenum pname, GLint value);
+
+string programCacheDirectory = "cache/programs";
+// switch to build every program from source (new binaries are still stored)
+bool useProgramCache = true;
+
+#define PROGRAM_FILE_VERSION 1
+
+struct ProgramFileHeader {
+    char magic[4]; // "GPRG"
+    unsigned int version;
+    unsigned int format;
+    unsigned int length;
+};
+
+// keeps linked programs on disk as driver binaries, so later runs skip compiling and linking.
+// the key of a program covers its sources, its defines and the driver that produced the binary, so
+// an edited shader or a driver update misses the cache and the program is built from source again.
+class ProgramCache {
+public:
+    // programs found in the cache and programs that had to be compiled since Init
+    unsigned int hits, misses;
+
+    ProgramCache() : hits(0), misses(0), getProgramBinary(nullptr), programBinary(nullptr), programParameteri(nullptr) {}
+
+    // looks up the entry points, the context has to be current
+    void Init()
+    {
+        getProgramBinary = (GetProgramBinaryProc)glfwGetProcAddress("glGetProgramBinary");
+        programBinary = (ProgramBinaryProc)glfwGetProcAddress("glProgramBinary");
+        programParameteri = (ProgramParameteriProc)glfwGetProcAddress("glProgramParameteri");
+
+        // a driver can have the functions and still offer no format to store in
+        GLint formats = 0;
+        if (Available())
+            glGetIntegerv(NUM_PROGRAM_BINARY_FORMATS, &formats);
+        if (formats == 0)
+            getProgramBinary = nullptr;
+
+        driver = string((const char*)glGetString(GL_VENDOR)) + "|" + (const char*)glGetString(GL_RENDERER) + "|" + (const char*)glGetString(GL_VERSION);
+        hits = misses = 0;
+    }
+
+    bool Available() const
+    {
+        return getProgramBinary && programBinary && programParameteri;
+    }
+
+    // key of the program linked from these shader sources with these defines on the current driver
+    unsigned long long Key(const vector<string>& sources, const string& defines = "") const
+    {
+        unsigned long long hash = HashBytes(driver.data(), driver.size());
+        hash = HashBytes(defines.data(), defines.size(), hash);
+        for (unsigned int i = 0; i < sources.size(); i++)
+        {
+            // the length goes in as well so moving text from one stage to the next changes the key
+            unsigned long long length = sources[i].size();
+            hash = HashBytes(&length, sizeof(length), hash);
+            hash = HashBytes(sources[i].data(), sources[i].size(), hash);
+        }
+        return hash;
+    }
+
+    // a linked program restored from the cache, 0 if there is none or the driver refuses the binary
+    GLuint Load(unsigned long long key)
+    {
+        if (!Available() || !useProgramCache)
+            return 0;
+
+        MappedFile file;
+        if (!file.Open(path(key).c_str()) || file.Size() < sizeof(ProgramFileHeader))
+            return 0;
+        const ProgramFileHeader* header = (const ProgramFileHeader*)file.Data();
+        if (memcmp(header->magic, "GPRG", 4) != 0 || header->version != PROGRAM_FILE_VERSION
+            || sizeof(ProgramFileHeader) + header->length > file.Size())
+            return 0;
+
+        GLuint program = glCreateProgram();
+        programBinary(program, header->format, file.Data() + sizeof(ProgramFileHeader), header->length);
+
+        GLint success = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        if (!success)
+        {
+            glDeleteProgram(program);
+            return 0;
+        }
+        hits++;
+        return program;
+    }
+
+    // call before linking a program that goes into the cache, some drivers only keep a binary when asked to
+    void PrepareLink(GLuint program)
+    {
+        misses++;
+        if (Available())
+            programParameteri(program, PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    // writes the binary of a linked program, a failed write only means it is compiled again next time
+    void Store(unsigned long long key, GLuint program)
+    {
+        GLint success = 0, length = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        if (!Available() || !success)
+            return;
+        glGetProgramiv(program, PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+
+        vector<char> binary(length);
+        GLenum format = 0;
+        getProgramBinary(program, length, &length, &format, &binary[0]);
+
+        ProgramFileHeader header;
+        memcpy(header.magic, "GPRG", 4);
+        header.version = PROGRAM_FILE_VERSION;
+        header.format = format;
+        header.length = (unsigned int)length;
+
+        std::error_code error;
+        std::filesystem::create_directories(programCacheDirectory, error);
+        // written next to the real file and renamed over it, so a crash never leaves half a binary behind
+        string finalPath = path(key), temporaryPath = finalPath + ".tmp";
+        {
+            std::ofstream file(temporaryPath, std::ios::binary);
+            if (!file.is_open())
+                return;
+            file.write((const char*)&header, sizeof(header));
+            file.write(&binary[0], length);
+            if (!file.good())
+                return;
+        }
+        std::filesystem::rename(temporaryPath, finalPath, error);
+    }
+
+private:
+    GetProgramBinaryProc getProgramBinary;
+    ProgramBinaryProc programBinary;
+    ProgramParameteriProc programParameteri;
+    string driver;
+
+    static string path(unsigned long long key)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.prog", key);
+        return programCacheDirectory + "/" + name;
+    }
+};
+
+ProgramCache programCache;
+#endif
@@ -0,0 +1,268 @@
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <glad/glad.h>
+
+#include "glstate.h"
+#include "gpuprofiler.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+using namespace std;
+
+// passes in the order they are drawn, the top bits of every key. the sky is drawn either as the
+// background, before everything, or after the opaque geometry where only the pixels nothing covered shade it
+enum RenderPass {
+    PASS_DEPTH,
+    PASS_BACKGROUND,
+    PASS_OPAQUE,
+    PASS_SKY,
+    PASS_TRANSPARENT,
+    RENDER_PASS_COUNT
+};
+
+// the names of the passes in the GPU profiler
+static const char* renderPassNames[RENDER_PASS_COUNT] = { "depth", "background", "opaque", "sky", "transparent" };
+
+// bits of each field of a key. an opaque key is, from the top
+//   pass | program | material | vertex array | depth
+// so draws that share a program end up together, then the ones that share their textures and geometry, and
+// what is left is ordered front to back. transparent draws have to blend back to front whatever that costs:
+//   pass | inverted depth | program | material | vertex array
+#define RENDER_KEY_PASS_BITS 4
+#define RENDER_KEY_PROGRAM_BITS 10
+#define RENDER_KEY_MATERIAL_BITS 14
+#define RENDER_KEY_VERTEX_ARRAY_BITS 12
+#define RENDER_KEY_DEPTH_BITS 24
+
+// the draws of a frame, submitted in any order and drawn sorted by a 64 bit key. only the key is sorted,
+// with a radix sort, the commands stay where they were submitted. every pass is a GPU profiler scope,
+// and the draws inside it are grouped in scopes by the name they were submitted with.
+class RenderQueue {
+public:
+    // issues the draw, the program of the command is current already
+    typedef function<void()> Draw;
+    // the same without the std::function, for the many draws of a model: called with the data and index it
+    // was submitted with, so nothing is allocated per draw
+    typedef void (*DrawFunction)(const void* data, unsigned int index);
+    // sets the state a pass needs, like depth test and blending, before its first draw
+    typedef function<void()> PassSetup;
+
+    // commands drawn by the last Flush
+    unsigned int drawn;
+
+    RenderQueue() : drawn(0), farDistance(1.0f) {}
+
+    void SetPass(RenderPass pass, PassSetup setup)
+    {
+        passSetups[pass] = setup;
+    }
+
+    // starts a frame, distances are measured against farDistance to fit in the depth bits
+    void Begin(float farDistance)
+    {
+        this->farDistance = farDistance;
+        commands.clear();
+        kept.clear();
+    }
+
+    // queues a draw. material is any number that is the same for draws binding the same textures,
+    // distance is how far the draw is from the camera. scope names what the draw is part of in the profiler,
+    // it has to stay valid until the flush
+    void Submit(RenderPass pass, GLuint program, unsigned int material, GLuint vertexArray, float distance, const Draw& draw, const char* scope = nullptr)
+    {
+        Command command;
+        command.key = Key(pass, program, material, vertexArray, distance / farDistance);
+        command.program = program;
+        command.draw = draw;
+        command.function = nullptr;
+        command.data = nullptr;
+        command.index = 0;
+        command.scope = scope;
+        commands.push_back(command);
+    }
+
+    // queues a draw that calls function(data, index). data is shared by many draws and has to stay valid until
+    // the flush, Keep gives a copy that does
+    void Submit(RenderPass pass, GLuint program, unsigned int material, GLuint vertexArray, float distance, DrawFunction function, const void* data, unsigned int index,
+                const char* scope = nullptr)
+    {
+        commands.push_back(Command());
+        Command& command = commands.back();
+        command.key = Key(pass, program, material, vertexArray, distance / farDistance);
+        command.program = program;
+        command.function = function;
+        command.data = data;
+        command.index = index;
+        command.scope = scope;
+    }
+
+    // a copy of value that lives until the queue is flushed, for what the draws of a DrawFunction share
+    template<typename T>
+    const T* Keep(const T& value)
+    {
+        shared_ptr<T> copy = make_shared<T>(value);
+        kept.push_back(copy);
+        return copy.get();
+    }
+
+    // draws every command and empties the queue, in key order when sorted and in submission order otherwise
+    void Flush(bool sorted = true)
+    {
+        order.resize(commands.size());
+        for (unsigned int i = 0; i < commands.size(); i++)
+        {
+            order[i].key = commands[i].key;
+            order[i].index = i;
+        }
+        if (sorted)
+            radixSort();
+
+        int pass = -1;
+        const char* scope = nullptr;
+        for (unsigned int i = 0; i < order.size(); i++)
+        {
+            const Command& command = commands[order[i].index];
+            int commandPass = (int)(command.key >> (64 - RENDER_KEY_PASS_BITS));
+            // unsorted, the same pass can come back, its state is set again every time it does
+            if (commandPass != pass)
+            {
+                if (scope)
+                    gpuProfiler.End();
+                if (pass >= 0)
+                    gpuProfiler.End();
+                scope = nullptr;
+                pass = commandPass;
+                gpuProfiler.Begin(pass < RENDER_PASS_COUNT ? renderPassNames[pass] : "pass");
+                if (pass < RENDER_PASS_COUNT && passSetups[pass])
+                    passSetups[pass]();
+            }
+            if (!sameScope(scope, command.scope))
+            {
+                if (scope)
+                    gpuProfiler.End();
+                scope = command.scope;
+                if (scope)
+                    gpuProfiler.Begin(scope);
+            }
+            glState.UseProgram(command.program);
+            if (command.function)
+                command.function(command.data, command.index);
+            else
+                command.draw();
+        }
+        if (scope)
+            gpuProfiler.End();
+        if (pass >= 0)
+            gpuProfiler.End();
+        drawn = (unsigned int)commands.size();
+        commands.clear();
+        kept.clear();
+    }
+
+    // the key of a draw, depth is the distance divided by the far distance
+    static uint64_t Key(RenderPass pass, GLuint program, unsigned int material, GLuint vertexArray, float depth)
+    {
+        uint64_t depthBits = (uint64_t)(min(max(depth, 0.0f), 1.0f) * (float)((1u << RENDER_KEY_DEPTH_BITS) - 1));
+        uint64_t programBits = program & ((1u << RENDER_KEY_PROGRAM_BITS) - 1);
+        uint64_t materialBits = material & ((1u << RENDER_KEY_MATERIAL_BITS) - 1);
+        uint64_t vertexArrayBits = vertexArray & ((1u << RENDER_KEY_VERTEX_ARRAY_BITS) - 1);
+
+        uint64_t key = (uint64_t)pass << (64 - RENDER_KEY_PASS_BITS);
+        if (pass == PASS_TRANSPARENT)
+        {
+            uint64_t inverted = ((1u << RENDER_KEY_DEPTH_BITS) - 1) - depthBits;
+            key |= inverted << (64 - RENDER_KEY_PASS_BITS - RENDER_KEY_DEPTH_BITS);
+            key |= programBits << (RENDER_KEY_MATERIAL_BITS + RENDER_KEY_VERTEX_ARRAY_BITS);
+            key |= materialBits << RENDER_KEY_VERTEX_ARRAY_BITS;
+            key |= vertexArrayBits;
+        }
+        else
+        {
+            key |= programBits << (RENDER_KEY_MATERIAL_BITS + RENDER_KEY_VERTEX_ARRAY_BITS + RENDER_KEY_DEPTH_BITS);
+            key |= materialBits << (RENDER_KEY_VERTEX_ARRAY_BITS + RENDER_KEY_DEPTH_BITS);
+            key |= vertexArrayBits << RENDER_KEY_DEPTH_BITS;
+            key |= depthBits;
+        }
+        return key;
+    }
+
+    // a material number for a set of textures, equal sets give equal numbers. two different sets can
+    // collide in the bits the key keeps, that only costs a few binds
+    static unsigned int MaterialKey(const GLuint* textures, unsigned int count)
+    {
+        unsigned int hash = 2166136261u;
+        for (unsigned int i = 0; i < count; i++)
+        {
+            hash ^= textures[i];
+            hash *= 16777619u;
+        }
+        return hash ^ (hash >> RENDER_KEY_MATERIAL_BITS);
+    }
+
+private:
+    struct Command {
+        uint64_t key;
+        GLuint program;
+        Draw draw;
+        DrawFunction function; // used instead of draw when set
+        const void* data;
+        unsigned int index;
+        const char* scope;
+    };
+
+    struct Entry {
+        uint64_t key;
+        unsigned int index;
+    };
+
+    float farDistance;
+    PassSetup passSetups[RENDER_PASS_COUNT];
+    vector<Command> commands;
+    // the copies made by Keep for this frame's draws
+    vector<shared_ptr<const void>> kept;
+    // the sorted keys and the commands they belong to, and the other half of the sort's ping pong
+    vector<Entry> order, scratch;
+
+    static bool sameScope(const char* a, const char* b)
+    {
+        if (a == b)
+            return true;
+        return a && b && strcmp(a, b) == 0;
+    }
+
+    // least significant byte first, each pass is a stable counting sort on one byte. a byte that is the same
+    // in every key, like the high bits of the program or the pass in a frame with one pass, is skipped
+    void radixSort()
+    {
+        unsigned int count = (unsigned int)order.size();
+        if (count < 2)
+            return;
+        scratch.resize(count);
+
+        for (int shift = 0; shift < 64; shift += 8)
+        {
+            unsigned int offsets[256] = {};
+            for (unsigned int i = 0; i < count; i++)
+                offsets[(order[i].key >> shift) & 0xFF]++;
+            if (offsets[(order[0].key >> shift) & 0xFF] == count)
+                continue;
+
+            unsigned int total = 0;
+            for (int i = 0; i < 256; i++)
+            {
+                unsigned int bucket = offsets[i];
+                offsets[i] = total;
+                total += bucket;
+            }
+            for (unsigned int i = 0; i < count; i++)
+                scratch[offsets[(order[i].key >> shift) & 0xFF]++] = order[i];
+            order.swap(scratch);
+        }
+    }
+};
+#endif
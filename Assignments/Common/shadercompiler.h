@@ -0,0 +1,175 @@
+#ifndef SHADERCOMPILER_H
+#define SHADERCOMPILER_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// KHR_parallel_shader_compile (or the ARB version of it), glad is generated for plain 3.3 so the
+// entry point and enum are looked up by hand
+#define COMPLETION_STATUS_KHR 0x91B1
+// lets the driver pick how many threads it compiles on
+#define MAX_SHADER_COMPILER_THREADS 0xFFFFFFFF
+
+typedef void (APIENTRYP MaxShaderCompilerThreadsProc)(GLuint count);
+
+// compiles and links programs without waiting for them. asking for a compile or link status is what makes
+// the driver finish the work, so nothing is asked until the program is needed: every program is submitted
+// up front and the CPU goes on loading textures and models while the driver compiles. with
+// KHR_parallel_shader_compile the driver does that on its own threads and Poll can check without blocking.
+class ShaderCompiler {
+public:
+    // runs once the program linked, to put it to use
+    typedef function<void(GLuint program)> Linked;
+
+    // programs that linked and that failed since Init
+    unsigned int linked, failed;
+
+    ShaderCompiler() : linked(0), failed(0), parallel(false) {}
+
+    // looks up the extension, the context has to be current
+    void Init()
+    {
+        MaxShaderCompilerThreadsProc maxThreads = nullptr;
+        if (glfwExtensionSupported("GL_KHR_parallel_shader_compile"))
+            maxThreads = (MaxShaderCompilerThreadsProc)glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+        else if (glfwExtensionSupported("GL_ARB_parallel_shader_compile"))
+            maxThreads = (MaxShaderCompilerThreadsProc)glfwGetProcAddress("glMaxShaderCompilerThreadsARB");
+
+        parallel = maxThreads != nullptr;
+        if (parallel)
+            maxThreads(MAX_SHADER_COMPILER_THREADS);
+        linked = failed = 0;
+    }
+
+    // the driver compiles on its own threads and can be asked whether a program is done
+    bool Parallel() const
+    {
+        return parallel;
+    }
+
+    // creates a shader and starts compiling it, its status is only read once its program is finished
+    GLuint Compile(GLenum type, const string& source)
+    {
+        const char* text = source.c_str();
+        GLuint shader = glCreateShader(type);
+        glShaderSource(shader, 1, &text, nullptr);
+        glCompileShader(shader);
+        return shader;
+    }
+
+    // takes over a program that was told to link. its shaders are deleted once it's finished, files name
+    // them in the error log. target is the program it's going to replace, for Finish
+    void Submit(const void* target, GLuint program, const vector<GLuint>& shaders, const vector<string>& files, Linked onLinked)
+    {
+        Job entry;
+        entry.target = target;
+        entry.program = program;
+        entry.shaders = shaders;
+        entry.files = files;
+        entry.onLinked = onLinked;
+        pending.push_back(entry);
+    }
+
+    // finishes the programs the driver is done with, without waiting for the others. only the extension can
+    // tell without blocking, so without it nothing is finished here. returns how many are still compiling
+    unsigned int Poll()
+    {
+        if (!parallel)
+            return (unsigned int)pending.size();
+
+        for (unsigned int i = 0; i < pending.size();)
+        {
+            GLint done = GL_FALSE;
+            glGetProgramiv(pending[i].program, COMPLETION_STATUS_KHR, &done);
+            if (done)
+                finish(i);
+            else
+                i++;
+        }
+        return (unsigned int)pending.size();
+    }
+
+    // waits for the programs submitted for target, or for all of them without one, and puts them to use.
+    // false when one of them didn't compile or link
+    bool Finish(const void* target = nullptr)
+    {
+        bool ok = true;
+        if (target == nullptr)
+        {
+            // the ones already done go first, in whatever order the driver finished them
+            unsigned int failedBefore = failed;
+            Poll();
+            ok = failed == failedBefore;
+        }
+        for (unsigned int i = 0; i < pending.size();)
+        {
+            if (target && pending[i].target != target)
+                i++;
+            else if (!finish(i))
+                ok = false;
+        }
+        return ok;
+    }
+
+    unsigned int Pending() const
+    {
+        return (unsigned int)pending.size();
+    }
+
+private:
+    struct Job {
+        const void* target;
+        GLuint program;
+        vector<GLuint> shaders;
+        vector<string> files;
+        Linked onLinked;
+    };
+
+    bool parallel;
+    vector<Job> pending;
+
+    // reads the status of pending[index], which blocks until the driver is done with it, and removes it
+    bool finish(unsigned int index)
+    {
+        Job entry = pending[index];
+        pending.erase(pending.begin() + index);
+
+        int success;
+        char infoLog[512];
+        for (unsigned int i = 0; i < entry.shaders.size(); i++)
+        {
+            glGetShaderiv(entry.shaders[i], GL_COMPILE_STATUS, &success);
+            if (!success) {
+                GLint type = 0;
+                glGetShaderiv(entry.shaders[i], GL_SHADER_TYPE, &type);
+                const char* stage = type == GL_VERTEX_SHADER ? "VERTEX" : type == GL_FRAGMENT_SHADER ? "FRAGMENT" : "GEOMETRY";
+                glGetShaderInfoLog(entry.shaders[i], 512, nullptr, infoLog);
+                cout << "ERROR COMPILING " << stage << " SHADER " << (i < entry.files.size() ? entry.files[i] : "") << "\n" << infoLog << endl;
+            }
+            glDeleteShader(entry.shaders[i]);
+        }
+
+        glGetProgramiv(entry.program, GL_LINK_STATUS, &success);
+        if (!success) {
+            glGetProgramInfoLog(entry.program, 512, nullptr, infoLog);
+            cout << "ERROR LINKING PROGRAM\n" << infoLog << endl;
+            // whatever was there before keeps drawing
+            glDeleteProgram(entry.program);
+            failed++;
+            return false;
+        }
+
+        linked++;
+        entry.onLinked(entry.program);
+        return true;
+    }
+};
+
+ShaderCompiler shaderCompiler;
+#endif
@@ -0,0 +1,276 @@
+#ifndef SHADERPROGRAM_H
+#define SHADERPROGRAM_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "glstate.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+using namespace std;
+
+// switch to set every uniform the old way, looked up by name in the driver and uploaded every time
+bool useUniformCache = true;
+// uniform values sent to the driver, and the ones skipped because the program already held them
+unsigned long long uniformUploads = 0, uniformUploadsSkipped = 0;
+
+// bytes one element of a uniform of this type takes, samplers are set like an int
+inline unsigned int UniformValueSize(GLenum type)
+{
+    switch (type)
+    {
+    case GL_FLOAT_VEC2: case GL_INT_VEC2: case GL_UNSIGNED_INT_VEC2: case GL_BOOL_VEC2: return 8;
+    case GL_FLOAT_VEC3: case GL_INT_VEC3: case GL_UNSIGNED_INT_VEC3: case GL_BOOL_VEC3: return 12;
+    case GL_FLOAT_VEC4: case GL_INT_VEC4: case GL_UNSIGNED_INT_VEC4: case GL_BOOL_VEC4: case GL_FLOAT_MAT2: return 16;
+    case GL_FLOAT_MAT2x3: case GL_FLOAT_MAT3x2: return 24;
+    case GL_FLOAT_MAT2x4: case GL_FLOAT_MAT4x2: return 32;
+    case GL_FLOAT_MAT3: return 36;
+    case GL_FLOAT_MAT3x4: case GL_FLOAT_MAT4x3: return 48;
+    case GL_FLOAT_MAT4: return 64;
+    default: return 4;
+    }
+}
+
+// a linked program with its active uniforms read back once after linking. the setters find a uniform in
+// a small sorted table instead of asking the driver for its location, and skip the upload when the program
+// already holds the value. uniforms set with glUniform directly aren't seen by the table, a program should
+// be set through one or the other.
+class ShaderProgram {
+public:
+    GLuint id;
+
+    ShaderProgram() : id(0) {}
+
+    // builds the uniform table of a linked program, samplers included
+    void Reflect(GLuint program)
+    {
+        id = program;
+        uniforms.clear();
+        values.clear();
+        if (program == 0)
+            return;
+
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        vector<char> name(std::max(maxLength, 1));
+        for (GLint i = 0; i < count; i++)
+        {
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform(program, i, (GLsizei)name.size(), &length, &size, &type, &name[0]);
+
+            Uniform uniform;
+            uniform.location = glGetUniformLocation(program, &name[0]);
+            if (uniform.location < 0)
+                continue; // members of uniform blocks have no location, they live in their buffer
+
+            uniform.name = string(&name[0], length);
+            // arrays are reported as name[0], they're set by their plain name from the first element
+            if (uniform.name.size() > 3 && uniform.name.compare(uniform.name.size() - 3, 3, "[0]") == 0)
+                uniform.name.resize(uniform.name.size() - 3);
+            uniform.type = type;
+            uniform.bytes = UniformValueSize(type) * size;
+            uniform.offset = (unsigned int)values.size();
+            uniform.held = false;
+            values.resize(values.size() + uniform.bytes);
+            uniforms.push_back(uniform);
+        }
+        sort(uniforms.begin(), uniforms.end(), [](const Uniform& a, const Uniform& b) { return a.name < b.name; });
+    }
+
+    // swaps in a newly linked build of the same program. every uniform it shares with the old build gets the
+    // value the old one held (samplers included), then the old program is deleted
+    void Adopt(GLuint program)
+    {
+        ShaderProgram old = *this;
+        Reflect(program);
+
+        GLuint current = glState.Program();
+        glState.UseProgram(program);
+        for (unsigned int i = 0; i < uniforms.size(); i++)
+        {
+            Uniform& uniform = uniforms[i];
+            const Uniform* previous = old.find(uniform.name.c_str());
+            if (!previous || !previous->held || previous->type != uniform.type || previous->bytes != uniform.bytes)
+                continue;
+            memcpy(&values[uniform.offset], &old.values[previous->offset], uniform.bytes);
+            uniform.held = restore(uniform);
+        }
+        glState.UseProgram(current == old.id ? program : current);
+
+        if (old.id != 0 && old.id != program)
+            glDeleteProgram(old.id);
+    }
+
+    bool Has(const char* name) const
+    {
+        return find(name) != nullptr;
+    }
+
+    // number of active uniforms outside of uniform blocks
+    unsigned int UniformCount() const
+    {
+        return (unsigned int)uniforms.size();
+    }
+
+    // forgets the held values, the next set of every uniform uploads again
+    void Invalidate()
+    {
+        for (unsigned int i = 0; i < uniforms.size(); i++)
+            uniforms[i].held = false;
+    }
+
+    void SetInt(const char* name, int value)
+    {
+        GLint location = upload(name, &value, sizeof(value));
+        if (location >= 0)
+            glUniform1i(location, value);
+    }
+
+    // count elements from the first one of an int or sampler array, like materialArrays
+    void SetIntArray(const char* name, const int* values, int count)
+    {
+        GLint location = upload(name, values, count * sizeof(int));
+        if (location >= 0)
+            glUniform1iv(location, count, values);
+    }
+
+    void SetFloat(const char* name, float value)
+    {
+        GLint location = upload(name, &value, sizeof(value));
+        if (location >= 0)
+            glUniform1f(location, value);
+    }
+
+    void SetVec2(const char* name, const glm::vec2& value)
+    {
+        GLint location = upload(name, &value, sizeof(value));
+        if (location >= 0)
+            glUniform2fv(location, 1, glm::value_ptr(value));
+    }
+
+    // count elements from the first one of an ivec2 array
+    void SetIVec2Array(const char* name, const glm::ivec2* values, int count)
+    {
+        GLint location = upload(name, values, count * sizeof(glm::ivec2));
+        if (location >= 0)
+            glUniform2iv(location, count, glm::value_ptr(values[0]));
+    }
+
+    void SetVec3(const char* name, const glm::vec3& value)
+    {
+        GLint location = upload(name, &value, sizeof(value));
+        if (location >= 0)
+            glUniform3fv(location, 1, glm::value_ptr(value));
+    }
+
+    void SetVec4(const char* name, const glm::vec4& value)
+    {
+        GLint location = upload(name, &value, sizeof(value));
+        if (location >= 0)
+            glUniform4fv(location, 1, glm::value_ptr(value));
+    }
+
+    void SetMat3(const char* name, const glm::mat3& value)
+    {
+        GLint location = upload(name, &value, sizeof(value));
+        if (location >= 0)
+            glUniformMatrix3fv(location, 1, GL_FALSE, glm::value_ptr(value));
+    }
+
+    void SetMat4(const char* name, const glm::mat4& value)
+    {
+        GLint location = upload(name, &value, sizeof(value));
+        if (location >= 0)
+            glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
+    }
+
+private:
+    struct Uniform {
+        string name;
+        GLint location;
+        GLenum type;
+        unsigned int bytes;  // of the whole uniform, all elements of an array
+        unsigned int offset; // of its value in values
+        bool held;           // values holds what the program was last given
+    };
+
+    // sorted by name
+    vector<Uniform> uniforms;
+    // the last value uploaded to every uniform, packed one after the other
+    vector<unsigned char> values;
+
+    const Uniform* find(const char* name) const
+    {
+        vector<Uniform>::const_iterator it = lower_bound(uniforms.begin(), uniforms.end(), name,
+            [](const Uniform& uniform, const char* name) { return strcmp(uniform.name.c_str(), name) < 0; });
+        return it != uniforms.end() && it->name == name ? &*it : nullptr;
+    }
+
+    // uploads the held value of a whole uniform to the current program, false for types there's no setter for
+    bool restore(const Uniform& uniform)
+    {
+        const void* value = &values[uniform.offset];
+        GLsizei count = (GLsizei)(uniform.bytes / UniformValueSize(uniform.type));
+        switch (uniform.type)
+        {
+        case GL_FLOAT: glUniform1fv(uniform.location, count, (const GLfloat*)value); break;
+        case GL_FLOAT_VEC2: glUniform2fv(uniform.location, count, (const GLfloat*)value); break;
+        case GL_FLOAT_VEC3: glUniform3fv(uniform.location, count, (const GLfloat*)value); break;
+        case GL_FLOAT_VEC4: glUniform4fv(uniform.location, count, (const GLfloat*)value); break;
+        case GL_FLOAT_MAT3: glUniformMatrix3fv(uniform.location, count, GL_FALSE, (const GLfloat*)value); break;
+        case GL_FLOAT_MAT4: glUniformMatrix4fv(uniform.location, count, GL_FALSE, (const GLfloat*)value); break;
+        case GL_INT_VEC2: glUniform2iv(uniform.location, count, (const GLint*)value); break;
+        default:
+            // ints, bools and samplers
+            if (UniformValueSize(uniform.type) != 4)
+                return false;
+            glUniform1iv(uniform.location, count, (const GLint*)value);
+        }
+        uniformUploads++;
+        return true;
+    }
+
+    // location to upload the value to, -1 when the uniform isn't active or already holds the value
+    GLint upload(const char* name, const void* value, unsigned int bytes)
+    {
+        Uniform* uniform = const_cast<Uniform*>(find(name));
+        if (!useUniformCache)
+        {
+            // what every draw used to do, the table has to catch up once the cache is switched on again
+            if (uniform)
+                uniform->held = false;
+            uniformUploads++;
+            return glGetUniformLocation(id, name);
+        }
+
+        if (!uniform)
+            return -1;
+        if (bytes > uniform->bytes)
+        {
+            // set with a bigger type than it has, GL reports the error and there's nothing to remember
+            uniform->held = false;
+            uniformUploads++;
+            return uniform->location;
+        }
+
+        unsigned char* held = &values[uniform->offset];
+        if (uniform->held && memcmp(held, value, bytes) == 0)
+        {
+            uniformUploadsSkipped++;
+            return -1;
+        }
+        memcpy(held, value, bytes);
+        uniform->held = true;
+        uniformUploads++;
+        return uniform->location;
+    }
+};
+#endif
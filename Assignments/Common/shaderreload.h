@@ -0,0 +1,143 @@
+#ifndef SHADERRELOAD_H
+#define SHADERRELOAD_H
+
+#include "filewatcher.h"
+#include "shaderprogram.h"
+#include "vfs.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+using namespace std;
+
+// how deep #include may nest, deeper than this is taken for a file including itself
+#define SHADER_INCLUDE_DEPTH 16
+
+// index of path in files, added at the end if it isn't there yet
+inline unsigned int shaderFileIndex(vector<string>& files, const string& path)
+{
+    for (unsigned int i = 0; i < files.size(); i++)
+    {
+        if (files[i] == path)
+            return i;
+    }
+    files.push_back(path);
+    return (unsigned int)files.size() - 1;
+}
+
+// reads a shader and pastes in the files it includes with #include "file", relative to the including file.
+// every file read is added to files once, and the pasted text is framed with #line directives whose source
+// number is the file's index in files, so a compile error names the line in the file it is really in.
+// defines, whole "#define NAME" lines, go in right after the #version line of the top file.
+bool LoadShaderSource(const string& path, string& source, vector<string>& files, const string& defines = "", int depth = 0)
+{
+    unsigned int index = shaderFileIndex(files, path);
+    if (depth > SHADER_INCLUDE_DEPTH)
+    {
+        cout << "Shader includes nested too deep at " << path << endl;
+        return false;
+    }
+
+    AssetData file;
+    if (!assets.Read(path, file))
+    {
+        cout << "Failed to open shader " << path << endl;
+        return false;
+    }
+    const char* text = (const char*)file.data;
+    const char* end = text + file.size;
+
+    // #version has to stay the first line, an included file starts numbering its own lines
+    if (depth > 0)
+        source += "#line 1 " + to_string(index) + "\n";
+
+    string line;
+    int number = 0;
+    while (text < end)
+    {
+        const char* lineEnd = find(text, end, '\n');
+        line.assign(text, lineEnd);
+        text = lineEnd == end ? end : lineEnd + 1;
+        number++;
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+
+        size_t start = line.find_first_not_of(" \t");
+        if (start == string::npos || line.compare(start, 8, "#include") != 0)
+        {
+            source += line + "\n";
+            if (depth == 0 && start != string::npos && line.compare(start, 8, "#version") == 0)
+                source += defines + "#line " + to_string(number + 1) + " " + to_string(index) + "\n";
+            continue;
+        }
+
+        size_t open = line.find('"', start + 8);
+        size_t close = open == string::npos ? string::npos : line.find('"', open + 1);
+        if (close == string::npos)
+        {
+            cout << path << "(" << number << "): #include needs a file name in quotes" << endl;
+            return false;
+        }
+
+        std::filesystem::path included = std::filesystem::path(path).parent_path() / line.substr(open + 1, close - open - 1);
+        if (!LoadShaderSource(included.lexically_normal().generic_string(), source, files, "", depth + 1))
+            return false;
+        source += "#line " + to_string(number + 1) + " " + to_string(index) + "\n";
+    }
+    return true;
+}
+
+// rebuilds programs while the program runs when one of their shader files, or a file those include, is
+// saved. the build is expected to compile into a new program object and only swap it in when it links
+// (ShaderProgram::Adopt), so a broken edit leaves the last working program on screen.
+class ShaderReloader {
+public:
+    // builds the program again from its files, false when it didn't compile or link
+    typedef function<bool()> Builder;
+
+    ShaderReloader(FileWatcher& watcher) : watcher(watcher) {}
+
+    // watches the files program was built from. called on every build, so includes added by an edit are
+    // picked up; the latest build function is the one that runs
+    void Track(ShaderProgram* program, const vector<string>& files, Builder build)
+    {
+        Entry& entry = entries[program];
+        entry.build = build;
+        for (unsigned int i = 0; i < files.size(); i++)
+        {
+            if (!entry.files.insert(files[i]).second)
+                continue;
+            watcher.Watch(files[i], [this, program](const string& path) { rebuild(program, path); });
+        }
+    }
+
+private:
+    struct Entry {
+        set<string> files;
+        Builder build;
+    };
+
+    FileWatcher& watcher;
+    map<ShaderProgram*, Entry> entries;
+
+    void rebuild(ShaderProgram* program, const string& path)
+    {
+        // copied, the build tracks the program again and replaces the function in the entry
+        Builder build = entries[program].build;
+
+        chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+        bool built = build();
+        double time = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+        if (built)
+            cout << "Reloaded a program after " << path << " changed in " << time << " ms" << endl;
+        else
+            cout << "Reloading after " << path << " changed failed, the previous program stays in use" << endl;
+    }
+};
+#endif
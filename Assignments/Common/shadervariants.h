@@ -0,0 +1,94 @@
+#ifndef SHADERVARIANTS_H
+#define SHADERVARIANTS_H
+
+#include <glad/glad.h>
+
+#include "glstate.h"
+#include "shaderprogram.h"
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+using namespace std;
+
+// one shader built in variants that differ in which feature flags are #defined, so a draw runs a variant
+// that leaves out the work it doesn't need. a variant is only compiled the first time a draw asks for it,
+// its binary is cached per set of defines like any other program.
+class ShaderVariants {
+public:
+    // compiles the shader into program with the defines pasted in after #version, false when it failed
+    typedef function<bool(ShaderProgram& program, const string& defines)> Builder;
+    // sets what a variant needs once after it's built, like its sampler units. the variant is current
+    typedef function<void(ShaderProgram& program)> Setup;
+
+    // variants compiled so far, failed ones included
+    unsigned int built;
+
+    ShaderVariants() : built(0) {}
+
+    // names[i] is the define of feature bit i
+    void Init(const vector<string>& names, Builder build, Setup setup = nullptr)
+    {
+        this->names = names;
+        this->build = build;
+        this->setup = setup;
+    }
+
+    // the variant with exactly these features, compiled now if it's the first time it's needed.
+    // one that failed to compile falls back to the variant with every feature, until an edit fixes it
+    ShaderProgram& Get(unsigned int features)
+    {
+        map<unsigned int, ShaderProgram>::iterator it = variants.find(features);
+        if (it == variants.end())
+        {
+            // a map node never moves, the reloader keeps the address of the program
+            ShaderProgram& program = variants[features];
+            GLuint current = glState.Program();
+            if (build(program, Defines(features)) && setup)
+            {
+                glState.UseProgram(program.id);
+                setup(program);
+            }
+            glState.UseProgram(current);
+            built++;
+            it = variants.find(features);
+        }
+
+        unsigned int all = (1u << names.size()) - 1;
+        if (it->second.id == 0 && features != all)
+            return Get(all);
+        return it->second;
+    }
+
+    // the #define lines of a set of features
+    string Defines(unsigned int features) const
+    {
+        string defines;
+        for (unsigned int i = 0; i < names.size(); i++)
+        {
+            if (features & (1u << i))
+                defines += "#define " + names[i] + "\n";
+        }
+        return defines;
+    }
+
+    // deletes every variant, only at shutdown since the reloader still holds their addresses
+    void Release()
+    {
+        for (map<unsigned int, ShaderProgram>::iterator it = variants.begin(); it != variants.end(); ++it)
+        {
+            if (it->second.id != 0)
+                glDeleteProgram(it->second.id);
+        }
+        variants.clear();
+        built = 0;
+    }
+
+private:
+    vector<string> names;
+    Builder build;
+    Setup setup;
+    map<unsigned int, ShaderProgram> variants;
+};
+#endif
@@ -0,0 +1,50 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+
+// fixed size single producer / single consumer ring buffer. one thread pushes, one other thread pops,
+// and neither ever takes a lock: the producer only writes head, the consumer only writes tail.
+template<typename T, size_t Capacity>
+class SpscQueue {
+public:
+    SpscQueue() : head(0), tail(0) {}
+
+    // producer side, returns false when the queue is full
+    bool Push(const T& item)
+    {
+        size_t current = head.load(std::memory_order_relaxed);
+        size_t next = (current + 1) % Capacity;
+        if (next == tail.load(std::memory_order_acquire))
+            return false;
+
+        items[current] = item;
+        head.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side, returns false when the queue is empty
+    bool Pop(T& item)
+    {
+        size_t current = tail.load(std::memory_order_relaxed);
+        if (current == head.load(std::memory_order_acquire))
+            return false;
+
+        item = items[current];
+        tail.store((current + 1) % Capacity, std::memory_order_release);
+        return true;
+    }
+
+    bool Empty() const
+    {
+        return tail.load(std::memory_order_acquire) == head.load(std::memory_order_acquire);
+    }
+
+private:
+    T items[Capacity];
+    // keep the two indices on separate cache lines so producer and consumer don't fight over one
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+};
+#endif
@@ -0,0 +1,277 @@
+#ifndef TEXARRAY_H
+#define TEXARRAY_H
+
+#include <glad/glad.h>
+
+#include "glstate.h"
+#include "shaderprogram.h"
+#include "texcache.h"
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+using namespace std;
+
+// number of sampler2DArray units the packed material shader declares
+#define MATERIAL_ARRAY_COUNT 8
+
+// the textures a packed material can have, in the order of the material uniform in the shader
+enum MaterialSlot {
+    MATERIAL_DIFFUSE,
+    MATERIAL_SPECULAR,
+    MATERIAL_NORMAL,
+    MATERIAL_ROUGHNESS,
+    MATERIAL_AO,
+    MATERIAL_SLOT_COUNT
+};
+
+// where a texture ended up, array is -1 when there is no texture (the shader then uses a default value)
+struct MaterialLayer {
+    int array;
+    int layer;
+};
+
+// the layers of every texture one mesh samples
+struct MeshMaterial {
+    MaterialLayer layers[MATERIAL_SLOT_COUNT];
+
+    MeshMaterial()
+    {
+        for (int i = 0; i < MATERIAL_SLOT_COUNT; i++)
+        {
+            layers[i].array = -1;
+            layers[i].layer = 0;
+        }
+    }
+};
+
+// packs material textures into GL_TEXTURE_2D_ARRAYs. textures with the same size, format and number of
+// levels share an array and each becomes one layer of it, so all the meshes of a scene can be drawn with
+// one program and a single set of bound arrays, picking their textures by array and layer index.
+class MaterialPacker {
+public:
+    // adds a texture (through the texture cache) and returns its place. the same file is only added once.
+    // the texture is on the GPU after the next Build.
+    MaterialLayer Add(const string& path, TextureUsage usage, bool flip = false)
+    {
+        MaterialLayer result;
+        result.array = -1;
+        result.layer = 0;
+
+        string key = path + (flip ? "|flip" : "");
+        map<string, PackedTexture>::iterator it = added.find(key);
+        if (it != added.end())
+            return it->second.layer;
+
+        TextureData data = LoadTextureData(path.c_str(), 0, usage, true, flip);
+        if (data.Empty())
+        {
+            std::cout << "ERROR::MATERIALPACKER:: failed to load " << path << std::endl;
+            return result;
+        }
+
+        GLint maxLayers;
+        glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+
+        for (unsigned int i = 0; i < arrays.size(); i++)
+        {
+            if (arrays[i].Matches(data) && (int)arrays[i].layers.size() < maxLayers)
+            {
+                result.array = i;
+                break;
+            }
+        }
+
+        if (result.array < 0)
+        {
+            if (arrays.size() >= MATERIAL_ARRAY_COUNT)
+            {
+                std::cout << "ERROR::MATERIALPACKER:: no array left for " << path << " (" << data.levels[0].width << "x" << data.levels[0].height << ")" << std::endl;
+                return result;
+            }
+            arrays.push_back(TextureArray());
+            result.array = (int)arrays.size() - 1;
+        }
+
+        result.layer = (int)arrays[result.array].layers.size();
+        arrays[result.array].layers.push_back(data);
+
+        PackedTexture packed;
+        packed.layer = result;
+        packed.path = path;
+        packed.usage = usage;
+        packed.flip = flip;
+        added[key] = packed;
+        return result;
+    }
+
+    // loads a file that was added before again and overwrites its layer, after it changed on disk.
+    // once the array is built the new image has to match it in size, format and levels
+    bool Reload(const string& path)
+    {
+        bool reloaded = false;
+        for (map<string, PackedTexture>::iterator it = added.begin(); it != added.end(); ++it)
+        {
+            const PackedTexture& packed = it->second;
+            if (packed.path != path || packed.layer.array < 0)
+                continue;
+
+            TextureData data = LoadTextureData(path.c_str(), 0, packed.usage, true, packed.flip);
+            TextureArray& array = arrays[packed.layer.array];
+            if (data.Empty())
+            {
+                std::cout << "ERROR::MATERIALPACKER:: failed to load " << path << std::endl;
+                continue;
+            }
+            if (array.texture == 0 && (array.Matches(data) || array.layers.size() == 1))
+            {
+                array.layers[packed.layer.layer] = data; // not uploaded yet, Build takes the new data
+                reloaded = true;
+                continue;
+            }
+            if (array.texture == 0 || data.internalFormat != array.internalFormat || data.levelCount != array.levelCount
+                || data.levels[0].width != array.width || data.levels[0].height != array.height)
+            {
+                std::cout << "ERROR::MATERIALPACKER:: " << path << " changed size or format, it can't replace its layer" << std::endl;
+                continue;
+            }
+
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glState.BindTexture(GL_TEXTURE_2D_ARRAY, array.texture);
+            uploadLayer(data, packed.layer.layer);
+            glState.BindTexture(GL_TEXTURE_2D_ARRAY, 0);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            reloaded = true;
+        }
+        return reloaded;
+    }
+
+    // creates the arrays that were added to since the last Build, uploads every layer and drops the CPU copies.
+    // an array can't grow once it is built, later textures go into new arrays.
+    void Build()
+    {
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (unsigned int i = 0; i < arrays.size(); i++)
+        {
+            TextureArray& array = arrays[i];
+            if (array.texture != 0 || array.layers.empty())
+                continue;
+
+            const TextureData& first = array.layers[0];
+            int layerCount = (int)array.layers.size();
+
+            glGenTextures(1, &array.texture);
+            glState.BindTexture(GL_TEXTURE_2D_ARRAY, array.texture);
+            gpuMemory.Track(GPU_TEXTURE, array.texture, MEMORY_MODELS, "material array " + std::to_string(i));
+
+            // allocate every level for all layers, then fill them in layer by layer
+            for (int level = 0; level < first.levelCount; level++)
+            {
+                const TextureLevel& size = first.levels[level];
+                if (first.compressed)
+                    glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, first.internalFormat, size.width, size.height, layerCount, 0, (GLsizei)(size.size * layerCount), nullptr);
+                else
+                    glTexImage3D(GL_TEXTURE_2D_ARRAY, level, first.internalFormat, size.width, size.height, layerCount, 0, first.format, first.type, nullptr);
+                gpuMemory.SetImage(GPU_TEXTURE, array.texture, TextureImageIndex(level), size.size * layerCount);
+            }
+
+            for (int layer = 0; layer < layerCount; layer++)
+                uploadLayer(array.layers[layer], layer);
+
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, first.levelCount - 1);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+            std::cout << "Material array " << i << ": " << layerCount << " layers of " << first.levels[0].width << "x" << first.levels[0].height << std::endl;
+
+            // what Reload has to match once the CPU copies are gone
+            array.internalFormat = first.internalFormat;
+            array.levelCount = first.levelCount;
+            array.width = first.levels[0].width;
+            array.height = first.levels[0].height;
+            array.layers.clear();
+        }
+        glState.BindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+
+    // binds every array to its own texture unit, starting at firstUnit, and points materialArrays[i] at them.
+    // once per frame is enough for all the meshes drawn with the packed program, the program has to be current
+    void Bind(ShaderProgram& program, int firstUnit = 0) const
+    {
+        int units[MATERIAL_ARRAY_COUNT];
+        for (unsigned int i = 0; i < MATERIAL_ARRAY_COUNT; i++)
+        {
+            glState.BindTexture(firstUnit + i, GL_TEXTURE_2D_ARRAY, i < arrays.size() ? arrays[i].texture : 0);
+            units[i] = firstUnit + i;
+        }
+        // only goes to the driver the first time, the units don't change
+        program.SetIntArray("materialArrays", units, MATERIAL_ARRAY_COUNT);
+    }
+
+    // deletes the arrays, has to happen while the GL context is still there
+    void Release()
+    {
+        for (unsigned int i = 0; i < arrays.size(); i++)
+            DeleteTrackedTexture(arrays[i].texture);
+        arrays.clear();
+        added.clear();
+    }
+
+    // selects the layers of one mesh, the material uniform is an ivec2 (array, layer) per slot
+    static void SetMaterial(ShaderProgram& program, const MeshMaterial& material)
+    {
+        glm::ivec2 values[MATERIAL_SLOT_COUNT];
+        for (int i = 0; i < MATERIAL_SLOT_COUNT; i++)
+            values[i] = glm::ivec2(material.layers[i].array, material.layers[i].layer);
+        program.SetIVec2Array("material", values, MATERIAL_SLOT_COUNT);
+    }
+
+private:
+    struct TextureArray {
+        GLuint texture;
+        vector<TextureData> layers; // until Build
+        GLenum internalFormat;
+        int levelCount, width, height;
+
+        TextureArray() : texture(0), internalFormat(0), levelCount(0), width(0), height(0) {}
+
+        bool Matches(const TextureData& data) const
+        {
+            if (texture != 0)
+                return false;
+            const TextureData& first = layers[0];
+            return first.internalFormat == data.internalFormat && first.compressed == data.compressed
+                && first.levelCount == data.levelCount
+                && first.levels[0].width == data.levels[0].width && first.levels[0].height == data.levels[0].height;
+        }
+    };
+
+    // where a file went and how it was loaded, for Reload
+    struct PackedTexture {
+        MaterialLayer layer;
+        string path;
+        TextureUsage usage;
+        bool flip;
+    };
+
+    vector<TextureArray> arrays;
+    map<string, PackedTexture> added;
+
+    // fills every level of one layer of the bound array
+    static void uploadLayer(const TextureData& data, int layer)
+    {
+        for (int level = 0; level < data.levelCount; level++)
+        {
+            const TextureLevel& source = data.levels[level];
+            if (data.compressed)
+                glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, source.width, source.height, 1, data.internalFormat, (GLsizei)source.size, source.data);
+            else
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, source.width, source.height, 1, data.format, data.type, source.data);
+        }
+    }
+};
+#endif
@@ -0,0 +1,323 @@
+#ifndef TEXCACHE_H
+#define TEXCACHE_H
+
+#include <glad/glad.h>
+
+#include "stb_image.h"
+#include "texcompress.h"
+#include "mappedfile.h"
+#include "gpumemory.h"
+#include "vfs.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// where converted textures are kept between runs
+string textureCacheDirectory = "cache/textures";
+
+// one mip level of one face. data points either into storage or into the mapped cache file.
+struct TextureLevel {
+    int width, height;
+    size_t size;
+    const unsigned char* data;
+};
+
+// a texture in its final GPU format with its whole mip chain, ready to upload level by level
+struct TextureData {
+    GLenum internalFormat;
+    GLenum format;  // pixel format and type of uncompressed data, unused when compressed
+    GLenum type;
+    bool compressed;
+    int faces;
+    int levelCount;
+    vector<TextureLevel> levels; // face major: levels[face * levelCount + level]
+
+    shared_ptr<vector<unsigned char>> storage; // owns the pixels when the texture was built in memory
+    shared_ptr<MappedFile> mapping;            // keeps the cache file mapped while the levels point into it
+
+    TextureData() : internalFormat(0), format(0), type(0), compressed(false), faces(0), levelCount(0) {}
+
+    bool Empty() const { return levels.empty(); }
+
+    size_t TotalSize() const
+    {
+        size_t size = 0;
+        for (unsigned int i = 0; i < levels.size(); i++)
+            size += levels[i].size;
+        return size;
+    }
+};
+
+// layout of a cache file: this header, faces * levelCount level entries, then the level data,
+// every level starting on a 16 byte boundary
+struct TextureFileHeader {
+    char magic[4];
+    unsigned int version;
+    unsigned int internalFormat;
+    unsigned int format;
+    unsigned int type;
+    unsigned int compressed;
+    unsigned int faces;
+    unsigned int levelCount;
+};
+
+struct TextureFileLevel {
+    unsigned int width, height;
+    unsigned long long offset;
+    unsigned long long size;
+};
+
+#define TEXTURE_FILE_VERSION 1
+
+// cache file name for a source image and the options it is loaded with, empty if the source can't be read.
+// the source is hashed by content so an edited file gets a new entry even if its date doesn't change,
+// a packed source has its hash in the pack index.
+string TextureCachePath(const char* sourcePath, const string& options)
+{
+    unsigned long long hash;
+    if (!assets.Hash(sourcePath, hash))
+        return "";
+
+    hash = HashBytes(options.data(), options.size(), hash);
+
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.gtex", hash);
+    return textureCacheDirectory + "/" + name;
+}
+
+// maps a cache file and points the levels straight into the mapping
+bool ReadTextureCache(const string& cachePath, TextureData& texture)
+{
+    shared_ptr<MappedFile> mapping(new MappedFile());
+    if (!mapping->Open(cachePath.c_str()) || mapping->Size() < sizeof(TextureFileHeader))
+        return false;
+
+    const TextureFileHeader* header = (const TextureFileHeader*)mapping->Data();
+    if (memcmp(header->magic, "GTEX", 4) != 0 || header->version != TEXTURE_FILE_VERSION)
+        return false;
+
+    unsigned int count = header->faces * header->levelCount;
+    if (sizeof(TextureFileHeader) + count * sizeof(TextureFileLevel) > mapping->Size())
+        return false;
+
+    const TextureFileLevel* entries = (const TextureFileLevel*)(mapping->Data() + sizeof(TextureFileHeader));
+    texture.levels.clear();
+    for (unsigned int i = 0; i < count; i++)
+    {
+        if (entries[i].offset + entries[i].size > mapping->Size())
+            return false;
+
+        TextureLevel level;
+        level.width = entries[i].width;
+        level.height = entries[i].height;
+        level.size = (size_t)entries[i].size;
+        level.data = mapping->Data() + entries[i].offset;
+        texture.levels.push_back(level);
+    }
+
+    texture.internalFormat = header->internalFormat;
+    texture.format = header->format;
+    texture.type = header->type;
+    texture.compressed = header->compressed != 0;
+    texture.faces = header->faces;
+    texture.levelCount = header->levelCount;
+    texture.mapping = mapping;
+    return true;
+}
+
+bool WriteTextureCache(const string& cachePath, const TextureData& texture)
+{
+    std::error_code error;
+    std::filesystem::create_directories(std::filesystem::path(cachePath).parent_path(), error);
+
+    // write to a temporary name first so a crash never leaves a half written entry behind
+    string temporaryPath = cachePath + ".tmp";
+    std::ofstream file(temporaryPath, std::ios::binary);
+    if (!file.is_open())
+        return false;
+
+    TextureFileHeader header;
+    memcpy(header.magic, "GTEX", 4);
+    header.version = TEXTURE_FILE_VERSION;
+    header.internalFormat = texture.internalFormat;
+    header.format = texture.format;
+    header.type = texture.type;
+    header.compressed = texture.compressed ? 1 : 0;
+    header.faces = texture.faces;
+    header.levelCount = texture.levelCount;
+    file.write((const char*)&header, sizeof(header));
+
+    unsigned long long offset = sizeof(TextureFileHeader) + texture.levels.size() * sizeof(TextureFileLevel);
+    for (unsigned int i = 0; i < texture.levels.size(); i++)
+    {
+        offset = (offset + 15) & ~15ULL;
+        TextureFileLevel entry;
+        entry.width = texture.levels[i].width;
+        entry.height = texture.levels[i].height;
+        entry.offset = offset;
+        entry.size = texture.levels[i].size;
+        file.write((const char*)&entry, sizeof(entry));
+        offset += entry.size;
+    }
+
+    static const char padding[16] = {};
+    for (unsigned int i = 0; i < texture.levels.size(); i++)
+    {
+        size_t position = (size_t)file.tellp();
+        file.write(padding, ((position + 15) & ~(size_t)15) - position);
+        file.write((const char*)texture.levels[i].data, texture.levels[i].size);
+    }
+    file.close();
+
+    std::filesystem::rename(temporaryPath, cachePath, error);
+    return !error;
+}
+
+GLenum UncompressedInternalFormat(int channels)
+{
+    return channels == 1 ? GL_R8 : channels == 2 ? GL_RG8 : channels == 3 ? GL_RGB8 : GL_RGBA8;
+}
+
+GLenum UncompressedFormat(int channels)
+{
+    return channels == 1 ? GL_RED : channels == 2 ? GL_RG : channels == 3 ? GL_RGB : GL_RGBA;
+}
+
+// turns decoded pixels into the final texture: block compressed when the usage allows it, plain otherwise,
+// with the full mip chain built on the CPU when mipmaps is set
+TextureData BuildTextureData(const unsigned char* pixels, int width, int height, int channels, TextureUsage usage, bool mipmaps, const string& name)
+{
+    TextureData texture;
+    texture.faces = 1;
+    texture.storage.reset(new vector<unsigned char>());
+
+    // the mip chain is filtered in linear light for color, renormalized for normals and left alone for data
+    vector<MipLevel> mips;
+    if (mipmaps)
+    {
+        MipContent content = usage == TEXTURE_NORMAL ? MIP_NORMAL : usage == TEXTURE_DATA ? MIP_LINEAR : MIP_SRGB;
+        mips = GenerateMipmaps(pixels, width, height, channels, content, mipFilter);
+    }
+
+    vector<CompressedLevel> levels;
+    BlockFormat blockFormat = ChooseBlockFormat(usage);
+    if (blockFormat != BLOCK_NONE)
+    {
+        CompressedTexture compressed = CompressTexture(pixels, width, height, channels, blockFormat, mips);
+        ReportCompression(name, compressed);
+        texture.internalFormat = compressed.internalFormat;
+        texture.compressed = true;
+        levels.swap(compressed.levels);
+    }
+    else
+    {
+        texture.internalFormat = UncompressedInternalFormat(channels);
+        texture.format = UncompressedFormat(channels);
+        texture.type = GL_UNSIGNED_BYTE;
+
+        CompressedLevel level;
+        level.width = width;
+        level.height = height;
+        level.data.assign(pixels, pixels + (size_t)width * height * channels);
+        levels.push_back(level);
+
+        for (unsigned int i = 0; i < mips.size(); i++)
+        {
+            level.width = mips[i].width;
+            level.height = mips[i].height;
+            level.data.swap(mips[i].data);
+            levels.push_back(level);
+        }
+    }
+
+    // pack the levels into one block of storage and point at it
+    size_t total = 0;
+    for (unsigned int i = 0; i < levels.size(); i++)
+        total += levels[i].data.size();
+    texture.storage->resize(total);
+
+    size_t offset = 0;
+    for (unsigned int i = 0; i < levels.size(); i++)
+    {
+        memcpy(&(*texture.storage)[offset], &levels[i].data[0], levels[i].data.size());
+
+        TextureLevel level;
+        level.width = levels[i].width;
+        level.height = levels[i].height;
+        level.size = levels[i].data.size();
+        level.data = &(*texture.storage)[offset];
+        texture.levels.push_back(level);
+        offset += level.size;
+    }
+    texture.levelCount = (int)texture.levels.size();
+    return texture;
+}
+
+// returns the texture for an image file, from the cache when the same file was converted with the same
+// options before, otherwise decoded, converted and written to the cache for the next run.
+// comp forces the channel count like stbi_load, flip flips the image vertically while decoding.
+TextureData LoadTextureData(const char* path, int comp, TextureUsage usage, bool mipmaps, bool flip = false)
+{
+    stringstream options;
+    options << "comp=" << comp << " usage=" << usage << " mips=" << mipmaps << " flip=" << flip
+            << " format=" << ChooseBlockFormat(usage) << " filter=" << mipFilter << " v=" << TEXTURE_FILE_VERSION;
+
+    TextureData texture;
+    string cachePath = TextureCachePath(path, options.str());
+    if (cachePath.empty())
+        return texture;
+
+    if (ReadTextureCache(cachePath, texture))
+        return texture;
+
+    // the flip flag is per thread so loader threads don't affect each other
+    stbi_set_flip_vertically_on_load_thread(flip);
+    AssetData source;
+    if (!assets.Read(path, source))
+        return texture;
+    int width, height, channels;
+    unsigned char* pixels = stbi_load_from_memory(source.data, (int)source.size, &width, &height, &channels, comp);
+    if (!pixels)
+        return texture;
+    if (comp != 0) channels = comp;
+
+    if (usage == TEXTURE_COLOR && channels == 4)
+        usage = TEXTURE_COLOR_ALPHA;
+    texture = BuildTextureData(pixels, width, height, channels, usage, mipmaps, path);
+    stbi_image_free(pixels);
+
+    WriteTextureCache(cachePath, texture);
+    return texture;
+}
+
+// uploads a single level of one face into id, which has to be bound to target (GL_TEXTURE_2D or a cube map face).
+// the unpack alignment has to be set to 1 by the caller.
+void UploadTextureLevel(GLuint id, GLenum target, const TextureData& texture, int level, int face = 0)
+{
+    const TextureLevel& data = texture.levels[face * texture.levelCount + level];
+    if (texture.compressed)
+        glCompressedTexImage2D(target, level, texture.internalFormat, data.width, data.height, 0, (GLsizei)data.size, data.data);
+    else
+        glTexImage2D(target, level, texture.internalFormat, data.width, data.height, 0, texture.format, texture.type, data.data);
+
+    size_t bytes = texture.compressed ? data.size : TextureImageBytes(texture.internalFormat, data.width, data.height);
+    gpuMemory.SetImage(GPU_TEXTURE, id, TextureImageIndex(level, target == GL_TEXTURE_2D ? 0 : target - GL_TEXTURE_CUBE_MAP_POSITIVE_X), bytes);
+}
+
+// uploads every level of one face into id, which has to be bound to target
+void UploadTextureData(GLuint id, GLenum target, const TextureData& texture, int face = 0)
+{
+    // uncompressed rows of RGB8 and R8 data aren't 4 byte aligned
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int i = 0; i < texture.levelCount; i++)
+        UploadTextureLevel(id, target, texture, i, face);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+#endif
@@ -0,0 +1,515 @@
+#ifndef TEXCOMPRESS_H
+#define TEXCOMPRESS_H
+
+#include <glad/glad.h>
+
+#include "mipgen.h"
+#include "workerpool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// block compressed formats that are not part of the GL 3.3 core glad was generated for
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#endif
+
+enum BlockFormat {
+    BLOCK_NONE, // not compressed, uploaded as RGB/RGBA8
+    BLOCK_BC1,  // RGB, 4 bits per pixel
+    BLOCK_BC3,  // RGBA with a separate alpha block, 8 bits per pixel
+    BLOCK_BC5,  // two channels (normal map x/y), 8 bits per pixel
+    BLOCK_BC7   // RGBA, high quality, 8 bits per pixel
+};
+
+// what a texture is used for, decides the block format it gets
+enum TextureUsage {
+    TEXTURE_COLOR,
+    TEXTURE_COLOR_ALPHA,
+    TEXTURE_NORMAL,
+    TEXTURE_DATA // values that must survive exactly, like height maps, never compressed
+};
+
+struct CompressedLevel {
+    int width, height;
+    vector<unsigned char> data;
+};
+
+struct CompressedTexture {
+    BlockFormat format;
+    GLenum internalFormat;
+    vector<CompressedLevel> levels;
+    // size of the same mip chain as uncompressed RGB/RGBA8, for the report
+    size_t uncompressedBytes;
+    double encodeSeconds;
+};
+
+// which of the optional formats the driver can sample, filled by InitTextureCompression
+bool s3tcSupported = false;
+bool bptcSupported = false;
+// switch to fall back to uncompressed uploads everywhere
+bool compressTextures = true;
+
+bool IsExtensionSupported(const char* name)
+{
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++)
+    {
+        const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+        if (extension && strcmp(extension, name) == 0)
+            return true;
+    }
+    return false;
+}
+
+// has to be called once the GL context exists
+void InitTextureCompression()
+{
+    s3tcSupported = IsExtensionSupported("GL_EXT_texture_compression_s3tc");
+
+    GLint major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    bptcSupported = major > 4 || (major == 4 && minor >= 2) || IsExtensionSupported("GL_ARB_texture_compression_bptc");
+}
+
+// picks the best supported format for a usage. BC5 (RGTC) is core since 3.0 so normal maps always compress.
+BlockFormat ChooseBlockFormat(TextureUsage usage)
+{
+    if (!compressTextures || usage == TEXTURE_DATA)
+        return BLOCK_NONE;
+
+    if (usage == TEXTURE_NORMAL)
+        return BLOCK_BC5;
+    if (usage == TEXTURE_COLOR_ALPHA)
+        return s3tcSupported ? BLOCK_BC3 : (bptcSupported ? BLOCK_BC7 : BLOCK_NONE);
+    return s3tcSupported ? BLOCK_BC1 : (bptcSupported ? BLOCK_BC7 : BLOCK_NONE);
+}
+
+GLenum BlockInternalFormat(BlockFormat format)
+{
+    switch (format)
+    {
+    case BLOCK_BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case BLOCK_BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    case BLOCK_BC5: return GL_COMPRESSED_RG_RGTC2;
+    case BLOCK_BC7: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+    default: return GL_RGBA8;
+    }
+}
+
+int BlockBytes(BlockFormat format)
+{
+    return format == BLOCK_BC1 ? 8 : 16;
+}
+
+// ---- block encoders, all of them take the 16 pixels of a 4x4 block as RGBA ----
+
+static unsigned short packRGB565(const float color[3])
+{
+    int r = std::min(31, std::max(0, (int)(color[0] * 31.0f / 255.0f + 0.5f)));
+    int g = std::min(63, std::max(0, (int)(color[1] * 63.0f / 255.0f + 0.5f)));
+    int b = std::min(31, std::max(0, (int)(color[2] * 31.0f / 255.0f + 0.5f)));
+    return (unsigned short)((r << 11) | (g << 5) | b);
+}
+
+static void unpackRGB565(unsigned short packed, float color[3])
+{
+    int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+    color[0] = (float)((r << 3) | (r >> 2));
+    color[1] = (float)((g << 2) | (g >> 4));
+    color[2] = (float)((b << 3) | (b >> 2));
+}
+
+// finds the line through the block colors (mean + principal axis via power iteration) and returns
+// the two colors at the ends of the pixels' projection onto it. channels is 3 or 4.
+static void fitEndpoints(const unsigned char* block, int channels, float low[4], float high[4])
+{
+    float mean[4] = { 0, 0, 0, 0 };
+    for (int i = 0; i < 16; i++)
+        for (int c = 0; c < channels; c++)
+            mean[c] += block[i * 4 + c] / 16.0f;
+
+    float covariance[4][4] = {};
+    for (int i = 0; i < 16; i++)
+    {
+        float d[4];
+        for (int c = 0; c < channels; c++)
+            d[c] = block[i * 4 + c] - mean[c];
+        for (int a = 0; a < channels; a++)
+            for (int b = 0; b < channels; b++)
+                covariance[a][b] += d[a] * d[b];
+    }
+
+    float axis[4] = { 1, 1, 1, 1 };
+    for (int iteration = 0; iteration < 8; iteration++)
+    {
+        float next[4] = { 0, 0, 0, 0 };
+        float length = 0;
+        for (int a = 0; a < channels; a++)
+        {
+            for (int b = 0; b < channels; b++)
+                next[a] += covariance[a][b] * axis[b];
+            length += next[a] * next[a];
+        }
+        if (length < 1e-8f)
+            break;
+        length = sqrt(length);
+        for (int a = 0; a < channels; a++)
+            axis[a] = next[a] / length;
+    }
+
+    float minT = 1e30f, maxT = -1e30f;
+    for (int i = 0; i < 16; i++)
+    {
+        float t = 0;
+        for (int c = 0; c < channels; c++)
+            t += (block[i * 4 + c] - mean[c]) * axis[c];
+        minT = std::min(minT, t);
+        maxT = std::max(maxT, t);
+    }
+
+    for (int c = 0; c < channels; c++)
+    {
+        low[c] = std::min(255.0f, std::max(0.0f, mean[c] + axis[c] * minT));
+        high[c] = std::min(255.0f, std::max(0.0f, mean[c] + axis[c] * maxT));
+    }
+}
+
+void EncodeBC1Block(const unsigned char* block, unsigned char* out)
+{
+    float low[4], high[4];
+    fitEndpoints(block, 3, low, high);
+
+    unsigned short color0 = packRGB565(high);
+    unsigned short color1 = packRGB565(low);
+    // color0 > color1 selects the four color mode
+    if (color0 < color1)
+        std::swap(color0, color1);
+
+    float palette[4][3];
+    unpackRGB565(color0, palette[0]);
+    unpackRGB565(color1, palette[1]);
+    for (int c = 0; c < 3; c++)
+    {
+        palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3.0f;
+        palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3.0f;
+    }
+
+    unsigned int indices = 0;
+    if (color0 != color1)
+    {
+        for (int i = 0; i < 16; i++)
+        {
+            int best = 0;
+            float bestError = 1e30f;
+            for (int p = 0; p < 4; p++)
+            {
+                float error = 0;
+                for (int c = 0; c < 3; c++)
+                {
+                    float d = block[i * 4 + c] - palette[p][c];
+                    error += d * d;
+                }
+                if (error < bestError)
+                {
+                    bestError = error;
+                    best = p;
+                }
+            }
+            indices |= (unsigned int)best << (i * 2);
+        }
+    }
+
+    out[0] = color0 & 0xFF; out[1] = color0 >> 8;
+    out[2] = color1 & 0xFF; out[3] = color1 >> 8;
+    out[4] = indices & 0xFF; out[5] = (indices >> 8) & 0xFF;
+    out[6] = (indices >> 16) & 0xFF; out[7] = (indices >> 24) & 0xFF;
+}
+
+// single channel block (BC4), used for the alpha of BC3 and both channels of BC5.
+// channel selects which of the RGBA bytes to encode.
+void EncodeBC4Block(const unsigned char* block, int channel, unsigned char* out)
+{
+    int minValue = 255, maxValue = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        minValue = std::min(minValue, (int)block[i * 4 + channel]);
+        maxValue = std::max(maxValue, (int)block[i * 4 + channel]);
+    }
+
+    // endpoint0 > endpoint1 selects the eight value mode
+    out[0] = (unsigned char)maxValue;
+    out[1] = (unsigned char)minValue;
+
+    unsigned long long indices = 0;
+    if (maxValue != minValue)
+    {
+        float palette[8];
+        palette[0] = (float)maxValue;
+        palette[1] = (float)minValue;
+        for (int p = 2; p < 8; p++)
+            palette[p] = ((8 - p) * maxValue + (p - 1) * minValue) / 7.0f;
+
+        for (int i = 0; i < 16; i++)
+        {
+            int best = 0;
+            float bestError = 1e30f;
+            for (int p = 0; p < 8; p++)
+            {
+                float error = fabs(block[i * 4 + channel] - palette[p]);
+                if (error < bestError)
+                {
+                    bestError = error;
+                    best = p;
+                }
+            }
+            indices |= (unsigned long long)best << (i * 3);
+        }
+    }
+
+    for (int i = 0; i < 6; i++)
+        out[2 + i] = (unsigned char)((indices >> (i * 8)) & 0xFF);
+}
+
+void EncodeBC3Block(const unsigned char* block, unsigned char* out)
+{
+    EncodeBC4Block(block, 3, out);
+    EncodeBC1Block(block, out + 8);
+}
+
+void EncodeBC5Block(const unsigned char* block, unsigned char* out)
+{
+    EncodeBC4Block(block, 0, out);
+    EncodeBC4Block(block, 1, out + 8);
+}
+
+// writes bits least significant first into a 16 byte block
+struct BlockBitWriter {
+    unsigned char* out;
+    int position;
+
+    BlockBitWriter(unsigned char* block) : out(block), position(0)
+    {
+        memset(out, 0, 16);
+    }
+
+    void Write(unsigned int value, int bits)
+    {
+        for (int i = 0; i < bits; i++, position++)
+        {
+            if (value & (1u << i))
+                out[position >> 3] |= (unsigned char)(1 << (position & 7));
+        }
+    }
+};
+
+// BC7 mode 6 only: one subset, RGBA endpoints with 7 bits + a p-bit each and 4 bit indices.
+// that covers photographic color and alpha maps well and keeps the encoder small.
+void EncodeBC7Block(const unsigned char* block, unsigned char* out)
+{
+    static const int weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+    float ends[2][4];
+    fitEndpoints(block, 4, ends[0], ends[1]);
+
+    // quantize each endpoint to 7 bits per channel, trying both p-bits
+    int quantized[2][4];
+    int pbits[2];
+    for (int e = 0; e < 2; e++)
+    {
+        float bestError = 1e30f;
+        for (int p = 0; p < 2; p++)
+        {
+            int candidate[4];
+            float error = 0;
+            for (int c = 0; c < 4; c++)
+            {
+                candidate[c] = std::min(127, std::max(0, (int)floor((ends[e][c] - p) / 2.0f + 0.5f)));
+                float d = ((candidate[c] << 1) | p) - ends[e][c];
+                error += d * d;
+            }
+            if (error < bestError)
+            {
+                bestError = error;
+                pbits[e] = p;
+                memcpy(quantized[e], candidate, sizeof(candidate));
+            }
+        }
+    }
+
+    int indices[16];
+    for (int pass = 0; pass < 2; pass++)
+    {
+        int expanded[2][4];
+        for (int e = 0; e < 2; e++)
+            for (int c = 0; c < 4; c++)
+                expanded[e][c] = (quantized[e][c] << 1) | pbits[e];
+
+        for (int i = 0; i < 16; i++)
+        {
+            int best = 0;
+            int bestError = 1 << 30;
+            for (int w = 0; w < 16; w++)
+            {
+                int error = 0;
+                for (int c = 0; c < 4; c++)
+                {
+                    int value = ((64 - weights[w]) * expanded[0][c] + weights[w] * expanded[1][c] + 32) >> 6;
+                    int d = value - block[i * 4 + c];
+                    error += d * d;
+                }
+                if (error < bestError)
+                {
+                    bestError = error;
+                    best = w;
+                }
+            }
+            indices[i] = best;
+        }
+
+        // the first index is stored with 3 bits, so its top bit must be zero. swapping the endpoints
+        // inverts every index and fixes that.
+        if (indices[0] < 8)
+            break;
+        for (int c = 0; c < 4; c++)
+            std::swap(quantized[0][c], quantized[1][c]);
+        std::swap(pbits[0], pbits[1]);
+    }
+
+    BlockBitWriter writer(out);
+    writer.Write(1 << 6, 7); // mode 6
+    for (int c = 0; c < 4; c++)
+    {
+        writer.Write(quantized[0][c], 7);
+        writer.Write(quantized[1][c], 7);
+    }
+    writer.Write(pbits[0], 1);
+    writer.Write(pbits[1], 1);
+    writer.Write(indices[0], 3);
+    for (int i = 1; i < 16; i++)
+        writer.Write(indices[i], 4);
+}
+
+// copies a 4x4 block out of an image as RGBA, clamping at the borders for sizes that aren't a multiple of 4.
+// grayscale becomes gray RGB, missing alpha becomes opaque.
+static void fetchBlock(const unsigned char* pixels, int width, int height, int channels, int blockX, int blockY, unsigned char* block)
+{
+    for (int y = 0; y < 4; y++)
+    {
+        for (int x = 0; x < 4; x++)
+        {
+            int px = std::min(blockX * 4 + x, width - 1);
+            int py = std::min(blockY * 4 + y, height - 1);
+            const unsigned char* src = pixels + ((size_t)py * width + px) * channels;
+            unsigned char* dst = block + (y * 4 + x) * 4;
+
+            dst[0] = src[0];
+            dst[1] = channels > 1 ? src[1] : src[0];
+            dst[2] = channels > 2 ? src[2] : src[0];
+            dst[3] = channels > 3 ? src[3] : 255;
+        }
+    }
+}
+
+// compresses one image, splitting the rows of blocks over the worker pool
+CompressedLevel CompressLevel(const unsigned char* pixels, int width, int height, int channels, BlockFormat format)
+{
+    CompressedLevel level;
+    level.width = width;
+    level.height = height;
+
+    int blocksX = (width + 3) / 4;
+    int blocksY = (height + 3) / 4;
+    int blockBytes = BlockBytes(format);
+    level.data.resize((size_t)blocksX * blocksY * blockBytes);
+
+    workerPool.ParallelFor((unsigned int)blocksY, 4, [&](unsigned int begin, unsigned int end) {
+        unsigned char block[64];
+        for (int by = (int)begin; by < (int)end; by++)
+        {
+            for (int bx = 0; bx < blocksX; bx++)
+            {
+                fetchBlock(pixels, width, height, channels, bx, by, block);
+                unsigned char* out = &level.data[((size_t)by * blocksX + bx) * blockBytes];
+                switch (format)
+                {
+                case BLOCK_BC1: EncodeBC1Block(block, out); break;
+                case BLOCK_BC3: EncodeBC3Block(block, out); break;
+                case BLOCK_BC5: EncodeBC5Block(block, out); break;
+                case BLOCK_BC7: EncodeBC7Block(block, out); break;
+                default: break;
+                }
+            }
+        }
+    });
+
+    return level;
+}
+
+// compresses an image and the mip levels built for it (see GenerateMipmaps), mipmaps may be empty
+CompressedTexture CompressTexture(const unsigned char* pixels, int width, int height, int channels, BlockFormat format, const vector<MipLevel>& mipmaps)
+{
+    CompressedTexture texture;
+    texture.format = format;
+    texture.internalFormat = BlockInternalFormat(format);
+    texture.uncompressedBytes = 0;
+
+    auto start = chrono::high_resolution_clock::now();
+
+    for (int i = -1; i < (int)mipmaps.size(); i++)
+    {
+        const unsigned char* levelPixels = i < 0 ? pixels : &mipmaps[i].data[0];
+        int levelWidth = i < 0 ? width : mipmaps[i].width;
+        int levelHeight = i < 0 ? height : mipmaps[i].height;
+        texture.levels.push_back(CompressLevel(levelPixels, levelWidth, levelHeight, channels, format));
+        texture.uncompressedBytes += (size_t)levelWidth * levelHeight * (channels == 4 ? 4 : 3);
+    }
+
+    texture.encodeSeconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+    return texture;
+}
+
+size_t CompressedSize(const CompressedTexture& texture)
+{
+    size_t size = 0;
+    for (unsigned int i = 0; i < texture.levels.size(); i++)
+        size += texture.levels[i].data.size();
+    return size;
+}
+
+// uploads every level of a compressed texture to target, which has to be bound (GL_TEXTURE_2D or a cube face)
+void UploadCompressedLevels(GLenum target, const CompressedTexture& texture)
+{
+    for (unsigned int i = 0; i < texture.levels.size(); i++)
+    {
+        const CompressedLevel& level = texture.levels[i];
+        glCompressedTexImage2D(target, i, texture.internalFormat, level.width, level.height, 0, (GLsizei)level.data.size(), &level.data[0]);
+    }
+}
+
+void ReportCompression(const string& name, const CompressedTexture& texture)
+{
+    static const char* formatNames[] = { "RGBA8", "BC1", "BC3", "BC5", "BC7" };
+    size_t compressed = CompressedSize(texture);
+    double megabytes = texture.uncompressedBytes / (1024.0 * 1024.0);
+
+    cout << "Compressed " << name << " to " << formatNames[texture.format] << ": "
+         << texture.uncompressedBytes / 1024 << " KB -> " << compressed / 1024 << " KB (saved "
+         << (texture.uncompressedBytes - compressed) / 1024 << " KB), "
+         << (texture.encodeSeconds > 0 ? megabytes / texture.encodeSeconds : 0.0) << " MB/s" << endl;
+}
+#endif
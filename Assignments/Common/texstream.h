@@ -0,0 +1,382 @@
+#ifndef TEXSTREAM_H
+#define TEXSTREAM_H
+
+#include <glad/glad.h>
+
+#include "glstate.h"
+#include "texcache.h"
+#include "spscqueue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+// switch to upload every texture completely before it is used, like before streaming existed
+bool streamTextures = true;
+
+// uploads textures a few mip levels at a time. a new texture starts out as a single placeholder texel,
+// then its smallest levels go up first and GL_TEXTURE_BASE_LEVEL is lowered as the larger ones follow,
+// so the texture can be sampled from the first frame and sharpens over the next frames.
+// every texture keeps its source data and a wanted level, which is 0 (everything) unless a residency
+// manager asks for less. levels finer than the wanted level are dropped from video memory again.
+// everything except the file loading on the worker thread has to happen on the GL thread.
+class TextureStreamer {
+public:
+    // bytes uploaded per Update, a single level bigger than this still goes up alone
+    size_t frameBudget;
+
+    TextureStreamer(size_t budget = 4 * 1024 * 1024) : frameBudget(budget), running(true), pending(0)
+    {
+        worker = thread(&TextureStreamer::run, this);
+    }
+
+    ~TextureStreamer()
+    {
+        running = false;
+        worker.join();
+
+        Loaded* loaded;
+        while (finished.Pop(loaded))
+            delete loaded;
+    }
+
+    // returns a texture that can be bound right away. the file is read (or converted) on the worker thread
+    // and streamed in by the following calls to Update. category is where the memory tracker books it.
+    GLuint Load(const char* path, int comp = 0, TextureUsage usage = TEXTURE_COLOR, MemoryCategory category = MEMORY_OTHER, bool flip = false)
+    {
+        GLuint texture = createPlaceholder(usage);
+        gpuMemory.Track(GPU_TEXTURE, texture, category, path);
+
+        Request request;
+        request.texture = texture;
+        request.path = path;
+        request.comp = comp;
+        request.usage = usage;
+        request.flip = flip;
+        sources[texture] = request;
+        queueLoad(request);
+        return texture;
+    }
+
+    // reads the file of a texture that came from Load again, after it changed on disk. the texture
+    // keeps showing its old levels until the new ones are loaded, then they are swapped in place.
+    void Reload(GLuint texture)
+    {
+        map<GLuint, Request>::iterator it = sources.find(texture);
+        if (it != sources.end())
+            queueLoad(it->second);
+    }
+
+    // puts new data into a texture that came from Load or Stream, the texture object stays the same
+    void Replace(GLuint texture, const TextureData& data)
+    {
+        startStreaming(texture, data);
+    }
+
+    // same as Load for data that is already in memory, like the images a model decoded
+    GLuint Stream(const TextureData& data, TextureUsage usage = TEXTURE_COLOR, MemoryCategory category = MEMORY_OTHER, const string& name = "")
+    {
+        GLuint texture = createPlaceholder(usage);
+        gpuMemory.Track(GPU_TEXTURE, texture, category, name);
+        startStreaming(texture, data);
+        return texture;
+    }
+
+    // takes the textures the worker finished, drops levels that are no longer wanted and uploads
+    // levels until the frame budget is used up. the textures with the smallest outstanding level go first,
+    // so every texture gets its low resolution levels before any texture gets its full size one.
+    void Update()
+    {
+        Loaded* loaded;
+        while (finished.Pop(loaded))
+        {
+            if (loaded->data.Empty())
+                std::cout << "Error loading texture: " << loaded->path << std::endl;
+            startStreaming(loaded->texture, loaded->data);
+            delete loaded;
+            pending--;
+        }
+
+        vector<Entry*> loading;
+        for (map<GLuint, Entry>::iterator it = entries.begin(); it != entries.end(); ++it)
+        {
+            Entry& entry = it->second;
+            if (entry.residentLevel < entry.wantedLevel)
+                evict(entry);
+            else if (entry.residentLevel > entry.wantedLevel)
+                loading.push_back(&entry);
+        }
+        if (loading.empty())
+            return;
+
+        std::sort(loading.begin(), loading.end(), [](const Entry* a, const Entry* b) {
+            return a->data.levels[a->residentLevel - 1].size < b->data.levels[b->residentLevel - 1].size;
+        });
+
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        size_t uploaded = 0;
+        for (unsigned int i = 0; i < loading.size() && uploaded < frameBudget; i++)
+        {
+            Entry& entry = *loading[i];
+            glState.BindTexture(GL_TEXTURE_2D, entry.texture);
+
+            int firstLevel = entry.residentLevel;
+            while (entry.residentLevel > entry.wantedLevel)
+            {
+                size_t size = entry.data.levels[entry.residentLevel - 1].size;
+                if (uploaded > 0 && uploaded + size > frameBudget)
+                    break;
+
+                UploadTextureLevel(entry.texture, GL_TEXTURE_2D, entry.data, entry.residentLevel - 1);
+                uploaded += size;
+                entry.residentLevel--;
+            }
+
+            // only the levels that are there may be sampled, everything from the base level down is complete
+            if (entry.residentLevel != firstLevel)
+            {
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, entry.data.levelCount - 1);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, entry.residentLevel);
+            }
+        }
+        glState.BindTexture(GL_TEXTURE_2D, 0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+
+    // true while any texture is still loading or missing wanted levels
+    bool Busy() const
+    {
+        if (pending > 0)
+            return true;
+        for (map<GLuint, Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it)
+        {
+            if (it->second.residentLevel > it->second.wantedLevel)
+                return true;
+        }
+        return false;
+    }
+
+    // the source data of a streamed texture, null for textures the streamer doesn't manage
+    const TextureData* Data(GLuint texture) const
+    {
+        map<GLuint, Entry>::const_iterator it = entries.find(texture);
+        return it == entries.end() ? nullptr : &it->second.data;
+    }
+
+    // deletes a texture that came from Load or Stream, along with its source data
+    void Release(GLuint texture)
+    {
+        entries.erase(texture);
+        sources.erase(texture);
+        DeleteTrackedTexture(texture);
+    }
+
+    // every texture the streamer manages
+    vector<GLuint> Textures() const
+    {
+        vector<GLuint> textures;
+        for (map<GLuint, Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it)
+            textures.push_back(it->first);
+        return textures;
+    }
+
+    // finest level the texture should have resident, levels below it are loaded or dropped by Update
+    void SetWantedLevel(GLuint texture, int level)
+    {
+        map<GLuint, Entry>::iterator it = entries.find(texture);
+        if (it != entries.end())
+            it->second.wantedLevel = std::min(std::max(level, 0), it->second.data.levelCount - 1);
+    }
+
+    // video memory taken by the resident levels of all streamed textures
+    size_t ResidentBytes() const
+    {
+        size_t bytes = 0;
+        for (map<GLuint, Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it)
+        {
+            const Entry& entry = it->second;
+            for (int level = entry.residentLevel; level < entry.data.levelCount; level++)
+                bytes += entry.data.levels[level].size;
+        }
+        return bytes;
+    }
+
+private:
+    struct Request {
+        GLuint texture;
+        string path;
+        int comp;
+        TextureUsage usage;
+        bool flip;
+    };
+
+    struct Loaded {
+        GLuint texture;
+        string path;
+        TextureData data;
+    };
+
+    struct Entry {
+        GLuint texture;
+        TextureData data;
+        int residentLevel; // finest level on the GPU, levelCount while only the placeholder is there
+        int wantedLevel;
+    };
+
+    SpscQueue<Request, 256> requests;
+    // results go through as pointers so the queue slots don't keep the texture data alive
+    SpscQueue<Loaded*, 256> finished;
+    map<GLuint, Entry> entries;
+    // how every texture from Load was loaded, for Reload
+    map<GLuint, Request> sources;
+
+    thread worker;
+    atomic<bool> running;
+    unsigned int pending;
+
+    void run()
+    {
+        while (running)
+        {
+            Request request;
+            if (!requests.Pop(request))
+            {
+                this_thread::sleep_for(chrono::milliseconds(1));
+                continue;
+            }
+
+            Loaded* loaded = new Loaded();
+            loaded->texture = request.texture;
+            loaded->path = request.path;
+            loaded->data = LoadTextureData(request.path.c_str(), request.comp, request.usage, true, request.flip);
+
+            while (!finished.Push(loaded))
+                this_thread::yield();
+        }
+    }
+
+    // a one texel texture in a neutral color that is shown until the real levels arrive
+    GLuint createPlaceholder(TextureUsage usage)
+    {
+        unsigned char texel[4] = { 128, 128, 128, 255 };
+        if (usage == TEXTURE_NORMAL)
+            texel[2] = 255;
+
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glState.BindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, texel);
+        gpuMemory.SetImage(GPU_TEXTURE, texture, TextureImageIndex(0), 4);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glState.BindTexture(GL_TEXTURE_2D, 0);
+        return texture;
+    }
+
+    // loads the file right away without streaming, or hands it to the worker
+    void queueLoad(const Request& request)
+    {
+        if (!streamTextures)
+        {
+            TextureData data = LoadTextureData(request.path.c_str(), request.comp, request.usage, true, request.flip);
+            if (data.Empty())
+                std::cout << "Error loading texture: " << request.path << std::endl;
+            startStreaming(request.texture, data);
+            return;
+        }
+
+        while (!requests.Push(request))
+            this_thread::yield();
+        pending++;
+    }
+
+    void startStreaming(GLuint texture, const TextureData& data)
+    {
+        if (data.Empty())
+            return;
+
+        map<GLuint, Entry>::iterator existing = entries.find(texture);
+        if (existing != entries.end())
+        {
+            replace(existing->second, data);
+            return;
+        }
+
+        if (!streamTextures)
+        {
+            glState.BindTexture(GL_TEXTURE_2D, texture);
+            UploadTextureData(texture, GL_TEXTURE_2D, data);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, data.levelCount - 1);
+            glState.BindTexture(GL_TEXTURE_2D, 0);
+            return;
+        }
+
+        // the placeholder stays the only level (base = max = 0) until Update puts real levels in
+        Entry entry;
+        entry.texture = texture;
+        entry.data = data;
+        entry.residentLevel = data.levelCount;
+        entry.wantedLevel = 0;
+        entries[texture] = entry;
+    }
+
+    // a level redefined with a size of 0 holds no image any more, the driver frees its storage.
+    // the texture has to be bound
+    static void dropLevel(const Entry& entry, int level)
+    {
+        if (entry.data.compressed)
+            glCompressedTexImage2D(GL_TEXTURE_2D, level, entry.data.internalFormat, 0, 0, 0, 0, nullptr);
+        else
+            glTexImage2D(GL_TEXTURE_2D, level, entry.data.internalFormat, 0, 0, 0, entry.data.format, entry.data.type, nullptr);
+        gpuMemory.SetImage(GPU_TEXTURE, entry.texture, TextureImageIndex(level), 0);
+    }
+
+    // moves the base level up to the wanted level and gives the memory of the finer levels back
+    void evict(Entry& entry)
+    {
+        glState.BindTexture(GL_TEXTURE_2D, entry.texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, entry.wantedLevel);
+        for (int level = entry.residentLevel; level < entry.wantedLevel; level++)
+            dropLevel(entry, level);
+        glState.BindTexture(GL_TEXTURE_2D, 0);
+        entry.residentLevel = entry.wantedLevel;
+    }
+
+    // swaps the levels of a streamed texture for new data. a reload is rare and asked for, so the wanted
+    // levels all go up at once instead of over several frames, and the old image never mixes with the new one.
+    void replace(Entry& entry, const TextureData& data)
+    {
+        glState.BindTexture(GL_TEXTURE_2D, entry.texture);
+
+        // levels the new data doesn't have, or that were only waiting to be evicted, go away
+        for (int level = data.levelCount; level < entry.data.levelCount; level++)
+            dropLevel(entry, level);
+        int wantedLevel = std::min(entry.wantedLevel, data.levelCount - 1);
+        for (int level = std::min(entry.residentLevel, wantedLevel); level < wantedLevel; level++)
+            dropLevel(entry, level);
+
+        entry.data = data;
+        entry.wantedLevel = wantedLevel;
+
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (int level = wantedLevel; level < data.levelCount; level++)
+            UploadTextureLevel(entry.texture, GL_TEXTURE_2D, data, level);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, data.levelCount - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, wantedLevel);
+        glState.BindTexture(GL_TEXTURE_2D, 0);
+        entry.residentLevel = wantedLevel;
+    }
+};
+#endif
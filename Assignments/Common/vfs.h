@@ -0,0 +1,549 @@
+#ifndef VFS_H
+#define VFS_H
+
+#include <assimp/IOStream.hpp>
+#include <assimp/IOSystem.hpp>
+
+#include "mappedfile.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// the pack the programs look for next to their shaders, textures and models
+#define ASSET_PACK_PATH "assets.pak"
+
+// 64 bit FNV-1a, seeded with the previous hash to chain several inputs
+unsigned long long HashBytes(const void* data, size_t size, unsigned long long hash = 14695981039346656037ULL)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// ----------------------------------------------------------------------------------------------------
+// LZ4 block format (no frame around it): every sequence is a token, literals copied as they are and a
+// match that repeats earlier output. a match is at least 4 bytes long, at most 64 KB back, and the last
+// 5 bytes of a block are always literals.
+
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5
+// a match can't start closer to the end than this
+#define LZ4_MATCH_LIMIT 12
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_HASH_BITS 16
+
+inline void lz4WriteLength(vector<unsigned char>& out, size_t length)
+{
+    while (length >= 255)
+    {
+        out.push_back(255);
+        length -= 255;
+    }
+    out.push_back((unsigned char)length);
+}
+
+// one sequence, matchLength 0 for the last one which only has literals
+inline void lz4WriteSequence(vector<unsigned char>& out, const unsigned char* literals, size_t literalLength, size_t offset, size_t matchLength)
+{
+    size_t matchCode = matchLength ? matchLength - LZ4_MIN_MATCH : 0;
+    out.push_back((unsigned char)((std::min(literalLength, (size_t)15) << 4) | std::min(matchCode, (size_t)15)));
+    if (literalLength >= 15)
+        lz4WriteLength(out, literalLength - 15);
+    out.insert(out.end(), literals, literals + literalLength);
+    if (matchLength == 0)
+        return;
+
+    out.push_back((unsigned char)(offset & 0xFF));
+    out.push_back((unsigned char)(offset >> 8));
+    if (matchCode >= 15)
+        lz4WriteLength(out, matchCode - 15);
+}
+
+inline unsigned int lz4Read32(const unsigned char* data)
+{
+    unsigned int value;
+    memcpy(&value, data, 4);
+    return value;
+}
+
+// compresses into one LZ4 block. greedy: the first match found for a position is taken, the same
+// trade LZ4's fast mode makes, decoding speed doesn't depend on how hard the encoder looked
+vector<unsigned char> Lz4Compress(const unsigned char* source, size_t size)
+{
+    vector<unsigned char> out;
+    out.reserve(size + size / 255 + 16);
+
+    // last position a 4 byte sequence was seen at, plus one so 0 means never
+    vector<size_t> table((size_t)1 << LZ4_HASH_BITS, 0);
+    size_t anchor = 0, position = 0;
+    while (position + LZ4_MATCH_LIMIT <= size)
+    {
+        unsigned int sequence = lz4Read32(source + position);
+        unsigned int hash = (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+        size_t candidate = table[hash];
+        table[hash] = position + 1;
+        if (candidate == 0 || position - (candidate - 1) > LZ4_MAX_OFFSET || lz4Read32(source + candidate - 1) != sequence)
+        {
+            position++;
+            continue;
+        }
+
+        size_t match = candidate - 1;
+        size_t length = LZ4_MIN_MATCH;
+        while (position + length < size - LZ4_LAST_LITERALS && source[match + length] == source[position + length])
+            length++;
+
+        lz4WriteSequence(out, source + anchor, position - anchor, position - match, length);
+        position += length;
+        anchor = position;
+    }
+    lz4WriteSequence(out, source + anchor, size - anchor, 0, 0);
+    return out;
+}
+
+// decodes one LZ4 block into exactly size bytes, false when the block is damaged
+bool Lz4Decompress(const unsigned char* source, size_t sourceSize, unsigned char* destination, size_t size)
+{
+    const unsigned char* in = source;
+    const unsigned char* inEnd = source + sourceSize;
+    unsigned char* out = destination;
+    unsigned char* outEnd = destination + size;
+
+    while (in < inEnd)
+    {
+        unsigned int token = *in++;
+        size_t literals = token >> 4;
+        if (literals == 15)
+        {
+            unsigned char extra;
+            do
+            {
+                if (in >= inEnd)
+                    return false;
+                extra = *in++;
+                literals += extra;
+            } while (extra == 255);
+        }
+        if (literals > (size_t)(inEnd - in) || literals > (size_t)(outEnd - out))
+            return false;
+        memcpy(out, in, literals);
+        in += literals;
+        out += literals;
+
+        // the last sequence ends after its literals
+        if (in == inEnd)
+            break;
+
+        if (inEnd - in < 2)
+            return false;
+        size_t offset = in[0] | ((size_t)in[1] << 8);
+        in += 2;
+        if (offset == 0 || offset > (size_t)(out - destination))
+            return false;
+
+        size_t length = token & 15;
+        if (length == 15)
+        {
+            unsigned char extra;
+            do
+            {
+                if (in >= inEnd)
+                    return false;
+                extra = *in++;
+                length += extra;
+            } while (extra == 255);
+        }
+        length += LZ4_MIN_MATCH;
+        if (length > (size_t)(outEnd - out))
+            return false;
+
+        // byte by byte, a match may overlap the bytes it's producing to repeat a short pattern
+        const unsigned char* match = out - offset;
+        for (size_t i = 0; i < length; i++)
+            out[i] = match[i];
+        out += length;
+    }
+    return out == outEnd;
+}
+
+// ----------------------------------------------------------------------------------------------------
+// pack file: this header, the data of every entry (each starting on a 16 byte boundary), then the index,
+// entryCount PackEntry records followed by the paths they point into
+
+#define PACK_FILE_VERSION 1
+#define PACK_STORED 0
+#define PACK_LZ4 1
+
+struct PackHeader {
+    char magic[4]; // "GPAK"
+    unsigned int version;
+    unsigned int entryCount;
+    unsigned int pathBytes;
+    unsigned long long indexOffset;
+};
+
+struct PackEntry {
+    unsigned long long offset;
+    unsigned long long storedSize; // in the pack, compressed or not
+    unsigned long long size;       // of the file itself
+    unsigned long long hash;       // HashBytes of the file itself
+    unsigned int pathOffset;       // into the paths after the index
+    unsigned int pathLength;
+    unsigned int compression;      // PACK_STORED or PACK_LZ4
+    unsigned int padding;
+};
+
+// the bytes of one asset, pointing into the pack mapping, a mapped loose file or a buffer of their own,
+// whichever they came from. owner keeps that alive as long as the data is used
+struct AssetData {
+    const unsigned char* data;
+    size_t size;
+    shared_ptr<const void> owner;
+
+    AssetData() : data(nullptr), size(0) {}
+
+    bool Empty() const { return data == nullptr; }
+};
+
+// the one place shaders, textures and models are read from. with a pack mounted a path is looked up in its
+// index and uncompressed entries are handed out straight from the mapping, no copy and no open per file.
+// paths that aren't in the pack, and files that changed on disk after it was built, come from loose files.
+class AssetFileSystem {
+public:
+    // opens the pack and reads its index, the pack stays mapped until the last data read from it is gone
+    bool Mount(const char* path)
+    {
+        shared_ptr<MappedFile> mapping(new MappedFile());
+        if (!mapping->Open(path) || mapping->Size() < sizeof(PackHeader))
+            return false;
+
+        const PackHeader* header = (const PackHeader*)mapping->Data();
+        if (memcmp(header->magic, "GPAK", 4) != 0 || header->version != PACK_FILE_VERSION
+            || header->indexOffset + (unsigned long long)header->entryCount * sizeof(PackEntry) + header->pathBytes > mapping->Size())
+        {
+            cout << "Not a pack file: " << path << endl;
+            return false;
+        }
+
+        const PackEntry* entries = (const PackEntry*)(mapping->Data() + header->indexOffset);
+        const char* paths = (const char*)(entries + header->entryCount);
+        unordered_map<string, PackEntry> index;
+        for (unsigned int i = 0; i < header->entryCount; i++)
+        {
+            if (entries[i].pathOffset + entries[i].pathLength > header->pathBytes || entries[i].offset + entries[i].storedSize > mapping->Size())
+            {
+                cout << "Damaged pack index in " << path << endl;
+                return false;
+            }
+            index[string(paths + entries[i].pathOffset, entries[i].pathLength)] = entries[i];
+        }
+
+        // the whole pack is going to be read at startup, one sequential read ahead beats a fault per page
+        mapping->WillNeed();
+
+        lock_guard<mutex> lock(guard);
+        pack = mapping;
+        this->index.swap(index);
+        return true;
+    }
+
+    bool Mounted() const
+    {
+        return pack != nullptr;
+    }
+
+    // reads of path go to the loose file from now on, for a file that was edited after the pack was built
+    void Override(const string& path)
+    {
+        lock_guard<mutex> lock(guard);
+        overrides.insert(Normalize(path));
+    }
+
+    bool Exists(const string& path)
+    {
+        string key = Normalize(path);
+        if (findEntry(key))
+            return true;
+        error_code error;
+        return std::filesystem::is_regular_file(key, error);
+    }
+
+    // the contents of path, false when it's neither in the pack nor on disk
+    bool Read(const string& path, AssetData& asset)
+    {
+        string key = Normalize(path);
+        shared_ptr<MappedFile> mapping;
+        PackEntry entry;
+        if (findEntry(key, &entry, &mapping))
+            return readEntry(entry, mapping, asset);
+
+        // a loose file is mapped as well, still no copy of our own
+        shared_ptr<MappedFile> file(new MappedFile());
+        if (!file->Open(key.c_str()))
+            return false;
+        asset.data = file->Size() ? file->Data() : (const unsigned char*)"";
+        asset.size = file->Size();
+        asset.owner = file;
+        return true;
+    }
+
+    // hash of the contents of path, from the pack index without reading the file when it's packed
+    bool Hash(const string& path, unsigned long long& hash)
+    {
+        PackEntry entry;
+        if (findEntry(Normalize(path), &entry))
+        {
+            hash = entry.hash;
+            return true;
+        }
+
+        AssetData asset;
+        if (!Read(path, asset))
+            return false;
+        hash = HashBytes(asset.data, asset.size);
+        return true;
+    }
+
+    // the key a path has in the index: relative, forward slashes, no ./ or ../ left in it
+    static string Normalize(const string& path)
+    {
+        string normal = std::filesystem::path(path).lexically_normal().generic_string();
+        while (normal.compare(0, 2, "./") == 0)
+            normal.erase(0, 2);
+        return normal;
+    }
+
+private:
+    mutex guard;
+    shared_ptr<MappedFile> pack;
+    unordered_map<string, PackEntry> index;
+    set<string> overrides;
+
+    bool findEntry(const string& key, PackEntry* entry = nullptr, shared_ptr<MappedFile>* mapping = nullptr)
+    {
+        lock_guard<mutex> lock(guard);
+        if (!pack || overrides.count(key))
+            return false;
+        unordered_map<string, PackEntry>::const_iterator it = index.find(key);
+        if (it == index.end())
+            return false;
+        if (entry)
+            *entry = it->second;
+        if (mapping)
+            *mapping = pack;
+        return true;
+    }
+
+    bool readEntry(const PackEntry& entry, const shared_ptr<MappedFile>& mapping, AssetData& asset)
+    {
+        const unsigned char* stored = mapping->Data() + entry.offset;
+        if (entry.compression == PACK_STORED)
+        {
+            asset.data = stored;
+            asset.size = (size_t)entry.size;
+            asset.owner = mapping;
+            return true;
+        }
+
+        shared_ptr<vector<unsigned char>> buffer(new vector<unsigned char>((size_t)entry.size + 1));
+        if (entry.compression != PACK_LZ4 || !Lz4Decompress(stored, (size_t)entry.storedSize, &(*buffer)[0], (size_t)entry.size))
+        {
+            cout << "Damaged pack entry at offset " << entry.offset << endl;
+            return false;
+        }
+        asset.data = &(*buffer)[0];
+        asset.size = (size_t)entry.size;
+        asset.owner = buffer;
+        return true;
+    }
+};
+
+AssetFileSystem assets;
+
+// packs every file under the directories into one pack. an entry is kept LZ4 compressed when that saves
+// at least an eighth of it, already compressed images mostly stay as they are
+bool BuildPack(const string& packPath, const vector<string>& directories)
+{
+    vector<string> files;
+    for (unsigned int i = 0; i < directories.size(); i++)
+    {
+        error_code error;
+        for (std::filesystem::recursive_directory_iterator it(directories[i], error), end; !error && it != end; it.increment(error))
+        {
+            if (it->is_regular_file())
+                files.push_back(AssetFileSystem::Normalize(it->path().generic_string()));
+        }
+    }
+    // sorted so directories stay together, files loaded together are read together
+    sort(files.begin(), files.end());
+
+    ofstream out(packPath, ios::binary);
+    if (!out.is_open())
+    {
+        cout << "Failed to create " << packPath << endl;
+        return false;
+    }
+
+    PackHeader header;
+    memcpy(header.magic, "GPAK", 4);
+    header.version = PACK_FILE_VERSION;
+    header.entryCount = 0;
+    header.pathBytes = 0;
+    header.indexOffset = 0;
+    out.write((const char*)&header, sizeof(header));
+
+    vector<PackEntry> entries;
+    string paths;
+    unsigned long long offset = sizeof(header);
+    size_t totalSize = 0;
+    for (unsigned int i = 0; i < files.size(); i++)
+    {
+        MappedFile file;
+        if (!file.Open(files[i].c_str()))
+        {
+            cout << "Skipped unreadable " << files[i] << endl;
+            continue;
+        }
+
+        // every entry starts on a 16 byte boundary
+        static const char zeros[16] = {};
+        unsigned long long aligned = (offset + 15) & ~15ULL;
+        out.write(zeros, (streamsize)(aligned - offset));
+        offset = aligned;
+
+        PackEntry entry;
+        entry.offset = offset;
+        entry.size = file.Size();
+        entry.hash = HashBytes(file.Data(), file.Size());
+        entry.pathOffset = (unsigned int)paths.size();
+        entry.pathLength = (unsigned int)files[i].size();
+        entry.padding = 0;
+        paths += files[i];
+
+        vector<unsigned char> compressed = file.Size() ? Lz4Compress(file.Data(), file.Size()) : vector<unsigned char>();
+        if (!compressed.empty() && compressed.size() <= file.Size() - file.Size() / 8)
+        {
+            entry.compression = PACK_LZ4;
+            entry.storedSize = compressed.size();
+            out.write((const char*)&compressed[0], (streamsize)compressed.size());
+        }
+        else
+        {
+            entry.compression = PACK_STORED;
+            entry.storedSize = file.Size();
+            out.write((const char*)file.Data(), (streamsize)file.Size());
+        }
+        offset += entry.storedSize;
+        totalSize += file.Size();
+        entries.push_back(entry);
+    }
+
+    header.entryCount = (unsigned int)entries.size();
+    header.pathBytes = (unsigned int)paths.size();
+    header.indexOffset = offset;
+    if (!entries.empty())
+        out.write((const char*)&entries[0], (streamsize)(entries.size() * sizeof(PackEntry)));
+    out.write(paths.data(), (streamsize)paths.size());
+    out.seekp(0);
+    out.write((const char*)&header, sizeof(header));
+    if (!out.good())
+    {
+        cout << "Failed to write " << packPath << endl;
+        return false;
+    }
+
+    cout << "Packed " << entries.size() << " files, " << totalSize / 1024 << " KB into " << offset / 1024 << " KB: " << packPath << endl;
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------
+// lets Assimp read models, and the material files next to them, through the asset file system
+
+class AssetIOStream : public Assimp::IOStream {
+public:
+    AssetIOStream(const AssetData& asset) : asset(asset), position(0) {}
+
+    size_t Read(void* buffer, size_t size, size_t count) override
+    {
+        if (size == 0)
+            return 0;
+        size_t elements = std::min(count, (asset.size - position) / size);
+        memcpy(buffer, asset.data + position, elements * size);
+        position += elements * size;
+        return elements;
+    }
+
+    size_t Write(const void*, size_t, size_t) override
+    {
+        return 0;
+    }
+
+    aiReturn Seek(size_t offset, aiOrigin origin) override
+    {
+        size_t target = origin == aiOrigin_SET ? offset : origin == aiOrigin_CUR ? position + offset : asset.size + offset;
+        if (target > asset.size)
+            return aiReturn_FAILURE;
+        position = target;
+        return aiReturn_SUCCESS;
+    }
+
+    size_t Tell() const override
+    {
+        return position;
+    }
+
+    size_t FileSize() const override
+    {
+        return asset.size;
+    }
+
+    void Flush() override {}
+
+private:
+    AssetData asset;
+    size_t position;
+};
+
+// handed to an importer with SetIOHandler, which deletes it along with itself
+class AssetIOSystem : public Assimp::IOSystem {
+public:
+    bool Exists(const char* file) const override
+    {
+        return assets.Exists(file);
+    }
+
+    char getOsSeparator() const override
+    {
+        return '/';
+    }
+
+    Assimp::IOStream* Open(const char* file, const char* mode = "rb") override
+    {
+        // the assets are read only
+        AssetData asset;
+        if (strchr(mode, 'w') || strchr(mode, 'a') || !assets.Read(file, asset))
+            return nullptr;
+        return new AssetIOStream(asset);
+    }
+
+    void Close(Assimp::IOStream* stream) override
+    {
+        delete stream;
+    }
+};
+#endif
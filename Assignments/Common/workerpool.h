@@ -0,0 +1,134 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+// threads that are started once and split loops between them, so a parallel loop costs waking them up
+// instead of creating and joining threads every time. the calling thread works on its own loop too.
+// one loop runs on the pool at a time: a loop started while it is busy, from another thread or from inside
+// a loop that is already running, runs on the thread that started it.
+class WorkerPool {
+public:
+    WorkerPool() : started(false), stopping(false), busy(false), generation(0), active(0), work(nullptr), count(0), grain(1), chunks(0), next(0) {}
+
+    ~WorkerPool()
+    {
+        {
+            lock_guard<mutex> lock(guard);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (unsigned int i = 0; i < workers.size(); i++)
+            workers[i].join();
+    }
+
+    // calls function(begin, end) on ranges of [0, count) that are grain items long, the last one can be
+    // shorter. returns once every range is done. a loop of a single range stays on the calling thread
+    void ParallelFor(unsigned int count, unsigned int grain, const function<void(unsigned int begin, unsigned int end)>& function)
+    {
+        if (count == 0)
+            return;
+        grain = std::max(grain, 1u);
+
+        bool idle = false;
+        if (count <= grain || !busy.compare_exchange_strong(idle, true))
+        {
+            function(0, count);
+            return;
+        }
+        if (!started)
+            start();
+        if (workers.empty())
+        {
+            function(0, count);
+            busy = false;
+            return;
+        }
+
+        this->work = &function;
+        this->count = count;
+        this->grain = grain;
+        chunks = (count + grain - 1) / grain;
+        next = 0;
+        {
+            lock_guard<mutex> lock(guard);
+            active = (unsigned int)workers.size();
+            generation++;
+        }
+        wake.notify_all();
+
+        runChunks();
+        {
+            unique_lock<mutex> lock(guard);
+            done.wait(lock, [this]() { return active == 0; });
+        }
+        this->work = nullptr;
+        busy = false;
+    }
+
+private:
+    vector<thread> workers;
+    bool started, stopping;
+    // set while a loop runs on the pool
+    atomic<bool> busy;
+
+    mutex guard;
+    condition_variable wake, done;
+    // counts the loops handed to the workers, and how many workers are still on the current one
+    unsigned long long generation;
+    unsigned int active;
+
+    // the current loop, chunks are handed out in order through next
+    const function<void(unsigned int, unsigned int)>* work;
+    unsigned int count, grain, chunks;
+    atomic<unsigned int> next;
+
+    // one thread per hardware thread next to the calling one
+    void start()
+    {
+        started = true;
+        unsigned int hardwareThreads = thread::hardware_concurrency();
+        for (unsigned int i = 1; i < hardwareThreads; i++)
+            workers.push_back(thread(&WorkerPool::run, this));
+    }
+
+    void runChunks()
+    {
+        for (unsigned int chunk = next++; chunk < chunks; chunk = next++)
+        {
+            unsigned int begin = chunk * grain;
+            (*work)(begin, std::min(count, begin + grain));
+        }
+    }
+
+    void run()
+    {
+        unsigned long long seen = 0;
+        while (true)
+        {
+            {
+                unique_lock<mutex> lock(guard);
+                wake.wait(lock, [this, seen]() { return stopping || generation != seen; });
+                if (stopping)
+                    return;
+                seen = generation;
+            }
+            runChunks();
+            {
+                lock_guard<mutex> lock(guard);
+                if (--active == 0)
+                    done.notify_one();
+            }
+        }
+    }
+};
+
+WorkerPool workerPool;
+#endif
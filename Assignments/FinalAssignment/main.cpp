@@ -1,5 +1,7 @@
 #include <iostream>
 #include <fstream>
+#include <chrono>
+#include <cstring>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -8,25 +10,40 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
-#include "model.h"
+#include "../Common/glstate.h"
+#include "../Common/model.h"
+#include "../Common/asyncloader.h"
+#include "../Common/programcache.h"
+#include "../Common/shaderprogram.h"
+#include "../Common/frameuniforms.h"
+#include "../Common/shaderreload.h"
+#include "../Common/shadervariants.h"
+#include "../Common/shadercompiler.h"
+#include "../Common/renderqueue.h"
+#include "../Common/gpuprofiler.h"
+#include "../Common/vfs.h"
 
 #define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
+#include "../Common/stb_image.h"
 
 //Forward Declaration
 void processInput(GLFWwindow* window);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 int init(GLFWwindow*& window);
 void createShaders();
-void createGeometryProgram(GLuint& programID, const char* vertex, const char* fragment, const char* geometry);
-void createProgram(GLuint& programID, const char* vertex, const char* fragment);
-GLuint loadTexture(const char* path, int comp = 0);
+void setupShaders();
+bool createGeometryProgram(ShaderProgram& program, const char* vertex, const char* fragment, const char* geometry);
+bool createProgram(ShaderProgram& program, const char* vertex, const char* fragment, const std::string& defines = "");
+GLuint loadTexture(const char* path, int comp = 0, TextureUsage usage = TEXTURE_COLOR, MemoryCategory category = MEMORY_OTHER);
 GLuint loadSkyboxTexture();
-void loadFile(const char* filename, char*& output);
+void setupRenderPasses();
 void renderModel(Model* model, glm::vec3 pos, glm::vec3 rot, glm::vec3 scale);
 void renderModelNormals(Model* model, GLuint spikeTex);
+void reportGpuTimes();
 
-GLuint simpleProgram, modelProgram;
+ShaderProgram simpleProgram;
+//The model shader is built per set of material maps, a mesh uses the variant that samples only the maps it has
+ShaderVariants modelVariants;
 
 const int WIDTH = 1280, HEIGHT = 720;
 
@@ -45,26 +62,56 @@ bool firstMouse = true;
 glm::vec3 lightPosition = glm::normalize(glm::vec3(-0.5f, -0.5f, -0.5f));
 
 glm::mat4 view;
-glm::mat4 projection = glm::perspective(glm::radians(45.0f), WIDTH / (float)HEIGHT, 0.1f, 5000.0f);
+#define FAR_PLANE 5000.0f
+glm::mat4 projection = glm::perspective(glm::radians(45.0f), WIDTH / (float)HEIGHT, 0.1f, FAR_PLANE);
 
 float triangleSize = 5000;
 
 Model* backpack;
+TextureStreamer textureStreamer;
+AsyncModelLoader modelLoader(2, &textureStreamer);
+
+//Shaders are rebuilt when their files change
+FileWatcher fileWatcher;
+ShaderReloader shaderReloader(fileWatcher);
+
+//Uniforms set through the reflected tables of the programs, toggled with U to compare against a lookup per uniform
+double renderCpuTime = 0.0;
+unsigned int renderCpuFrames = 0;
+
+//The draws of a frame, sorted by their keys before they are issued. toggled with O to compare against submission order
+RenderQueue renderQueue;
+bool sortRenderQueue = true;
+
+int main(int argc, char** argv) {
+    // FinalAssignment.exe --build-pack puts every shader, texture and model into one pack file and exits
+    if (argc > 1 && strcmp(argv[1], "--build-pack") == 0)
+        return BuildPack(ASSET_PACK_PATH, { "shaders", "textures", "models" }) ? 0 : 1;
+
+    // with a pack next to the program the assets are read from it, loose files are only the fallback
+    if (assets.Mount(ASSET_PACK_PATH))
+        std::cout << "Reading assets from " << ASSET_PACK_PATH << std::endl;
 
-int main() {
     GLFWwindow* window;
     int res = init(window);
     if (res != 0) return res;
 
+    InitTextureCompression();
+    programCache.Init();
+    shaderCompiler.Init();
+
+    // the programs compile while the texture and model load
     createShaders();
-    GLuint spikeTex = loadTexture("textures/Spike.png");
+    GLuint spikeTex = loadTexture("textures/Spike.png", 0, TEXTURE_COLOR, MEMORY_MODELS);
+
 
+    // imported on a worker thread, a placeholder box is drawn until it is uploaded
+    backpack = modelLoader.Load("models/backpack/backpack.obj", true);
 
-    stbi_set_flip_vertically_on_load(true);
-    backpack = new Model("models/backpack/backpack.obj");
-    stbi_set_flip_vertically_on_load(false);
+    setupShaders();
 
     glViewport(0, 0, WIDTH, HEIGHT);
+    setupRenderPasses();
 
     glfwSetCursorPosCallback(window, mouse_callback);
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
@@ -72,25 +119,63 @@ int main() {
     while (!glfwWindowShouldClose(window)) {
         processInput(window);
 
-        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+        fileWatcher.Poll();
+        modelLoader.Update();
+        textureStreamer.Update();
 
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-        glEnable(GL_DEPTH_TEST);
-        glDepthFunc(GL_LESS);
+        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
         view = glm::lookAt(cameraPosition, cameraPosition + cameraFront, cameraUp);
+        // the camera and light go to every program at once, the draws only set their own uniforms
+        frameUniforms.Update(view, projection, cameraPosition, lightPosition);
         glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+        auto renderStart = std::chrono::high_resolution_clock::now();
+
+        // the GPU time of the frame, read back a few frames from now
+        gpuProfiler.BeginFrame();
+
+        // the render functions only queue their draws, the queue decides the order
+        renderQueue.Begin(FAR_PLANE);
+
         renderModel(backpack, glm::vec3(0, 0, 0), glm::vec3(0, 0, 0), glm::vec3(1, 1, 1));
         renderModelNormals(backpack, spikeTex);
 
+        renderQueue.Flush(sortRenderQueue);
+        gpuProfiler.EndFrame();
+
+        renderCpuTime += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - renderStart).count();
+        renderCpuFrames++;
+
         glfwSwapBuffers(window);
         glfwPollEvents();
+
+        // every few seconds, the CPU time spent issuing the frame and what the uniform tables and the state cache saved
+        if (renderCpuFrames == 600) {
+            std::cout << "Render CPU time: " << renderCpuTime / renderCpuFrames << " ms/frame with uniform cache " << (useUniformCache ? "on" : "off") << ", "
+                      << uniformUploads / renderCpuFrames << " uniform uploads and " << uniformUploadsSkipped / renderCpuFrames << " skipped per frame, "
+                      << glState.issued / renderCpuFrames << " state changes and " << glState.skipped / renderCpuFrames << " redundant ones skipped per frame with "
+                      << renderQueue.drawn << " draws " << (sortRenderQueue ? "sorted" : "in submission order") << std::endl;
+            renderCpuTime = 0.0;
+            renderCpuFrames = 0;
+            uniformUploads = uniformUploadsSkipped = 0;
+            glState.ResetCounters();
+
+            reportGpuTimes();
+        }
     }
 
+    if (backpack->ready)
+        backpack->Release(&textureStreamer);
+    textureStreamer.Release(spikeTex);
+    modelLoader.Release();
+    frameUniforms.Release();
+    modelVariants.Release();
+    gpuProfiler.Release();
+    if (gpuMemory.TotalUsed() > 0)
+        std::cout << "GPU memory still in use at exit: " << gpuMemory.TotalUsed() / 1024 << " KB" << std::endl;
+
     glfwTerminate();
     return 0;
 }
@@ -117,6 +202,44 @@ void processInput(GLFWwindow* window) {
     if (glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS)
         cameraPosition -= moveSpeed * cameraUp;
 
+    //toggle the uniform tables with U, the numbers start over so the report only covers one mode
+    static bool uniformKeyDown = false;
+    bool uniformKey = glfwGetKey(window, GLFW_KEY_U) == GLFW_PRESS;
+    if (uniformKey && !uniformKeyDown) {
+        useUniformCache = !useUniformCache;
+        renderCpuTime = 0.0;
+        renderCpuFrames = 0;
+        uniformUploads = uniformUploadsSkipped = 0;
+    }
+    uniformKeyDown = uniformKey;
+
+    //toggle sorting the render queue with O, the state changes of both orders show in the report
+    static bool sortKeyDown = false;
+    bool sortKey = glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS;
+    if (sortKey && !sortKeyDown) {
+        sortRenderQueue = !sortRenderQueue;
+        renderCpuTime = 0.0;
+        renderCpuFrames = 0;
+        uniformUploads = uniformUploadsSkipped = 0;
+        glState.ResetCounters();
+    }
+    sortKeyDown = sortKey;
+
+    //start and stop writing the GPU times of every frame to gpu_times.csv with G
+    static bool gpuCsvKeyDown = false;
+    bool gpuCsvKey = glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS;
+    if (gpuCsvKey && !gpuCsvKeyDown) {
+        if (gpuProfiler.WritingCsv()) {
+            gpuProfiler.StopCsv();
+            std::cout << "Stopped writing gpu_times.csv" << std::endl;
+        }
+        else if (gpuProfiler.StartCsv("gpu_times.csv"))
+            std::cout << "Writing GPU times to gpu_times.csv" << std::endl;
+        else
+            std::cout << "Can't write gpu_times.csv" << std::endl;
+    }
+    gpuCsvKeyDown = gpuCsvKey;
+
     //escape to exut window
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) {
         glfwSetWindowShouldClose(window, true);
@@ -183,200 +306,132 @@ int init(GLFWwindow*& window) {
     return 0;
 }
 
+// submits every program to the driver, setupShaders waits for them
 void createShaders() {
-    createProgram(modelProgram, "shaders/modelVertex.shader", "shaders/modelFragment.shader");
-
-    glUseProgram(modelProgram);
-
-    glUniform1i(glGetUniformLocation(modelProgram, "texture_diffuse1"), 0);
-    glUniform1i(glGetUniformLocation(modelProgram, "texture_specular1"), 1);
-    glUniform1i(glGetUniformLocation(modelProgram, "texture_normal1"), 2);
-    glUniform1i(glGetUniformLocation(modelProgram, "texture_roughness1"), 3);
-    glUniform1i(glGetUniformLocation(modelProgram, "texture_ao1"), 4);
+    // the bits are the MATERIAL_HAS_ flags of the meshes, a variant compiles the first time a mesh needs it
+    modelVariants.Init({ "HAS_SPECULAR", "HAS_ROUGHNESS", "HAS_AO" },
+        [](ShaderProgram& program, const std::string& defines) {
+            return createProgram(program, "shaders/modelVertex.shader", "shaders/modelFragment.shader", defines) && shaderCompiler.Finish(&program);
+        },
+        [](ShaderProgram& program) {
+            program.SetInt("texture_diffuse1", 0);
+            program.SetInt("texture_specular1", 1);
+            program.SetInt("texture_normal1", 2);
+            program.SetInt("texture_roughness1", 3);
+            program.SetInt("texture_ao1", 4);
+        });
 
     createGeometryProgram(simpleProgram, "shaders/normalVisualVertex.shader", "shaders/normalVisualFragment.shader", "shaders/normalVisualGeometry.shader");
-
-    glUseProgram(simpleProgram);
-
-    glUniform1i(glGetUniformLocation(simpleProgram, "spikeTex"), 5);
 }
 
-void createGeometryProgram(GLuint& programID, const char* vertex, const char* fragment, const char* geometry) {
-    // Create a GL Program with a vertex & fragment shader
-    char* vertexSrc;
-    char* fragmentSrc;
-    char* geometrySrc;
-
-    loadFile(vertex, vertexSrc);
-    loadFile(fragment, fragmentSrc);
-    loadFile(geometry, geometrySrc);
+// waits for the programs createShaders submitted and sets what they need once
+void setupShaders() {
+    shaderCompiler.Finish();
 
-    GLuint vertexShaderID, fragmentShaderID, geometryShaderID;
+    glState.UseProgram(simpleProgram.id);
 
-    vertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShaderID, 1, &vertexSrc, nullptr);
-    glCompileShader(vertexShaderID);
-
-    int success;
-    char infoLog[512];
-    glGetShaderiv(vertexShaderID, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        glGetShaderInfoLog(vertexShaderID, 512, nullptr, infoLog);
-        std::cout << "ERROR COMPILING VERTEX SHADER\n" << infoLog << std::endl;
-    }
-
-    fragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShaderID, 1, &fragmentSrc, nullptr);
-    glCompileShader(fragmentShaderID);
+    simpleProgram.SetInt("spikeTex", 5);
+}
 
-    glGetShaderiv(fragmentShaderID, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        glGetShaderInfoLog(fragmentShaderID, 512, nullptr, infoLog);
-        std::cout << "ERROR COMPILING FRAGMENT SHADER\n" << infoLog << std::endl;
+bool createGeometryProgram(ShaderProgram& program, const char* vertex, const char* fragment, const char* geometry) {
+    // Create a GL Program with a vertex, fragment & geometry shader, it only replaces the program once it linked.
+    // a program that isn't in the cache is only submitted, false means the sources couldn't be read
+    std::string vertexSrc, fragmentSrc, geometrySrc;
+    std::vector<std::string> files;
+    bool loaded = LoadShaderSource(vertex, vertexSrc, files) && LoadShaderSource(fragment, fragmentSrc, files) && LoadShaderSource(geometry, geometrySrc, files);
+
+    // saving any of the files, or one they include, builds the program again
+    shaderReloader.Track(&program, files, [&program, vertex, fragment, geometry]() {
+        return createGeometryProgram(program, vertex, fragment, geometry) && shaderCompiler.Finish(&program);
+    });
+    if (!loaded)
+        return false;
+
+    // a program linked from the same sources on this driver before is restored from its binary
+    unsigned long long key = programCache.Key({ vertexSrc, fragmentSrc, geometrySrc });
+    GLuint programID = programCache.Load(key);
+    if (programID != 0) {
+        frameUniforms.BindProgram(programID);
+        // the uniforms are read back once, drawing sets them through the table
+        program.Adopt(programID);
+        return true;
     }
 
-    geometryShaderID = glCreateShader(GL_GEOMETRY_SHADER);
-    glShaderSource(geometryShaderID, 1, &geometrySrc, nullptr);
-    glCompileShader(geometryShaderID);
-
-    glGetShaderiv(geometryShaderID, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        glGetShaderInfoLog(geometryShaderID, 512, nullptr, infoLog);
-        std::cout << "ERROR COMPILING GEOMETRY SHADER\n" << infoLog << std::endl;
-    }
+    // nothing waits for the compile here, the program is put to use once shaderCompiler.Finish gets to it
+    GLuint vertexShaderID = shaderCompiler.Compile(GL_VERTEX_SHADER, vertexSrc);
+    GLuint fragmentShaderID = shaderCompiler.Compile(GL_FRAGMENT_SHADER, fragmentSrc);
+    GLuint geometryShaderID = shaderCompiler.Compile(GL_GEOMETRY_SHADER, geometrySrc);
 
     programID = glCreateProgram();
     glAttachShader(programID, vertexShaderID);
     glAttachShader(programID, fragmentShaderID);
     glAttachShader(programID, geometryShaderID);
+    programCache.PrepareLink(programID);
     glLinkProgram(programID);
 
-    glGetProgramiv(programID, GL_LINK_STATUS, &success);
-    if (!success) {
-        glGetProgramInfoLog(programID, 512, nullptr, infoLog);
-        std::cout << "ERROR LINKING PROGRAM\n" << infoLog << std::endl;
-    }
-
-    glDeleteShader(vertexShaderID);
-    glDeleteShader(fragmentShaderID);
-    glDeleteShader(geometryShaderID);
-
-    delete vertexSrc;
-    delete fragmentSrc;
-    delete geometrySrc;
-
+    shaderCompiler.Submit(&program, programID, { vertexShaderID, fragmentShaderID, geometryShaderID }, { vertex, fragment, geometry }, [&program, key](GLuint programID) {
+        programCache.Store(key, programID);
+        frameUniforms.BindProgram(programID);
+        program.Adopt(programID);
+    });
+    return true;
 }
 
-void createProgram(GLuint& programID, const char* vertex, const char* fragment) {
-    // Create a GL Program with a vertex & fragment shader
-    char* vertexSrc;
-    char* fragmentSrc;
-
-    loadFile(vertex, vertexSrc);
-    loadFile(fragment, fragmentSrc);
-
-    GLuint vertexShaderID, fragmentShaderID;
-
-    vertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShaderID, 1, &vertexSrc, nullptr);
-    glCompileShader(vertexShaderID);
-
-    int success;
-    char infoLog[512];
-    glGetShaderiv(vertexShaderID, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        glGetShaderInfoLog(vertexShaderID, 512, nullptr, infoLog);
-        std::cout << "ERROR COMPILING VERTEX SHADER\n" << infoLog << std::endl;
+bool createProgram(ShaderProgram& program, const char* vertex, const char* fragment, const std::string& defines) {
+    // Create a GL Program with a vertex & fragment shader, it only replaces the program once it linked.
+    // defines are #define lines both shaders get, to build a variant of them. a program that isn't in the
+    // cache is only submitted, false means the sources couldn't be read
+    std::string vertexSrc, fragmentSrc;
+    std::vector<std::string> files;
+    bool loaded = LoadShaderSource(vertex, vertexSrc, files, defines) && LoadShaderSource(fragment, fragmentSrc, files, defines);
+
+    // saving any of the files, or one they include, builds the program again
+    shaderReloader.Track(&program, files, [&program, vertex, fragment, defines]() {
+        return createProgram(program, vertex, fragment, defines) && shaderCompiler.Finish(&program);
+    });
+    if (!loaded)
+        return false;
+
+    // a program linked from the same sources on this driver before is restored from its binary
+    unsigned long long key = programCache.Key({ vertexSrc, fragmentSrc }, defines);
+    GLuint programID = programCache.Load(key);
+    if (programID != 0) {
+        frameUniforms.BindProgram(programID);
+        // the uniforms are read back once, drawing sets them through the table
+        program.Adopt(programID);
+        return true;
     }
 
-    fragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShaderID, 1, &fragmentSrc, nullptr);
-    glCompileShader(fragmentShaderID);
-
-    glGetShaderiv(fragmentShaderID, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        glGetShaderInfoLog(fragmentShaderID, 512, nullptr, infoLog);
-        std::cout << "ERROR COMPILING FRAGMENT SHADER\n" << infoLog << std::endl;
-    }
+    // nothing waits for the compile here, the program is put to use once shaderCompiler.Finish gets to it
+    GLuint vertexShaderID = shaderCompiler.Compile(GL_VERTEX_SHADER, vertexSrc);
+    GLuint fragmentShaderID = shaderCompiler.Compile(GL_FRAGMENT_SHADER, fragmentSrc);
 
     programID = glCreateProgram();
     glAttachShader(programID, vertexShaderID);
     glAttachShader(programID, fragmentShaderID);
+    programCache.PrepareLink(programID);
     glLinkProgram(programID);
 
-    glGetProgramiv(programID, GL_LINK_STATUS, &success);
-    if (!success) {
-        glGetProgramInfoLog(programID, 512, nullptr, infoLog);
-        std::cout << "ERROR LINKING PROGRAM\n" << infoLog << std::endl;
-    }
-
-    glDeleteShader(vertexShaderID);
-    glDeleteShader(fragmentShaderID);
-
-    delete vertexSrc;
-    delete fragmentSrc;
-
-}
-
-void loadFile(const char* filename, char*& output) {
-    std::ifstream file(filename, std::ios::binary);
-
-    if (file.is_open()) {
-        file.seekg(0, file.end);
-        int length = file.tellg();
-        file.seekg(0, file.beg);
-
-        output = new char[length + 1];
-
-        file.read(output, length);
-
-        output[length] = '\0';
-
-        file.close();
-    }
-    else {
-        output = NULL;
-    }
+    shaderCompiler.Submit(&program, programID, { vertexShaderID, fragmentShaderID }, { vertex, fragment }, [&program, key](GLuint programID) {
+        programCache.Store(key, programID);
+        frameUniforms.BindProgram(programID);
+        program.Adopt(programID);
+    });
+    return true;
 }
 
-GLuint loadTexture(const char* path, int comp)
+GLuint loadTexture(const char* path, int comp, TextureUsage usage, MemoryCategory category)
 {
-    GLuint textureID;
-    glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_2D, textureID);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    int width, height, numChannels;
-    unsigned char* data = stbi_load(path, &width, &height, &numChannels, comp);
-    if (data) {
-        if (comp != 0) numChannels = comp;
-
-        if (numChannels == 3)
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-        else if (numChannels == 4)
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-
-
-        glGenerateMipmap(GL_TEXTURE_2D);
-    }
-    else {
-        std::cout << "Error loading texture: " << path << std::endl;
-    }
-
-    stbi_image_free(data);
-
-    glBindTexture(GL_TEXTURE_2D, 0);
-
-    return textureID;
+    // the texture can be used right away, its mip levels are streamed in smallest first over the next frames
+    return textureStreamer.Load(path, comp, usage, category);
 }
 
 GLuint loadSkyboxTexture() {
     // Load and configure skybox cubemap
     GLuint skyboxTexture;
     glGenTextures(1, &skyboxTexture);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTexture);
+    glState.BindTexture(GL_TEXTURE_CUBE_MAP, skyboxTexture);
+    gpuMemory.Track(GPU_TEXTURE, skyboxTexture, MEMORY_SKYBOX, "skybox");
 
     const char* skyboxFaces[] = {
         "textures/skybox/right.jpg",
@@ -387,16 +442,14 @@ GLuint loadSkyboxTexture() {
         "textures/skybox/back.jpg"
     };
 
-    int width, height, numChannels;
     for (GLuint i = 0; i < 6; ++i) {
-        unsigned char* data = stbi_load(skyboxFaces[i], &width, &height, &numChannels, 0);
-        if (data) {
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-            stbi_image_free(data);
+        // the sky is sampled without mipmaps, only the base level is kept
+        TextureData face = LoadTextureData(skyboxFaces[i], 0, TEXTURE_COLOR, false);
+        if (!face.Empty()) {
+            UploadTextureData(skyboxTexture, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, face);
         }
         else {
             std::cout << "Failed to load skybox texture: " << skyboxFaces[i] << std::endl;
-            stbi_image_free(data);
         }
     }
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -408,39 +461,81 @@ GLuint loadSkyboxTexture() {
     return skyboxTexture;
 }
 
+// the state every pass of the render queue starts from, the spikes blend over the model
+void setupRenderPasses() {
+    renderQueue.SetPass(PASS_OPAQUE, []() {
+        glState.Disable(GL_BLEND);
+        glState.Enable(GL_DEPTH_TEST);
+        glState.DepthFunc(GL_LESS);
+        glState.Enable(GL_CULL_FACE);
+        glState.CullFace(GL_BACK);
+    });
+    renderQueue.SetPass(PASS_TRANSPARENT, []() {
+        glState.Enable(GL_BLEND);
+        glState.BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glState.Enable(GL_DEPTH_TEST);
+        glState.DepthFunc(GL_LESS);
+        glState.Enable(GL_CULL_FACE);
+        glState.CullFace(GL_BACK);
+    });
+}
+
 void renderModel(Model* model, glm::vec3 pos, glm::vec3 rot, glm::vec3 scale)
 {
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_BACK);
-
-    glUseProgram(modelProgram);
-
     glm::mat4 world = glm::mat4(1.0f);
     world = glm::translate(world, pos);
     world = glm::scale(world, scale);
 
-    glUniformMatrix4fv(glGetUniformLocation(modelProgram, "world"), 1, GL_FALSE, glm::value_ptr(world));
-    glUniformMatrix4fv(glGetUniformLocation(modelProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(glGetUniformLocation(modelProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-
-    glUniform3fv(glGetUniformLocation(modelProgram, "lightDirection"), 1, glm::value_ptr(lightPosition));
-    glUniform3fv(glGetUniformLocation(modelProgram, "cameraPosition"), 1, glm::value_ptr(cameraPosition));
+    if (!model->ready) {
+        // still loading, draw a box where the model is going to be. it has no textures at all
+        ShaderProgram* program = &modelVariants.Get(0);
+        glm::mat4 proxyWorld = world * modelLoader.ProxyTransform(model);
+        renderQueue.Submit(PASS_OPAQUE, program->id, 0, 0, glm::length(pos - cameraPosition), [program, proxyWorld]() {
+            program->SetMat4("world", proxyWorld);
+            modelLoader.DrawProxy();
+        }, "model");
+        return;
+    }
 
-    model->Draw(modelProgram);
+    // skip the meshes that are off screen, the frustum is built in the model's object space.
+    // every mesh gets the variant that samples only the maps its material has
+    auto lookup = [](unsigned int features) {
+        return modelVariants.Get(features).id;
+    };
+    auto select = [world](unsigned int features) {
+        ShaderProgram& variant = modelVariants.Get(features);
+        variant.SetMat4("world", world);
+        return variant.id;
+    };
+    model->SubmitVariants(renderQueue, PASS_OPAQUE, lookup, select, world, cameraPosition, Frustum(projection * view * world));
 } 
 
 void renderModelNormals(Model* model, GLuint spikeTex) {
-    glUseProgram(simpleProgram);
+    if (!model->ready)
+        return;
 
+    // every mesh grows its spikes with the same program, they are queued per mesh to blend back to front
     glm::mat4 world = glm::mat4(1.0f);
-    glUniformMatrix4fv(glGetUniformLocation(simpleProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-    glUniformMatrix4fv(glGetUniformLocation(simpleProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(glGetUniformLocation(simpleProgram, "model"), 1, GL_FALSE, glm::value_ptr(world));
+    auto lookup = [](unsigned int features) {
+        return simpleProgram.id;
+    };
+    auto select = [world, spikeTex](unsigned int features) {
+        simpleProgram.SetMat4("model", world);
 
-    glUniform1f(glGetUniformLocation(simpleProgram, "trianglesize"), triangleSize);
+        simpleProgram.SetFloat("trianglesize", triangleSize);
 
-    glActiveTexture(GL_TEXTURE5);
-    glBindTexture(GL_TEXTURE_2D, spikeTex);
+        glState.BindTexture(5, GL_TEXTURE_2D, spikeTex);
+        return simpleProgram.id;
+    };
+    model->SubmitVariants(renderQueue, PASS_TRANSPARENT, lookup, select, world, cameraPosition, Frustum(projection * view * world), nullptr, glm::vec3(0.0f), "normals");
+}
 
-    model->Draw(simpleProgram);
+// prints the GPU time of the frame and of every scope in it, averaged and the 95th percentile
+void reportGpuTimes() {
+    std::vector<std::string> names = gpuProfiler.Names();
+    if (names.empty())
+        return;
+    std::cout << "GPU time (average / 95th percentile), " << gpuProfiler.dropped << " frames dropped:" << std::endl;
+    for (unsigned int i = 0; i < names.size(); i++)
+        std::cout << "  " << names[i] << ": " << gpuProfiler.Average(names[i]) << " / " << gpuProfiler.Percentile(names[i], 95.0) << " ms" << std::endl;
 }
\ No newline at end of file
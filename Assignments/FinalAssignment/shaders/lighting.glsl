@@ -0,0 +1,19 @@
+// lighting of the model shaders: a directional light with a specular highlight whose sharpness follows
+// the roughness texture. needs the frame uniforms included before it
+
+float lerp(float a, float b, float t) {
+    return a + (b - a) * t;
+}
+
+vec4 shadeModel(vec4 diffuse, vec3 specularColor, float roughness, float ambientOcclusion, vec3 normal, vec3 position)
+{
+    float light = max(dot(-lightDirection, normal), 0.0);
+
+    vec3 viewDir = normalize(cameraPosition - position);
+    vec3 refl = reflect(lightDirection, normal);
+
+    float spec = pow(max(dot(viewDir, refl), 0.0), lerp(1, 128, roughness));
+    vec3 specular = spec * specularColor;
+
+    return diffuse * max(light * ambientOcclusion, 0.2 * ambientOcclusion) + vec4(specular, 0);
+}
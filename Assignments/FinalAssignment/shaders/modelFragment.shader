@@ -11,28 +11,29 @@ uniform sampler2D texture_normal1;
 uniform sampler2D texture_roughness1;
 uniform sampler2D texture_ao1;
 
-uniform vec3 cameraPosition;
-uniform vec3 lightDirection;
-
-float lerp(float a, float b, float t) {
-    return a + (b - a) * t;
-}
+#include "frame.glsl"
+#include "lighting.glsl"
 
 void main()
 {
     vec4 diffuse = texture(texture_diffuse1, TexCoords);
-    vec4 specTex = texture(texture_specular1, TexCoords);
-
-    float light = max(dot(-lightDirection, Normals), 0.0);
-
-    vec3 viewDir = normalize(cameraPosition - FragPos.rgb);
-    vec3 refl = reflect(lightDirection, Normals);
 
+    // a map the material doesn't have isn't sampled, its variant uses the value of an untextured surface
+#ifdef HAS_SPECULAR
+    vec4 specTex = texture(texture_specular1, TexCoords);
+#else
+    vec4 specTex = vec4(0.0);
+#endif
+#ifdef HAS_AO
     float ambientOcclusion = texture(texture_ao1, TexCoords).r;
-    
+#else
+    float ambientOcclusion = 1.0;
+#endif
+#ifdef HAS_ROUGHNESS
     float roughness = texture(texture_roughness1, TexCoords).r;
-    float spec = pow(max(dot(viewDir, refl), 0.0), lerp(1, 128, roughness));
-    vec3 specular = spec * specTex.rgb;
-    
-    FragColor = diffuse * max(light * ambientOcclusion, 0.2 * ambientOcclusion) + vec4(specular, 0);
+#else
+    float roughness = 0.5;
+#endif
+
+    FragColor = shadeModel(diffuse, specTex.rgb, roughness, ambientOcclusion, Normals, FragPos.rgb);
 }
\ No newline at end of file
@@ -8,8 +8,7 @@ out vec3 Normals;
 out vec4 FragPos;
 
 uniform mat4 world;
-uniform mat4 view;
-uniform mat4 projection;
+#include "frame.glsl"
 
 void main()
 {
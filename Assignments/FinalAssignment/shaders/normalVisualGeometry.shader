@@ -10,7 +10,7 @@ out vec2 texCoord;
 
 const float MAGNITUDE = 0.1;
 
-uniform mat4 projection;
+#include "frame.glsl"
 
 void GenerateOutwardTriangles(int index)
 {
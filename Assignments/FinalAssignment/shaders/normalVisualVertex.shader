@@ -6,9 +6,10 @@ out VS_OUT {
     vec3 normal;
 } vs_out;
 
-uniform mat4 view;
 uniform mat4 model;
 
+#include "frame.glsl"
+
 void main()
 {
     mat3 normalMatrix = mat3(transpose(inverse(view * model)));
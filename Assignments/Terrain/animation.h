@@ -0,0 +1,368 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+
+#include "../Common/model.h"
+#include "../Common/workerpool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+using namespace std;
+
+// SSE2 is always there on x64, the scalar path is only for other targets
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ANIMATION_SSE
+#include <emmintrin.h>
+#endif
+
+// uniform buffer binding point of the BonePalette block in the skinning shader
+#define BONE_PALETTE_BINDING 1
+
+#ifdef ANIMATION_SSE
+// the dot product of two 4 float vectors, in every lane
+inline __m128 dot4(__m128 a, __m128 b)
+{
+    __m128 products = _mm_mul_ps(a, b);
+    __m128 sums = _mm_add_ps(products, _mm_shuffle_ps(products, products, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_add_ps(sums, _mm_shuffle_ps(sums, sums, _MM_SHUFFLE(1, 0, 3, 2)));
+}
+#endif
+
+// out = a * b, a column at a time. a is loaded up front and a column of b is read before the same
+// column of out is written, so out can be either of them
+inline void multiplyPose(const glm::mat4& a, const glm::mat4& b, glm::mat4& out)
+{
+#ifdef ANIMATION_SSE
+    const float* left = &a[0][0];
+    const float* right = &b[0][0];
+    __m128 a0 = _mm_loadu_ps(left), a1 = _mm_loadu_ps(left + 4), a2 = _mm_loadu_ps(left + 8), a3 = _mm_loadu_ps(left + 12);
+    float* result = &out[0][0];
+    for (int c = 0; c < 4; c++)
+    {
+        const float* column = right + c * 4;
+        __m128 sum = _mm_mul_ps(a0, _mm_set1_ps(column[0]));
+        sum = _mm_add_ps(sum, _mm_mul_ps(a1, _mm_set1_ps(column[1])));
+        sum = _mm_add_ps(sum, _mm_mul_ps(a2, _mm_set1_ps(column[2])));
+        sum = _mm_add_ps(sum, _mm_mul_ps(a3, _mm_set1_ps(column[3])));
+        _mm_storeu_ps(result + c * 4, sum);
+    }
+#else
+    out = a * b;
+#endif
+}
+
+// out = a + (b - a) * t on all four components
+inline void lerpKey(const glm::vec4& a, const glm::vec4& b, float t, glm::vec4& out)
+{
+#ifdef ANIMATION_SSE
+    __m128 from = _mm_loadu_ps(&a.x);
+    __m128 result = _mm_add_ps(from, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&b.x), from), _mm_set1_ps(t)));
+    _mm_storeu_ps(&out.x, result);
+#else
+    out = glm::mix(a, b, t);
+#endif
+}
+
+// normalized spherical interpolation between two rotations, the short way around
+inline glm::quat slerpKey(const glm::quat& a, const glm::quat& b, float t)
+{
+#ifdef ANIMATION_SSE
+    // the components are only dotted, scaled and added, so their order in glm::quat doesn't matter
+    __m128 from = _mm_loadu_ps((const float*)&a);
+    __m128 to = _mm_loadu_ps((const float*)&b);
+    float cosine = _mm_cvtss_f32(dot4(from, to));
+    if (cosine < 0.0f)
+    {
+        to = _mm_sub_ps(_mm_setzero_ps(), to);
+        cosine = -cosine;
+    }
+
+    // keys this close are lerped, the sine of the angle is too small to divide by
+    float fromWeight = 1.0f - t, toWeight = t;
+    if (cosine < 0.9995f)
+    {
+        float angle = acos(cosine);
+        float inverseSine = 1.0f / sin(angle);
+        fromWeight = sin((1.0f - t) * angle) * inverseSine;
+        toWeight = sin(t * angle) * inverseSine;
+    }
+    __m128 result = _mm_add_ps(_mm_mul_ps(from, _mm_set1_ps(fromWeight)), _mm_mul_ps(to, _mm_set1_ps(toWeight)));
+    result = _mm_div_ps(result, _mm_sqrt_ps(dot4(result, result)));
+
+    glm::quat rotation;
+    _mm_storeu_ps((float*)&rotation, result);
+    return rotation;
+#else
+    return glm::normalize(glm::slerp(a, b, t));
+#endif
+}
+
+// the keyframes of one animated node. every channel keeps its times and values in separate arrays
+// so the key search only walks the tightly packed times. positions and scales are padded to 4 floats
+// so a key is one SSE load.
+class BoneTrack {
+public:
+    vector<float>     positionTimes;
+    vector<glm::vec4> positions;
+    vector<float>     rotationTimes;
+    vector<glm::quat> rotations;
+    vector<float>     scaleTimes;
+    vector<glm::vec4> scales;
+
+    BoneTrack(const aiNodeAnim* channel)
+    {
+        for (unsigned int i = 0; i < channel->mNumPositionKeys; i++)
+        {
+            const aiVector3D& value = channel->mPositionKeys[i].mValue;
+            positionTimes.push_back((float)channel->mPositionKeys[i].mTime);
+            positions.push_back(glm::vec4(value.x, value.y, value.z, 0.0f));
+        }
+        for (unsigned int i = 0; i < channel->mNumRotationKeys; i++)
+        {
+            const aiQuaternion& value = channel->mRotationKeys[i].mValue;
+            rotationTimes.push_back((float)channel->mRotationKeys[i].mTime);
+            rotations.push_back(glm::quat(value.w, value.x, value.y, value.z));
+        }
+        for (unsigned int i = 0; i < channel->mNumScalingKeys; i++)
+        {
+            const aiVector3D& value = channel->mScalingKeys[i].mValue;
+            scaleTimes.push_back((float)channel->mScalingKeys[i].mTime);
+            scales.push_back(glm::vec4(value.x, value.y, value.z, 0.0f));
+        }
+    }
+
+    // local transform at the given time (in ticks). translation, rotation and scale are written
+    // straight into the matrix instead of multiplying three matrices together.
+    glm::mat4 Sample(float time) const
+    {
+        float t;
+        unsigned int key;
+
+        glm::vec4 position(0.0f);
+        if (!positions.empty())
+        {
+            key = findKey(positionTimes, time, t);
+            lerpKey(positions[key], positions[std::min(key + 1, (unsigned int)positions.size() - 1)], t, position);
+        }
+
+        glm::quat rotation(1.0f, 0.0f, 0.0f, 0.0f);
+        if (!rotations.empty())
+        {
+            key = findKey(rotationTimes, time, t);
+            rotation = slerpKey(rotations[key], rotations[std::min(key + 1, (unsigned int)rotations.size() - 1)], t);
+        }
+
+        glm::vec4 scale(1.0f);
+        if (!scales.empty())
+        {
+            key = findKey(scaleTimes, time, t);
+            lerpKey(scales[key], scales[std::min(key + 1, (unsigned int)scales.size() - 1)], t, scale);
+        }
+
+        glm::mat4 transform = glm::mat4_cast(rotation);
+        transform[0] *= scale.x;
+        transform[1] *= scale.y;
+        transform[2] *= scale.z;
+        transform[3] = glm::vec4(position.x, position.y, position.z, 1.0f);
+        return transform;
+    }
+
+private:
+    // returns the key at or before time and the blend factor towards the next key
+    static unsigned int findKey(const vector<float>& times, float time, float& t)
+    {
+        t = 0.0f;
+        if (times.size() < 2 || time <= times[0])
+            return 0;
+
+        unsigned int next = (unsigned int)(std::upper_bound(times.begin(), times.end(), time) - times.begin());
+        if (next >= times.size())
+            return (unsigned int)times.size() - 1;
+
+        unsigned int key = next - 1;
+        t = (time - times[key]) / (times[next] - times[key]);
+        return key;
+    }
+};
+
+// an animation clip for a skinned model. the node hierarchy is flattened into an array in which every
+// parent comes before its children, so a whole pose is evaluated in one linear pass without recursion.
+class Animation {
+public:
+    float duration;
+    float ticksPerSecond;
+
+    // loads the first animation in the file, the model has to be loaded from the same file first
+    Animation(const string& path, Model* model) : duration(0.0f), ticksPerSecond(25.0f)
+    {
+        Assimp::Importer importer;
+        importer.SetIOHandler(new AssetIOSystem());
+        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate);
+        if (!scene || !scene->mRootNode || scene->mNumAnimations == 0)
+        {
+            cout << "ERROR::ANIMATION:: no animation in " << path << endl;
+            return;
+        }
+
+        aiAnimation* animation = scene->mAnimations[0];
+        duration = (float)animation->mDuration;
+        if (animation->mTicksPerSecond != 0)
+            ticksPerSecond = (float)animation->mTicksPerSecond;
+
+        for (unsigned int i = 0; i < animation->mNumChannels; i++)
+            tracks.push_back(BoneTrack(animation->mChannels[i]));
+
+        flattenHierarchy(scene->mRootNode, -1, animation, model->boneInfoMap);
+    }
+
+    // writes the final bone matrices (global transform * offset) for the time in seconds into palette,
+    // which has to hold MAX_BONES matrices. globals is scratch space reused between calls. the parents
+    // are multiplied in with SSE, see multiplyPose.
+    void Evaluate(float seconds, glm::mat4* palette, vector<glm::mat4>& globals) const
+    {
+        float time = duration > 0.0f ? fmod(seconds * ticksPerSecond, duration) : 0.0f;
+
+        globals.resize(nodes.size());
+        for (unsigned int i = 0; i < nodes.size(); i++)
+        {
+            const Node& node = nodes[i];
+            glm::mat4 local = node.track >= 0 ? tracks[node.track].Sample(time) : node.transform;
+            if (node.parent >= 0)
+                multiplyPose(globals[node.parent], local, globals[i]);
+            else
+                globals[i] = local;
+
+            if (node.boneId >= 0 && node.boneId < MAX_BONES)
+                multiplyPose(globals[i], node.offset, palette[node.boneId]);
+        }
+    }
+
+private:
+    struct Node {
+        glm::mat4 transform;
+        glm::mat4 offset;
+        int parent;
+        int track;
+        int boneId;
+    };
+
+    vector<BoneTrack> tracks;
+    vector<Node> nodes;
+
+    void flattenHierarchy(const aiNode* source, int parent, const aiAnimation* animation, map<string, BoneInfo>& boneInfoMap)
+    {
+        Node node;
+        node.transform = AssimpToGlm(source->mTransformation);
+        node.offset = glm::mat4(1.0f);
+        node.parent = parent;
+        node.track = -1;
+        node.boneId = -1;
+
+        string name = source->mName.C_Str();
+        for (unsigned int i = 0; i < animation->mNumChannels; i++)
+        {
+            if (name == animation->mChannels[i]->mNodeName.C_Str())
+                node.track = i;
+        }
+
+        map<string, BoneInfo>::iterator bone = boneInfoMap.find(name);
+        if (bone != boneInfoMap.end())
+        {
+            node.boneId = bone->second.id;
+            node.offset = bone->second.offset;
+        }
+
+        int index = (int)nodes.size();
+        nodes.push_back(node);
+        for (unsigned int i = 0; i < source->mNumChildren; i++)
+            flattenHierarchy(source->mChildren[i], index, animation, boneInfoMap);
+    }
+};
+
+// evaluates one pose per instance, splitting the instances over the worker pool.
+// palettes receives MAX_BONES matrices per instance, times holds each instance's clip time in seconds.
+void EvaluatePoses(const Animation& animation, const vector<float>& times, vector<glm::mat4>& palettes)
+{
+    unsigned int count = (unsigned int)times.size();
+    palettes.resize(count * MAX_BONES, glm::mat4(1.0f));
+
+    workerPool.ParallelFor(count, 8, [&animation, &times, &palettes](unsigned int begin, unsigned int end) {
+        vector<glm::mat4> globals;
+        for (unsigned int i = begin; i < end; i++)
+            animation.Evaluate(times[i], &palettes[i * MAX_BONES], globals);
+    });
+}
+
+// one uniform buffer holding a bone palette for every instance. each instance gets its own range,
+// padded to the uniform buffer offset alignment, which is bound before that instance is drawn.
+class BonePaletteBuffer {
+public:
+    unsigned int UBO;
+
+    BonePaletteBuffer() : UBO(0), stride(0), capacity(0) {}
+
+    void Upload(const vector<glm::mat4>& palettes)
+    {
+        unsigned int count = (unsigned int)(palettes.size() / MAX_BONES);
+        unsigned int paletteSize = MAX_BONES * sizeof(glm::mat4);
+
+        if (UBO == 0)
+        {
+            GLint alignment;
+            glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+            stride = (paletteSize + alignment - 1) / alignment * alignment;
+            glGenBuffers(1, &UBO);
+            gpuMemory.Track(GPU_BUFFER, UBO, MEMORY_MODELS, "bone palettes");
+        }
+
+        glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+        if (count > capacity)
+        {
+            capacity = count;
+            TrackedBufferData(GL_UNIFORM_BUFFER, UBO, capacity * stride, nullptr, GL_STREAM_DRAW);
+        }
+
+        if (stride == paletteSize)
+        {
+            if (count > 0)
+                glBufferSubData(GL_UNIFORM_BUFFER, 0, count * paletteSize, &palettes[0]);
+        }
+        else
+        {
+            // the palettes are packed on the CPU, spread them out to the aligned offsets
+            staging.resize(count * stride);
+            for (unsigned int i = 0; i < count; i++)
+                memcpy(&staging[i * stride], &palettes[i * MAX_BONES], paletteSize);
+            if (count > 0)
+                glBufferSubData(GL_UNIFORM_BUFFER, 0, staging.size(), &staging[0]);
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    // makes the palette of one instance visible to the BonePalette block
+    void Bind(unsigned int instance)
+    {
+        glBindBufferRange(GL_UNIFORM_BUFFER, BONE_PALETTE_BINDING, UBO, instance * stride, MAX_BONES * sizeof(glm::mat4));
+    }
+
+    void Release()
+    {
+        DeleteTrackedBuffer(UBO);
+        capacity = 0;
+    }
+
+private:
+    unsigned int stride;
+    unsigned int capacity;
+    vector<unsigned char> staging;
+};
+#endif
@@ -1,5 +1,7 @@
 #include <iostream>
 #include <fstream>
+#include <chrono>
+#include <cstring>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -8,29 +10,64 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
-#include "model.h"
+#include "../Common/glstate.h"
+#include "../Common/model.h"
+#include "../Common/asyncloader.h"
+#include "animation.h"
+#include "residency.h"
+#include "../Common/filewatcher.h"
+#include "../Common/programcache.h"
+#include "../Common/shaderprogram.h"
+#include "../Common/frameuniforms.h"
+#include "../Common/shaderreload.h"
+#include "../Common/shadervariants.h"
+#include "../Common/shadercompiler.h"
+#include "../Common/renderqueue.h"
+#include "../Common/gpuprofiler.h"
+#include "../Common/vfs.h"
 
 #define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
+#include "../Common/stb_image.h"
 
 //Forward Declaration
 void processInput(GLFWwindow* window);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
-int init(GLFWwindow*& window);
+int init(GLFWwindow*& window, bool visible = true);
 void createShaders();
-void createProgram(GLuint& programID, const char* vertex, const char* fragment);
+void setupShaders();
+bool createProgram(ShaderProgram& program, const char* vertex, const char* fragment, const std::string& defines = "");
+void bindUniformBlocks(GLuint program);
 void createGeometry(GLuint& vao, GLuint& EBO, int& size, int& numTriangles);
-GLuint loadTexture(const char* path, int comp = 0);
+GLuint loadTexture(const char* path, int comp = 0, TextureUsage usage = TEXTURE_COLOR, MemoryCategory category = MEMORY_OTHER);
 GLuint loadSkyboxTexture();
 void createSkyboxGeometry(GLuint& VAO, GLuint& VBO);
-void renderSkybox(GLuint skyboxVAO, GLuint skyboxTex, glm::mat4 view, glm::mat4 projection);
-void renderBox(GLuint cubeVAO, GLuint boxTex, GLuint boxNormal, glm::mat4 cubeModel, glm::mat4 view, glm::mat4 projection, int& cubeNumIndices);
-void loadFile(const char* filename, char*& output);
-unsigned int GeneratePlane(const char* heightmap, unsigned char*& data, GLenum format, int comp, float hScale, float xzScale, unsigned int& indexCount, unsigned int& heightmapID);
+void renderSkybox(GLuint skyboxVAO, GLuint skyboxTex);
+void renderBox(GLuint cubeVAO, GLuint boxTex, GLuint boxNormal, glm::mat4 cubeModel, int& cubeNumIndices);
+unsigned int GeneratePlane(const char* heightmap, unsigned char*& data, int comp, float hScale, float xzScale, unsigned int& indexCount, GLenum& indexType, unsigned int& heightmapID, BoundingBox& bounds, bool wideIndices = false);
+void loadTerrainTextures();
+void setupRenderPasses();
+void beginFragmentQuery();
+void endFragmentQuery();
 void renderTerrain();
+void renderFeedback();
 void renderModel(Model* model, glm::vec3 pos, glm::vec3 rot, glm::vec3 scale);
-
-GLuint simpleProgram, skyboxProgram, terrainProgram, modelProgram;
+void benchmarkSkinning(const char* path, int characterCount, int frameCount);
+void benchmarkMipmaps(const char* path, int runs);
+void benchmarkPrograms();
+bool testIndices();
+void renderModelInstanced(Model* model, const std::vector<glm::mat4>& transforms, InstanceBuffer& instances);
+void releaseVertexArray(GLuint& VAO);
+void reportGpuMemory();
+void reportGpuTimes();
+void watchModelTextures(Model* model);
+void updateMaterialPacking();
+
+ShaderProgram simpleProgram, skyboxProgram, skinnedProgram, feedbackProgram, modelPackedProgram;
+//Depth prepass and overdraw heatmap programs, they share the vertex shaders of the programs they stand in for
+ShaderProgram terrainDepthProgram, modelDepthProgram, instancedDepthProgram;
+ShaderProgram skyOverdrawProgram, terrainOverdrawProgram, modelOverdrawProgram, instancedOverdrawProgram;
+//The terrain and model shaders are built per set of features, a draw uses the variant that does the least work
+ShaderVariants terrainVariants, modelVariants, modelInstancedVariants;
 
 const int WIDTH = 1280, HEIGHT = 720;
 
@@ -54,21 +91,131 @@ GLuint dirt, sand, grass, rock, snow;
 glm::vec3 lightPosition = glm::normalize(glm::vec3( - 0.5f, -0.5f, -0.5f));
 
 glm::mat4 view;
-glm::mat4 projection = glm::perspective(glm::radians(45.0f), WIDTH / (float)HEIGHT, 0.1f, 5000.0f);
+#define FAR_PLANE 5000.0f
+glm::mat4 projection = glm::perspective(glm::radians(45.0f), WIDTH / (float)HEIGHT, 0.1f, FAR_PLANE);
 
 Model* backpack;
+TextureStreamer textureStreamer;
+AsyncModelLoader modelLoader(2, &textureStreamer);
+// keeps only the mip levels the camera actually needs resident
+TextureResidency textureResidency(&textureStreamer, WIDTH, HEIGHT);
+
+//Instanced backpacks, toggled with I
+std::vector<glm::mat4> backpackField;
+InstanceBuffer backpackInstances;
+bool drawBackpackField = false;
+
+//Material textures packed into texture arrays, toggled with M. the backpack's own textures are released while they're used
+MaterialPacker materialPacker;
+bool materialsPacked = false;
+unsigned int packedVersion = 0;
+bool usePackedMaterials = true;
+
+//Per meshlet frustum and backface cone culling of the models, toggled with C
+MeshletCuller meshletCuller;
+bool useMeshletCulling = true;
+
+//Uniforms set through the reflected tables of the programs, toggled with U to compare against a lookup per uniform
+double renderCpuTime = 0.0;
+unsigned int renderCpuFrames = 0;
+
+//The draws of a frame, sorted by their keys before they are issued. toggled with O to compare against submission order
+RenderQueue renderQueue;
+bool sortRenderQueue = true;
+
+//Terrain and models are drawn depth only first and shaded with GL_EQUAL, the sky last where nothing covers it. toggled with P.
+//H shows how many fragments every pixel shades as a heatmap. the fragments shaded per frame are counted with occlusion queries
+RenderQueue depthQueue;
+bool useDepthPrepass = true;
+bool showOverdraw = false;
+#define FRAGMENT_QUERY_COUNT 3
+GLuint fragmentQueries[FRAGMENT_QUERY_COUNT];
+unsigned int fragmentQueryFrame = 0;
+unsigned long long fragmentsShaded = 0;
+unsigned int fragmentFrames = 0;
+
+//Textures, models and shaders are reloaded when their files change
+FileWatcher fileWatcher;
+ShaderReloader shaderReloader(fileWatcher);
+const char* backpackPath = "models/backpack/backpack.obj";
 
 //Terrain data
 GLuint terrainVAO, terrainIndexCount, heightmapID, heightNormalID;
+GLenum terrainIndexType;
+BoundingBox terrainBounds;
+// terrain variant that only samples the far layers, for when all of it is past TERRAIN_FAR_DISTANCE
+#define TERRAIN_VARIANT_FAR_ONLY 1
+// distance from the camera where terrainFragment.shader stops blending in the close layers
+#define TERRAIN_FAR_DISTANCE 400.0f
 unsigned char* heightmapTexture;
 
-int main() {
+int main(int argc, char** argv) {
+    auto startTime = std::chrono::high_resolution_clock::now();
+    bool firstFrame = true;
+    unsigned int meshletReportFrame = 0;
+
+    // Terrrain.exe --build-pack puts every shader, texture and model into one pack file and exits
+    if (argc > 1 && strcmp(argv[1], "--build-pack") == 0)
+        return BuildPack(ASSET_PACK_PATH, { "shaders", "textures", "models" }) ? 0 : 1;
+
+    // with a pack next to the program the assets are read from it, loose files are only the fallback
+    if (assets.Mount(ASSET_PACK_PATH))
+        std::cout << "Reading assets from " << ASSET_PACK_PATH << std::endl;
+
+    // the benchmarks only need a context, their window stays hidden
+    bool benchmark = argc > 1 && (strncmp(argv[1], "--bench-", 8) == 0 || strncmp(argv[1], "--test-", 7) == 0);
+
     GLFWwindow* window;
-    int res = init(window);
+    int res = init(window, !benchmark);
     if (res != 0) return res;
-    
 
+    InitTextureCompression();
+    programCache.Init();
+    shaderCompiler.Init();
+
+    // Terrrain.exe --bench-programs compares creating every program from source and from the program cache
+    if (argc > 1 && strcmp(argv[1], "--bench-programs") == 0) {
+        benchmarkPrograms();
+        glfwTerminate();
+        return 0;
+    }
+
+    // the programs compile while everything below loads, setupShaders waits for them before the first frame
+    auto shaderStart = std::chrono::high_resolution_clock::now();
     createShaders();
+    std::cout << "Submitted programs in " << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - shaderStart).count() << " ms ("
+              << programCache.hits << " from the program cache, " << programCache.misses << " compiling"
+              << (shaderCompiler.Parallel() ? " on the driver's threads)" : ")") << std::endl;
+
+    // Terrrain.exe --bench-skinning <animated model> animates 1000 copies of the model and exits
+    if (argc > 2 && strcmp(argv[1], "--bench-skinning") == 0) {
+        setupShaders();
+        benchmarkSkinning(argv[2], 1000, 300);
+        glfwTerminate();
+        return 0;
+    }
+
+    // Terrrain.exe --bench-mips <image> compares the CPU mip generator against glGenerateMipmap and exits
+    if (argc > 2 && strcmp(argv[1], "--bench-mips") == 0) {
+        benchmarkMipmaps(argv[2], 5);
+        glfwTerminate();
+        return 0;
+    }
+
+    // Terrrain.exe --test-indices checks that 16 bit indices draw the same pixels as 32 bit ones, exits with 1 if not
+    if (argc > 1 && strcmp(argv[1], "--test-indices") == 0) {
+        setupShaders();
+        bool passed = testIndices();
+        glfwTerminate();
+        return passed ? 0 : 1;
+    }
+
+    // streamed textures give up their finest levels when video memory use goes over the budget
+    gpuMemory.SetTotalBudget(512 * 1024 * 1024, [](MemoryCategory, size_t used, size_t budget) {
+        size_t over = used - budget;
+        textureResidency.budget = textureResidency.budget > over + 16 * 1024 * 1024 ? textureResidency.budget - over : 16 * 1024 * 1024;
+        std::cout << "GPU memory over budget by " << over / 1024 << " KB, texture budget lowered to " << textureResidency.budget / (1024 * 1024) << " MB" << std::endl;
+    });
 
     GLuint skyboxTex = loadSkyboxTexture();
     GLuint skyboxVAO, skyboxVBO;
@@ -77,24 +224,39 @@ int main() {
     GLuint cubeVAO, cubeVBO, cubeEBO;
     int cubeSize, cubeNumIndices;
 
-    GLuint boxTex = loadTexture("textures/container2.png");
-    GLuint boxNormal = loadTexture("textures/container2_normal.png");
+    GLuint boxTex = loadTexture("textures/container2.png", 0, TEXTURE_COLOR, MEMORY_MODELS);
+    GLuint boxNormal = loadTexture("textures/container2_normal.png", 0, TEXTURE_NORMAL, MEMORY_MODELS);
     createGeometry(cubeVAO, cubeEBO, cubeSize, cubeNumIndices);
 
-    terrainVAO = GeneratePlane("textures/heightMap.png", heightmapTexture, GL_RGBA, 4, 100.0f, 5.0f, terrainIndexCount, heightmapID);
-    heightNormalID = loadTexture("textures/heightnormal.png");
-
-    dirt = loadTexture("textures/dirt.jpg");
-    snow = loadTexture("textures/snow.jpg");
-    sand = loadTexture("textures/sand.jpg");
-    rock = loadTexture("textures/rock.jpg");
-    grass = loadTexture("textures/grass.png", 4);
+    terrainVAO = GeneratePlane("textures/heightMap.png", heightmapTexture, 4, 100.0f, 5.0f, terrainIndexCount, terrainIndexType, heightmapID, terrainBounds);
+    // the vertices are built, the CPU copy of the heights isn't needed any more
+    delete[] heightmapTexture;
+    heightmapTexture = nullptr;
+    loadTerrainTextures();
+
+    // imported on a worker thread, a placeholder box is drawn until it is uploaded
+    backpack = modelLoader.Load(backpackPath, true);
+    fileWatcher.Watch(backpackPath, [](const std::string& path) {
+        if (backpack->ready)
+            modelLoader.Reload(backpack, path, true);
+    });
+
+    // a grid of backpacks above the terrain to exercise the instanced path
+    for (int x = 0; x < 100; x++) {
+        for (int z = 0; z < 100; z++) {
+            glm::mat4 world = glm::translate(glm::mat4(1.0f), glm::vec3(x * 20.0f, 150.0f, z * 20.0f));
+            backpackField.push_back(glm::scale(world, glm::vec3(5, 5, 5)));
+        }
+    }
 
-    stbi_set_flip_vertically_on_load(true);
-    backpack = new Model("models/backpack/backpack.obj");
-    stbi_set_flip_vertically_on_load(false);
+    auto waitStart = std::chrono::high_resolution_clock::now();
+    setupShaders();
+    auto shaderEnd = std::chrono::high_resolution_clock::now();
+    std::cout << "Programs ready " << std::chrono::duration<double, std::milli>(shaderEnd - shaderStart).count() << " ms after they were submitted, "
+              << std::chrono::duration<double, std::milli>(shaderEnd - waitStart).count() << " ms of it waiting for the driver" << std::endl;
 
     glViewport(0, 0, WIDTH, HEIGHT);
+    setupRenderPasses();
 
     glfwSetCursorPosCallback(window, mouse_callback);
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
@@ -102,22 +264,128 @@ int main() {
     while (!glfwWindowShouldClose(window)) {
         processInput(window);
 
+        fileWatcher.Poll();
+        modelLoader.Update();
+
+        updateMaterialPacking();
+
+        textureResidency.Update();
+        textureStreamer.Update();
+
         glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
         view = glm::lookAt(cameraPosition, cameraPosition + cameraFront, cameraUp);
-        glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
+        // the camera and light go to every program at once, the draws only set their own uniforms
+        frameUniforms.Update(view, projection, cameraPosition, lightPosition);
+
+        auto renderStart = std::chrono::high_resolution_clock::now();
+
+        // the GPU time of the frame, read back a few frames from now
+        gpuProfiler.BeginFrame();
+
+        if (textureResidency.WantsFeedback()) {
+            GpuScope scope("feedback");
+            renderFeedback();
+        }
+
+        // the last pass of the previous frame leaves depth writes off, glClear doesn't clear what is masked
+        glState.ColorMask(true);
+        glState.DepthMask(true);
+        // the heatmap adds up from black
+        if (showOverdraw)
+            glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        else
+            glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        renderSkybox(skyboxVAO, skyboxTex, view, projection);
+        // the render functions only queue their draws, the queues decide the order
+        depthQueue.Begin(FAR_PLANE);
+        renderQueue.Begin(FAR_PLANE);
+
+        renderSkybox(skyboxVAO, skyboxTex);
 
         renderTerrain();
 
         renderModel(backpack, glm::vec3(100, 100, 100), glm::vec3(0, 0 , 0), glm::vec3(10, 10 ,10));
 
+        if (drawBackpackField && backpack->ready)
+            renderModelInstanced(backpack, backpackField, backpackInstances);
+
+        // the prepass goes first and on its own, the query only counts the fragments that are shaded
+        depthQueue.Flush(sortRenderQueue);
+        beginFragmentQuery();
+        renderQueue.Flush(sortRenderQueue);
+        endFragmentQuery();
+
+        gpuProfiler.EndFrame();
+
+        renderCpuTime += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - renderStart).count();
+        renderCpuFrames++;
+
         glfwSwapBuffers(window);
         glfwPollEvents();
+
+        // every few seconds, how much of the model geometry the meshlet culling saved
+        if (useMeshletCulling && meshletCuller.trianglesTested > 0 && ++meshletReportFrame % 600 == 0) {
+            std::cout << "Meshlets: " << meshletCuller.ConeCulledPercentage() << "% of triangles rejected by backface cones, "
+                      << meshletCuller.FrustumCulledPercentage() << "% by the frustum" << std::endl;
+            meshletCuller.ResetStats();
+        }
+
+        // every few seconds, the CPU time spent issuing the frame and what the uniform tables and the state cache saved
+        if (renderCpuFrames == 600) {
+            std::cout << "Render CPU time: " << renderCpuTime / renderCpuFrames << " ms/frame with uniform cache " << (useUniformCache ? "on" : "off") << ", "
+                      << uniformUploads / renderCpuFrames << " uniform uploads and " << uniformUploadsSkipped / renderCpuFrames << " skipped per frame, "
+                      << glState.issued / renderCpuFrames << " state changes and " << glState.skipped / renderCpuFrames << " redundant ones skipped per frame with "
+                      << renderQueue.drawn << " draws " << (sortRenderQueue ? "sorted" : "in submission order") << std::endl;
+            renderCpuTime = 0.0;
+            renderCpuFrames = 0;
+            uniformUploads = uniformUploadsSkipped = 0;
+            glState.ResetCounters();
+
+            if (fragmentFrames > 0) {
+                std::cout << "Fragments shaded: " << fragmentsShaded / fragmentFrames << " per frame, " << (double)fragmentsShaded / fragmentFrames / (WIDTH * HEIGHT)
+                          << " per pixel with depth prepass " << (useDepthPrepass ? "on" : "off") << std::endl;
+            }
+            fragmentsShaded = 0;
+            fragmentFrames = 0;
+
+            reportGpuTimes();
+        }
+
+        if (firstFrame) {
+            std::cout << "First frame after " << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count() << " ms" << std::endl;
+            firstFrame = false;
+        }
     }
 
+    // everything goes while the context is still there, whatever is left in the report afterwards leaked
+    if (backpack->ready)
+        backpack->Release(&textureStreamer);
+    GLuint streamed[] = { boxTex, boxNormal, heightNormalID, dirt, snow, sand, rock, grass };
+    for (GLuint texture : streamed)
+        textureStreamer.Release(texture);
+    DeleteTrackedTexture(heightmapID);
+    DeleteTrackedTexture(skyboxTex);
+    glDeleteVertexArrays(1, &skyboxVAO);
+    glState.VertexArrayDeleted(skyboxVAO);
+    DeleteTrackedBuffer(skyboxVBO);
+    releaseVertexArray(cubeVAO);
+    releaseVertexArray(terrainVAO);
+    backpackInstances.Release();
+    materialPacker.Release();
+    frameUniforms.Release();
+    textureResidency.Release();
+    modelLoader.Release();
+    terrainVariants.Release();
+    modelVariants.Release();
+    modelInstancedVariants.Release();
+    if (fragmentQueries[0] != 0)
+        glDeleteQueries(FRAGMENT_QUERY_COUNT, fragmentQueries);
+    gpuProfiler.Release();
+
+    reportGpuMemory();
+
     glfwTerminate();
     return 0;
 }
@@ -154,6 +422,84 @@ void processInput(GLFWwindow* window) {
     if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS)
         cubeModel = glm::rotate(cubeModel, -rotationSpeed, glm::vec3(1.0f, 0.0f, 0.0f));
 
+    //toggle the instanced backpacks with I
+    static bool instancedKeyDown = false;
+    bool instancedKey = glfwGetKey(window, GLFW_KEY_I) == GLFW_PRESS;
+    if (instancedKey && !instancedKeyDown)
+        drawBackpackField = !drawBackpackField;
+    instancedKeyDown = instancedKey;
+
+    //toggle between the packed material arrays and per mesh textures with M
+    static bool materialKeyDown = false;
+    bool materialKey = glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS;
+    if (materialKey && !materialKeyDown)
+        usePackedMaterials = !usePackedMaterials;
+    materialKeyDown = materialKey;
+
+    //toggle meshlet culling with C
+    static bool meshletKeyDown = false;
+    bool meshletKey = glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS;
+    if (meshletKey && !meshletKeyDown)
+        useMeshletCulling = !useMeshletCulling;
+    meshletKeyDown = meshletKey;
+
+    //toggle the uniform tables with U, the numbers start over so the report only covers one mode
+    static bool uniformKeyDown = false;
+    bool uniformKey = glfwGetKey(window, GLFW_KEY_U) == GLFW_PRESS;
+    if (uniformKey && !uniformKeyDown) {
+        useUniformCache = !useUniformCache;
+        renderCpuTime = 0.0;
+        renderCpuFrames = 0;
+        uniformUploads = uniformUploadsSkipped = 0;
+    }
+    uniformKeyDown = uniformKey;
+
+    //toggle sorting the render queue with O, the state changes of both orders show in the report
+    static bool sortKeyDown = false;
+    bool sortKey = glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS;
+    if (sortKey && !sortKeyDown) {
+        sortRenderQueue = !sortRenderQueue;
+        renderCpuTime = 0.0;
+        renderCpuFrames = 0;
+        uniformUploads = uniformUploadsSkipped = 0;
+        glState.ResetCounters();
+    }
+    sortKeyDown = sortKey;
+
+    //toggle the depth prepass with P, the fragment count starts over
+    static bool prepassKeyDown = false;
+    bool prepassKey = glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS;
+    if (prepassKey && !prepassKeyDown) {
+        useDepthPrepass = !useDepthPrepass;
+        // the queries still in flight were counted in the other mode
+        fragmentQueryFrame = 0;
+        fragmentsShaded = 0;
+        fragmentFrames = 0;
+    }
+    prepassKeyDown = prepassKey;
+
+    //toggle the overdraw heatmap with H
+    static bool overdrawKeyDown = false;
+    bool overdrawKey = glfwGetKey(window, GLFW_KEY_H) == GLFW_PRESS;
+    if (overdrawKey && !overdrawKeyDown)
+        showOverdraw = !showOverdraw;
+    overdrawKeyDown = overdrawKey;
+
+    //start and stop writing the GPU times of every frame to gpu_times.csv with G
+    static bool gpuCsvKeyDown = false;
+    bool gpuCsvKey = glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS;
+    if (gpuCsvKey && !gpuCsvKeyDown) {
+        if (gpuProfiler.WritingCsv()) {
+            gpuProfiler.StopCsv();
+            std::cout << "Stopped writing gpu_times.csv" << std::endl;
+        }
+        else if (gpuProfiler.StartCsv("gpu_times.csv"))
+            std::cout << "Writing GPU times to gpu_times.csv" << std::endl;
+        else
+            std::cout << "Can't write gpu_times.csv" << std::endl;
+    }
+    gpuCsvKeyDown = gpuCsvKey;
+
     //escape to exut window
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) {
         glfwSetWindowShouldClose(window, true);
@@ -195,12 +541,13 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos) {
     cameraFront = glm::normalize(front);
 }
 
-int init(GLFWwindow*& window) {
+int init(GLFWwindow*& window, bool visible) {
 
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, visible ? GL_TRUE : GL_FALSE);
     //glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 
     window = glfwCreateWindow(WIDTH, HEIGHT, "OPENGLproject", NULL, NULL);
@@ -220,21 +567,29 @@ int init(GLFWwindow*& window) {
     return 0;
 }
 
-unsigned int GeneratePlane(const char* heightmap, unsigned char* &data, GLenum format, int comp, float hScale, float xzScale, unsigned int& indexCount, unsigned int& heightmapID) {
-    int width, height, channels;
+unsigned int GeneratePlane(const char* heightmap, unsigned char* &data, int comp, float hScale, float xzScale, unsigned int& indexCount, GLenum& indexType, unsigned int& heightmapID, BoundingBox& bounds, bool wideIndices) {
+    int width, height;
     data = nullptr;
     if (heightmap != nullptr) {
-        data = stbi_load(heightmap, &width, &height, &channels, comp);
-        if (data) {
+        // heights have to stay exact, so the heightmap is cached uncompressed
+        TextureData texture = LoadTextureData(heightmap, comp, TEXTURE_DATA, true);
+        if (!texture.Empty()) {
+            width = texture.levels[0].width;
+            height = texture.levels[0].height;
+
+            // the vertices are built from the full resolution level
+            data = new unsigned char[texture.levels[0].size];
+            memcpy(data, texture.levels[0].data, texture.levels[0].size);
+
             glGenTextures(1, &heightmapID);
-            glBindTexture(GL_TEXTURE_2D, heightmapID);
+            glState.BindTexture(GL_TEXTURE_2D, heightmapID);
+            gpuMemory.Track(GPU_TEXTURE, heightmapID, MEMORY_TERRAIN, heightmap);
 
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 
-            glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-            glGenerateMipmap(GL_TEXTURE_2D);
-            glBindTexture(GL_TEXTURE_2D, 0);
+            UploadTextureData(heightmapID, GL_TEXTURE_2D, texture);
+            glState.BindTexture(GL_TEXTURE_2D, 0);
         }
     }
 
@@ -262,6 +617,8 @@ unsigned int GeneratePlane(const char* heightmap, unsigned char* &data, GLenum f
 
 
     }
+    bounds.min = glm::vec3(0.0f);
+    bounds.max = glm::vec3((width - 1) * xzScale, hScale, (height - 1) * xzScale);
 
     index = 0;
     for (int i = 0; i < (width - 1) * (height - 1); i++) {
@@ -283,18 +640,22 @@ unsigned int GeneratePlane(const char* heightmap, unsigned char* &data, GLenum f
 
     unsigned int vertSize = (width * height) * stride * sizeof(float);
     indexCount = ((width - 1) * (height - 1) * 6);
+    // heightmaps up to 256x256 fit 16 bit indices, wideIndices keeps them 32 bit to compare against
+    indexType = wideIndices ? GL_UNSIGNED_INT : ChooseIndexType(width * height);
 
     unsigned int VAO, VBO, EBO;
     glGenVertexArrays(1, &VAO);
     glGenBuffers(1, &VBO);
     glGenBuffers(1, &EBO);
 
-    glBindVertexArray(VAO);
+    glState.BindVertexArray(VAO);
 
+    gpuMemory.Track(GPU_BUFFER, VBO, MEMORY_TERRAIN, "terrain vertices");
+    gpuMemory.Track(GPU_BUFFER, EBO, MEMORY_TERRAIN, "terrain indices");
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, vertSize, vertices, GL_STATIC_DRAW);
+    TrackedBufferData(GL_ARRAY_BUFFER, VBO, vertSize, vertices, GL_STATIC_DRAW);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(unsigned int), indices, GL_STATIC_DRAW);
+    UploadIndexBuffer(EBO, indices, indexCount, indexType);
 
     // vertex information!
     // position
@@ -309,7 +670,7 @@ unsigned int GeneratePlane(const char* heightmap, unsigned char* &data, GLenum f
 
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-    glBindVertexArray(0);
+    glState.BindVertexArray(0);
 
     delete[] vertices;
     delete[] indices;
@@ -317,148 +678,196 @@ unsigned int GeneratePlane(const char* heightmap, unsigned char* &data, GLenum f
     return VAO;
 }
 
+// the units Mesh binds its textures to, see MaterialTextureUnit
+void setMaterialSamplers(ShaderProgram& program) {
+    program.SetInt("texture_diffuse1", 0);
+    program.SetInt("texture_specular1", 1);
+    program.SetInt("texture_normal1", 2);
+    program.SetInt("texture_roughness1", 3);
+    program.SetInt("texture_ao1", 4);
+}
+
+// submits every program to the driver, they compile while the textures and models load. setupShaders
+// waits for them
 void createShaders() {
     createProgram(skyboxProgram, "shaders/skyVertex.shader", "shaders/skyFragment.shader");
     createProgram(simpleProgram, "shaders/simpleVertex.shader", "shaders/simpleFragment.shader");
 
-    glUseProgram(simpleProgram);
-    glUniform1i(glGetUniformLocation(simpleProgram, "mainTex"), 0);
-    glUniform1i(glGetUniformLocation(simpleProgram, "normalTex"), 1);
-
-    createProgram(terrainProgram, "shaders/terrainVertex.shader", "shaders/terrainFragment.shader");
-
-
-    glUseProgram(terrainProgram);
-    glUniform1i(glGetUniformLocation(terrainProgram, "terrainTex"), 0);
-    glUniform1i(glGetUniformLocation(terrainProgram, "normalTex"), 1);
-
-    glUniform1i(glGetUniformLocation(terrainProgram, "dirt"), 2);
-    glUniform1i(glGetUniformLocation(terrainProgram, "sand"), 3);
-    glUniform1i(glGetUniformLocation(terrainProgram, "grass"), 4);
-    glUniform1i(glGetUniformLocation(terrainProgram, "rock"), 5);
-    glUniform1i(glGetUniformLocation(terrainProgram, "snow"), 6);
-
-    createProgram(modelProgram, "shaders/model.vs", "shaders/model.fs");
-
-    glUseProgram(modelProgram);
-
-    glUniform1i(glGetUniformLocation(modelProgram, "texture_diffuse1"), 0);
-    glUniform1i(glGetUniformLocation(modelProgram, "texture_specular1"), 1);
-    glUniform1i(glGetUniformLocation(modelProgram, "texture_normal1"), 2);
-    glUniform1i(glGetUniformLocation(modelProgram, "texture_roughness1"), 3);
-    glUniform1i(glGetUniformLocation(modelProgram, "texture_ao1"), 4);
+    // the variants compile the first time a draw needs them, and that draw waits for it
+    terrainVariants.Init({ "TERRAIN_FAR_ONLY" },
+        [](ShaderProgram& program, const std::string& defines) {
+            return createProgram(program, "shaders/terrainVertex.shader", "shaders/terrainFragment.shader", defines) && shaderCompiler.Finish(&program);
+        },
+        [](ShaderProgram& program) {
+            program.SetInt("terrainTex", 0);
+            program.SetInt("normalTex", 1);
+
+            program.SetInt("dirt", 2);
+            program.SetInt("sand", 3);
+            program.SetInt("grass", 4);
+            program.SetInt("rock", 5);
+            program.SetInt("snow", 6);
+        });
+
+    // the bits are the MATERIAL_HAS_ flags of the meshes
+    std::vector<std::string> materialFeatures = { "HAS_SPECULAR", "HAS_ROUGHNESS", "HAS_AO" };
+    modelVariants.Init(materialFeatures,
+        [](ShaderProgram& program, const std::string& defines) {
+            return createProgram(program, "shaders/model.vs", "shaders/model.fs", defines) && shaderCompiler.Finish(&program);
+        },
+        setMaterialSamplers);
+    modelInstancedVariants.Init(materialFeatures,
+        [](ShaderProgram& program, const std::string& defines) {
+            return createProgram(program, "shaders/modelInstanced.vs", "shaders/model.fs", defines) && shaderCompiler.Finish(&program);
+        },
+        setMaterialSamplers);
+
+    createProgram(feedbackProgram, "shaders/feedback.vs", "shaders/feedback.fs");
+
+    createProgram(modelPackedProgram, "shaders/model.vs", "shaders/modelPacked.fs");
+
+    // same vertex shaders, so the prepass writes exactly the depth the shading pass tests against
+    createProgram(terrainDepthProgram, "shaders/terrainVertex.shader", "shaders/depth.fs");
+    createProgram(modelDepthProgram, "shaders/model.vs", "shaders/depth.fs");
+    createProgram(instancedDepthProgram, "shaders/modelInstanced.vs", "shaders/depth.fs");
+
+    createProgram(skyOverdrawProgram, "shaders/skyVertex.shader", "shaders/overdraw.fs");
+    createProgram(terrainOverdrawProgram, "shaders/terrainVertex.shader", "shaders/overdraw.fs");
+    createProgram(modelOverdrawProgram, "shaders/model.vs", "shaders/overdraw.fs");
+    createProgram(instancedOverdrawProgram, "shaders/modelInstanced.vs", "shaders/overdraw.fs");
 }
 
-void createProgram(GLuint& programID, const char* vertex, const char* fragment) {
-    // Create a GL Program with a vertex & fragment shader
-    char* vertexSrc;
-    char* fragmentSrc;
-
-    loadFile(vertex, vertexSrc);
-    loadFile(fragment, fragmentSrc);
+// waits for the programs createShaders submitted and sets what they need once
+void setupShaders() {
+    shaderCompiler.Finish();
 
-    GLuint vertexShaderID, fragmentShaderID;
-
-    vertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShaderID, 1, &vertexSrc, nullptr);
-    glCompileShader(vertexShaderID);
+    glState.UseProgram(simpleProgram.id);
+    simpleProgram.SetInt("mainTex", 0);
+    simpleProgram.SetInt("normalTex", 1);
+}
 
-    int success;
-    char infoLog[512];
-    glGetShaderiv(vertexShaderID, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        glGetShaderInfoLog(vertexShaderID, 512, nullptr, infoLog);
-        std::cout << "ERROR COMPILING VERTEX SHADER\n" << infoLog << std::endl;
+bool createProgram(ShaderProgram& program, const char* vertex, const char* fragment, const std::string& defines) {
+    // Create a GL Program with a vertex & fragment shader, it only replaces the program once it linked.
+    // defines are #define lines both shaders get, to build a variant of them. a program that isn't in the
+    // cache is only submitted, false means the sources couldn't be read
+    std::string vertexSrc, fragmentSrc;
+    std::vector<std::string> files;
+    bool loaded = LoadShaderSource(vertex, vertexSrc, files, defines) && LoadShaderSource(fragment, fragmentSrc, files, defines);
+
+    // saving any of the files, or one they include, builds the program again
+    shaderReloader.Track(&program, files, [&program, vertex, fragment, defines]() {
+        return createProgram(program, vertex, fragment, defines) && shaderCompiler.Finish(&program);
+    });
+    if (!loaded)
+        return false;
+
+    // a program linked from the same sources on this driver before is restored from its binary
+    unsigned long long key = programCache.Key({ vertexSrc, fragmentSrc }, defines);
+    GLuint programID = programCache.Load(key);
+    if (programID != 0) {
+        bindUniformBlocks(programID);
+        // the uniforms are read back once, drawing sets them through the table
+        program.Adopt(programID);
+        return true;
     }
 
-    fragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShaderID, 1, &fragmentSrc, nullptr);
-    glCompileShader(fragmentShaderID);
-
-    glGetShaderiv(fragmentShaderID, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        glGetShaderInfoLog(fragmentShaderID, 512, nullptr, infoLog);
-        std::cout << "ERROR COMPILING FRAGMENT SHADER\n" << infoLog << std::endl;
-    }
+    // nothing waits for the compile here, the program is put to use once shaderCompiler.Finish gets to it
+    GLuint vertexShaderID = shaderCompiler.Compile(GL_VERTEX_SHADER, vertexSrc);
+    GLuint fragmentShaderID = shaderCompiler.Compile(GL_FRAGMENT_SHADER, fragmentSrc);
 
     programID = glCreateProgram();
     glAttachShader(programID, vertexShaderID);
     glAttachShader(programID, fragmentShaderID);
+    programCache.PrepareLink(programID);
     glLinkProgram(programID);
 
-    glGetProgramiv(programID, GL_LINK_STATUS, &success);
-    if (!success) {
-        glGetProgramInfoLog(programID, 512, nullptr, infoLog);
-        std::cout << "ERROR LINKING PROGRAM\n" << infoLog << std::endl;
-    }
-
-    glDeleteShader(vertexShaderID);
-    glDeleteShader(fragmentShaderID);
-
-    delete vertexSrc;
-    delete fragmentSrc;
-
+    shaderCompiler.Submit(&program, programID, { vertexShaderID, fragmentShaderID }, { vertex, fragment }, [&program, key](GLuint programID) {
+        programCache.Store(key, programID);
+        bindUniformBlocks(programID);
+        program.Adopt(programID);
+    });
+    return true;
 }
 
-void loadFile(const char* filename, char*& output) {
-    std::ifstream file(filename, std::ios::binary);
-
-    if (file.is_open()) {
-        file.seekg(0, file.end);
-        int length = file.tellg();
-        file.seekg(0, file.beg);
-
-        output = new char[length + 1];
-
-        file.read(output, length);
-
-        output[length] = '\0';
+// points the uniform blocks a program declares at the binding points of their buffers
+void bindUniformBlocks(GLuint program) {
+    frameUniforms.BindProgram(program);
 
-        file.close();
-    }
-    else {
-        output = NULL;
-    }
+    GLuint bones = glGetUniformBlockIndex(program, "BonePalette");
+    if (bones != GL_INVALID_INDEX)
+        glUniformBlockBinding(program, bones, BONE_PALETTE_BINDING);
 }
 
-GLuint loadTexture(const char* path, int comp)
+GLuint loadTexture(const char* path, int comp, TextureUsage usage, MemoryCategory category)
 {
-    GLuint textureID;
-    glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_2D, textureID);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    int width, height, numChannels;
-    unsigned char* data = stbi_load(path, &width, &height, &numChannels, comp);
-    if (data) {
-        if (comp != 0) numChannels = comp;
-
-        if (numChannels == 3)
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-        else if (numChannels == 4)
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+    // the texture can be used right away, its mip levels are streamed in smallest first over the next frames
+    GLuint texture = textureStreamer.Load(path, comp, usage, category);
+    fileWatcher.Watch(path, [texture](const std::string&) {
+        textureStreamer.Reload(texture);
+    });
+    return texture;
+}
 
+// reloads the textures of a model, and their copies in the material arrays, when their files change
+void watchModelTextures(Model* model) {
+    std::vector<std::string> paths = model->TexturePaths();
+    for (unsigned int i = 0; i < paths.size(); i++) {
+        if (fileWatcher.IsWatched(paths[i]))
+            continue;
+        fileWatcher.Watch(paths[i], [model](const std::string& path) {
+            model->ReloadTexture(path, &textureStreamer);
+            materialPacker.Reload(path);
+        });
+    }
+}
 
-        glGenerateMipmap(GL_TEXTURE_2D);
+// the material arrays only exist while M has them on, and the backpack's own textures only while something
+// samples them: the per mesh path and the instanced field, which has no packed program. that way no
+// material map is in video memory twice
+void updateMaterialPacking() {
+    static int watchedVersion = -1;
+    if (!backpack->ready)
+        return;
+
+    // once the backpack is in, or after it was reloaded, its textures go into the shared material arrays
+    if (usePackedMaterials && (!materialsPacked || packedVersion != backpack->version)) {
+        backpack->PackMaterials(materialPacker);
+        materialPacker.Build();
+        materialsPacked = true;
+        packedVersion = backpack->version;
     }
-    else {
-        std::cout << "Error loading texture: " << path << std::endl;
+    else if (!usePackedMaterials && materialsPacked) {
+        materialPacker.Release();
+        materialsPacked = false;
     }
 
-    stbi_image_free(data);
+    if (materialsPacked && !drawBackpackField)
+        backpack->ReleaseTextures(&textureStreamer);
+    else
+        backpack->RestoreTextures(&textureStreamer);
+
+    if (watchedVersion != (int)backpack->version) {
+        watchModelTextures(backpack);
+        watchedVersion = (int)backpack->version;
+    }
+}
 
-    glBindTexture(GL_TEXTURE_2D, 0);
+void loadTerrainTextures() {
+    heightNormalID = loadTexture("textures/heightnormal.png", 0, TEXTURE_NORMAL, MEMORY_TERRAIN);
 
-    return textureID;
+    dirt = loadTexture("textures/dirt.jpg", 0, TEXTURE_COLOR, MEMORY_TERRAIN);
+    snow = loadTexture("textures/snow.jpg", 0, TEXTURE_COLOR, MEMORY_TERRAIN);
+    sand = loadTexture("textures/sand.jpg", 0, TEXTURE_COLOR, MEMORY_TERRAIN);
+    rock = loadTexture("textures/rock.jpg", 0, TEXTURE_COLOR, MEMORY_TERRAIN);
+    grass = loadTexture("textures/grass.png", 4, TEXTURE_COLOR, MEMORY_TERRAIN);
 }
 
 GLuint loadSkyboxTexture() {
     // Load and configure skybox cubemap
     GLuint skyboxTexture;
     glGenTextures(1, &skyboxTexture);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTexture);
+    glState.BindTexture(GL_TEXTURE_CUBE_MAP, skyboxTexture);
+    gpuMemory.Track(GPU_TEXTURE, skyboxTexture, MEMORY_SKYBOX, "skybox");
 
     const char* skyboxFaces[] = {
         "textures/skybox/right.jpg",
@@ -469,16 +878,14 @@ GLuint loadSkyboxTexture() {
         "textures/skybox/back.jpg"
     };
 
-    int width, height, numChannels;
     for (GLuint i = 0; i < 6; ++i) {
-        unsigned char* data = stbi_load(skyboxFaces[i], &width, &height, &numChannels, 0);
-        if (data) {
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-            stbi_image_free(data);
+        // the sky is sampled without mipmaps, only the base level is kept
+        TextureData face = LoadTextureData(skyboxFaces[i], 0, TEXTURE_COLOR, false);
+        if (!face.Empty()) {
+            UploadTextureData(skyboxTexture, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, face);
         }
         else {
             std::cout << "Failed to load skybox texture: " << skyboxFaces[i] << std::endl;
-            stbi_image_free(data);
         }
     }
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -538,9 +945,10 @@ void createSkyboxGeometry(GLuint& VAO, GLuint& VBO) {
 
     glGenVertexArrays(1, &VAO);
     glGenBuffers(1, &VBO);
-    glBindVertexArray(VAO);
+    glState.BindVertexArray(VAO);
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
+    gpuMemory.Track(GPU_BUFFER, VBO, MEMORY_SKYBOX, "skybox vertices");
+    TrackedBufferData(GL_ARRAY_BUFFER, VBO, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
 }
@@ -612,16 +1020,18 @@ void createGeometry(GLuint& VAO, GLuint& EBO, int& size, int& numIndices) {
     numIndices = sizeof(indices) / sizeof(int);
 
     glGenVertexArrays(1, &VAO);
-    glBindVertexArray(VAO);
+    glState.BindVertexArray(VAO);
 
     GLuint VBO;
     glGenBuffers(1, &VBO);
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    gpuMemory.Track(GPU_BUFFER, VBO, MEMORY_MODELS, "box vertices");
+    TrackedBufferData(GL_ARRAY_BUFFER, VBO, sizeof(vertices), vertices, GL_STATIC_DRAW);
 
     glGenBuffers(1, &EBO);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+    gpuMemory.Track(GPU_BUFFER, EBO, MEMORY_MODELS, "box indices");
+    TrackedBufferData(GL_ELEMENT_ARRAY_BUFFER, EBO, sizeof(indices), indices, GL_STATIC_DRAW);
 
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
     glEnableVertexAttribArray(0);
@@ -642,113 +1052,610 @@ void createGeometry(GLuint& VAO, GLuint& EBO, int& size, int& numIndices) {
     glEnableVertexAttribArray(5);
 }
 
-void renderSkybox(GLuint skyboxVAO, GLuint skyboxTex, glm::mat4 view, glm::mat4 projection) {
-    glDisable(GL_CULL_FACE);
-    glDisable(GL_DEPTH);
-    glDisable(GL_DEPTH_TEST);
+// the state every pass of the render queue starts from
+// the passes that write color blend additively in the overdraw view and not at all otherwise
+void setColorPassState() {
+    glState.ColorMask(true);
+    if (showOverdraw) {
+        glState.Enable(GL_BLEND);
+        glState.BlendFunc(GL_ONE, GL_ONE);
+    }
+    else
+        glState.Disable(GL_BLEND);
+}
 
-    glm::mat4 skyboxView = glm::mat4(glm::mat3(view));
-    glUseProgram(skyboxProgram);
-    glUniformMatrix4fv(glGetUniformLocation(skyboxProgram, "view"), 1, GL_FALSE, glm::value_ptr(skyboxView));
-    glUniformMatrix4fv(glGetUniformLocation(skyboxProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-    glBindVertexArray(skyboxVAO);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTex);
-    glDrawArrays(GL_TRIANGLES, 0, 36);
-    glBindVertexArray(0);
+void setupRenderPasses() {
+    depthQueue.SetPass(PASS_DEPTH, []() {
+        glState.ColorMask(false);
+        glState.Disable(GL_BLEND);
+        glState.Enable(GL_DEPTH_TEST);
+        glState.DepthFunc(GL_LESS);
+        glState.DepthMask(true);
+        glState.Enable(GL_CULL_FACE);
+        glState.CullFace(GL_BACK);
+    });
+    renderQueue.SetPass(PASS_BACKGROUND, []() {
+        setColorPassState();
+        glState.Disable(GL_CULL_FACE);
+        glState.Disable(GL_DEPTH_TEST);
+    });
+    renderQueue.SetPass(PASS_OPAQUE, []() {
+        setColorPassState();
+        glState.Enable(GL_DEPTH_TEST);
+        // after the prepass the depth buffer is final, only the closest fragment of every pixel is shaded
+        glState.DepthFunc(useDepthPrepass ? GL_EQUAL : GL_LESS);
+        glState.DepthMask(!useDepthPrepass);
+        glState.Enable(GL_CULL_FACE);
+        glState.CullFace(GL_BACK);
+    });
+    renderQueue.SetPass(PASS_SKY, []() {
+        setColorPassState();
+        glState.Disable(GL_CULL_FACE);
+        glState.Enable(GL_DEPTH_TEST);
+        // the sky is on the far plane, where the cleared depth is
+        glState.DepthFunc(GL_LEQUAL);
+        glState.DepthMask(false);
+    });
+}
 
-    glEnable(GL_CULL_FACE);
-    glEnable(GL_DEPTH);
+// counts the fragments the color passes shade. a query is read FRAGMENT_QUERY_COUNT frames after it was issued,
+// by then the GPU is done with it and reading it doesn't stall
+void beginFragmentQuery() {
+    if (fragmentQueries[0] == 0)
+        glGenQueries(FRAGMENT_QUERY_COUNT, fragmentQueries);
+
+    GLuint query = fragmentQueries[fragmentQueryFrame % FRAGMENT_QUERY_COUNT];
+    if (fragmentQueryFrame >= FRAGMENT_QUERY_COUNT) {
+        GLuint64 samples = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &samples);
+        fragmentsShaded += samples;
+        fragmentFrames++;
+    }
+    glBeginQuery(GL_SAMPLES_PASSED, query);
 }
 
-void renderTerrain() {
-    glEnable(GL_DEPTH);
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_BACK);
+void endFragmentQuery() {
+    glEndQuery(GL_SAMPLES_PASSED);
+    fragmentQueryFrame++;
+}
 
-    glUseProgram(terrainProgram);
+void renderSkybox(GLuint skyboxVAO, GLuint skyboxTex) {
+    // with the prepass the depth buffer is complete before the sky is drawn, so it can go last
+    RenderPass pass = useDepthPrepass ? PASS_SKY : PASS_BACKGROUND;
+    GLuint program = showOverdraw ? skyOverdrawProgram.id : skyboxProgram.id;
+    renderQueue.Submit(pass, program, skyboxTex, skyboxVAO, FAR_PLANE, [skyboxVAO, skyboxTex]() {
+        glState.BindVertexArray(skyboxVAO);
+        glState.BindTexture(0, GL_TEXTURE_CUBE_MAP, skyboxTex);
+        glDrawArrays(GL_TRIANGLES, 0, 36);
+    }, "sky");
+}
 
-    glm::mat4 world = glm::mat4(1.0f);
+void renderTerrain() {
+    // the close layers are only blended in near the camera, past that distance the far ones are enough
+    glm::vec3 closest = glm::clamp(cameraPosition, terrainBounds.min, terrainBounds.max);
+    float distance = glm::length(closest - cameraPosition);
+    ShaderProgram* terrainProgram = &terrainVariants.Get(distance >= TERRAIN_FAR_DISTANCE ? TERRAIN_VARIANT_FAR_ONLY : 0);
+    if (showOverdraw)
+        terrainProgram = &terrainOverdrawProgram;
+
+    if (useDepthPrepass) {
+        depthQueue.Submit(PASS_DEPTH, terrainDepthProgram.id, 0, terrainVAO, distance, []() {
+            terrainDepthProgram.SetMat4("world", glm::mat4(1.0f));
+            glState.BindVertexArray(terrainVAO);
+            glDrawElements(GL_TRIANGLES, terrainIndexCount, terrainIndexType, 0);
+        }, "terrain");
+    }
 
-    glUniformMatrix4fv(glGetUniformLocation(terrainProgram, "world"), 1, GL_FALSE, glm::value_ptr(world));
-    glUniformMatrix4fv(glGetUniformLocation(terrainProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(glGetUniformLocation(terrainProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+    GLuint textures[] = { heightmapID, heightNormalID, dirt, sand, grass, rock, snow };
+    renderQueue.Submit(PASS_OPAQUE, terrainProgram->id, RenderQueue::MaterialKey(textures, 7), terrainVAO, distance, [terrainProgram]() {
+        glm::mat4 world = glm::mat4(1.0f);
 
-    glUniform3fv(glGetUniformLocation(terrainProgram, "lightDirection"), 1, glm::value_ptr(lightPosition));
-    glUniform3fv(glGetUniformLocation(terrainProgram, "cameraPosition"), 1, glm::value_ptr(cameraPosition));
+        terrainProgram->SetMat4("world", world);
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, heightmapID);
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, heightNormalID);
+        glState.BindTexture(0, GL_TEXTURE_2D, heightmapID);
+        glState.BindTexture(1, GL_TEXTURE_2D, heightNormalID);
 
-    glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, dirt);
-    glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_2D, sand);
-    glActiveTexture(GL_TEXTURE4);
-    glBindTexture(GL_TEXTURE_2D, grass);
-    glActiveTexture(GL_TEXTURE5);
-    glBindTexture(GL_TEXTURE_2D, rock);
-    glActiveTexture(GL_TEXTURE6);
-    glBindTexture(GL_TEXTURE_2D, snow);
+        glState.BindTexture(2, GL_TEXTURE_2D, dirt);
+        glState.BindTexture(3, GL_TEXTURE_2D, sand);
+        glState.BindTexture(4, GL_TEXTURE_2D, grass);
+        glState.BindTexture(5, GL_TEXTURE_2D, rock);
+        glState.BindTexture(6, GL_TEXTURE_2D, snow);
 
 
-    glBindVertexArray(terrainVAO);
-    glDrawElements(GL_TRIANGLES, terrainIndexCount, GL_UNSIGNED_INT, 0);
+        glState.BindVertexArray(terrainVAO);
+        glDrawElements(GL_TRIANGLES, terrainIndexCount, terrainIndexType, 0);
+    }, "terrain");
+}
 
+void renderBox(GLuint cubeVAO, GLuint boxTex, GLuint boxNormal, glm::mat4 cubeModel, int& cubeNumIndices) {
+    glState.Enable(GL_DEPTH_TEST);
+    glState.Enable(GL_CULL_FACE);
+    glState.CullFace(GL_BACK);
 
-    glDisable(GL_DEPTH);
-    glDisable(GL_DEPTH_TEST);
-}
+    glState.UseProgram(simpleProgram.id);
+    simpleProgram.SetMat4("world", cubeModel);
 
-void renderBox(GLuint cubeVAO, GLuint boxTex, GLuint boxNormal, glm::mat4 cubeModel,  glm::mat4 view, glm::mat4 projection, int& cubeNumIndices) {
-    glEnable(GL_DEPTH);
+    glState.BindTexture(0, GL_TEXTURE_2D, boxTex);
+    glState.BindTexture(1, GL_TEXTURE_2D, boxNormal);
 
-    glUseProgram(simpleProgram);
-    glUniformMatrix4fv(glGetUniformLocation(simpleProgram, "world"), 1, GL_FALSE, glm::value_ptr(cubeModel));
-    glUniformMatrix4fv(glGetUniformLocation(simpleProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(glGetUniformLocation(simpleProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+    glState.BindVertexArray(cubeVAO);
 
-    glUniform3fv(glGetUniformLocation(simpleProgram, "lightPosition"), 1, glm::value_ptr(lightPosition));
-    glUniform3fv(glGetUniformLocation(simpleProgram, "cameraPosition"), 1, glm::value_ptr(cameraPosition));
+    glDrawElements(GL_TRIANGLES, cubeNumIndices, GL_UNSIGNED_INT, 0);
+}
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, boxTex);
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, boxNormal);
+// draws the textured parts of the scene into the residency feedback buffer
+void renderFeedback()
+{
+    glState.Enable(GL_CULL_FACE);
+    glState.CullFace(GL_BACK);
 
-    glBindVertexArray(cubeVAO);
+    textureResidency.BeginFeedback(feedbackProgram);
 
-    glDrawElements(GL_TRIANGLES, cubeNumIndices, GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
+    // the layers repeat 100 times over the terrain up close, the normal map covers it once
+    static const std::vector<float> terrainScales = { 100.0f, 100.0f, 100.0f, 100.0f, 100.0f, 1.0f };
+    textureResidency.SetWorld(glm::mat4(1.0f));
+    textureResidency.SetGroup(textureResidency.Group({ dirt, sand, grass, rock, snow, heightNormalID }, terrainScales));
+    glState.BindVertexArray(terrainVAO);
+    glDrawElements(GL_TRIANGLES, terrainIndexCount, terrainIndexType, 0);
 
-    glDisable(GL_DEPTH);
-    glDisable(GL_DEPTH_TEST);
+    // same placement as in the main loop
+    glm::mat4 backpackWorld = glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(100, 100, 100)), glm::vec3(10, 10, 10));
+    textureResidency.DrawModel(backpack, backpackWorld);
+
+    textureResidency.EndFeedback();
 }
 
 void renderModel(Model* model, glm::vec3 pos, glm::vec3 rot, glm::vec3 scale)
 {
-    glEnable(GL_DEPTH);
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_BACK);
-
-    glUseProgram(modelProgram);
+    // the packed program samples the material arrays, so the meshes don't bind textures of their own.
+    // the overdraw view doesn't sample anything and draws mesh by mesh
+    bool packed = usePackedMaterials && materialsPacked && model->ready && !showOverdraw;
+    // the loading proxy has no textures at all
+    ShaderProgram* program = packed ? &modelPackedProgram : &modelVariants.Get(0);
+    if (showOverdraw)
+        program = &modelOverdrawProgram;
 
     glm::mat4 world = glm::mat4(1.0f);
     world = glm::translate(world, pos);
     world = glm::scale(world, scale);
 
-    glUniformMatrix4fv(glGetUniformLocation(modelProgram, "world"), 1, GL_FALSE, glm::value_ptr(world));
-    glUniformMatrix4fv(glGetUniformLocation(modelProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(glGetUniformLocation(modelProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+    float distance = glm::length(pos - cameraPosition);
+    if (!model->ready) {
+        // still loading, draw a box where the model is going to be
+        glm::mat4 proxyWorld = world * modelLoader.ProxyTransform(model);
+        if (useDepthPrepass) {
+            depthQueue.Submit(PASS_DEPTH, modelDepthProgram.id, 0, 0, distance, [proxyWorld]() {
+                modelDepthProgram.SetMat4("world", proxyWorld);
+                modelLoader.DrawProxy();
+            }, "model");
+        }
+        renderQueue.Submit(PASS_OPAQUE, program->id, 0, 0, distance, [program, proxyWorld]() {
+            program->SetMat4("world", proxyWorld);
+            modelLoader.DrawProxy();
+        }, "model");
+        return;
+    }
+
+    // skip the meshes that are off screen, the frustum is built in the model's object space.
+    // the meshlet cones are tested against the camera in that space too
+    MeshletCuller* culler = useMeshletCulling ? &meshletCuller : nullptr;
+    glm::vec3 objectCamera = glm::vec3(glm::inverse(world) * glm::vec4(cameraPosition, 1.0f));
+    Frustum frustum(projection * view * world);
+    if (useDepthPrepass) {
+        auto depthLookup = [](unsigned int features) {
+            return modelDepthProgram.id;
+        };
+        auto depthSelect = [world](unsigned int features) {
+            modelDepthProgram.SetMat4("world", world);
+            return modelDepthProgram.id;
+        };
+        model->SubmitVariants(depthQueue, PASS_DEPTH, depthLookup, depthSelect, world, cameraPosition, frustum, culler, objectCamera);
+    }
+    if (packed) {
+        // the arrays hold every material, the whole model is one entry in the queue
+        renderQueue.Submit(PASS_OPAQUE, program->id, 0, 0, distance, [program, model, world, frustum, culler, objectCamera]() {
+            program->SetMat4("world", world);
+            materialPacker.Bind(*program);
+            model->DrawPacked(*program, frustum, culler, objectCamera);
+        }, "model");
+    }
+    else {
+        // every mesh gets the variant that samples only the maps its material has
+        auto lookup = [](unsigned int features) {
+            return showOverdraw ? modelOverdrawProgram.id : modelVariants.Get(features).id;
+        };
+        auto select = [world](unsigned int features) {
+            ShaderProgram& variant = showOverdraw ? modelOverdrawProgram : modelVariants.Get(features);
+            variant.SetMat4("world", world);
+            return variant.id;
+        };
+        model->SubmitVariants(renderQueue, PASS_OPAQUE, lookup, select, world, cameraPosition, frustum, culler, objectCamera);
+    }
+}
+
+void renderModelInstanced(Model* model, const std::vector<glm::mat4>& transforms, InstanceBuffer& instances)
+{
+    // cull whole instances in world space with the same batched sphere test the meshes use
+    static SphereList instanceSpheres;
+    static std::vector<unsigned char> instanceVisible;
+    static std::vector<glm::mat4> visibleTransforms;
+
+    instanceSpheres.Clear();
+    for (unsigned int i = 0; i < transforms.size(); i++) {
+        const glm::mat4& world = transforms[i];
+        float maxScale = std::max(glm::length(glm::vec3(world[0])), std::max(glm::length(glm::vec3(world[1])), glm::length(glm::vec3(world[2]))));
+
+        BoundingSphere sphere;
+        sphere.center = glm::vec3(world * glm::vec4(model->sphere.center, 1.0f));
+        sphere.radius = model->sphere.radius * maxScale;
+        instanceSpheres.Add(sphere);
+    }
+    CullSpheres(Frustum(projection * view), instanceSpheres, instanceVisible);
+
+    // the instances are sorted as a whole, by the closest one
+    visibleTransforms.clear();
+    float distance = FAR_PLANE;
+    for (unsigned int i = 0; i < transforms.size(); i++) {
+        if (instanceVisible[i]) {
+            visibleTransforms.push_back(transforms[i]);
+            distance = std::min(distance, glm::length(glm::vec3(instanceSpheres.x[i], instanceSpheres.y[i], instanceSpheres.z[i]) - cameraPosition));
+        }
+    }
+
+    // one upload for all instances, then one draw call per mesh
+    instances.Upload(visibleTransforms);
+
+    // the instances carry their own world matrix, there is nothing to set when the draw comes up
+    if (useDepthPrepass) {
+        auto depthLookup = [](unsigned int features) {
+            return instancedDepthProgram.id;
+        };
+        model->SubmitInstancedVariants(depthQueue, PASS_DEPTH, depthLookup, depthLookup, instances, distance);
+    }
+    auto lookup = [](unsigned int features) {
+        return showOverdraw ? instancedOverdrawProgram.id : modelInstancedVariants.Get(features).id;
+    };
+    model->SubmitInstancedVariants(renderQueue, PASS_OPAQUE, lookup, lookup, instances, distance);
+}
+
+void benchmarkSkinning(const char* path, int characterCount, int frameCount)
+{
+    // skinned characters can have any material, they use the variant that samples every map. nothing but
+    // this benchmark draws them, so the program is only built here
+    if (!createProgram(skinnedProgram, "shaders/skinned.vs", "shaders/model.fs", modelVariants.Defines(MATERIAL_HAS_SPECULAR | MATERIAL_HAS_ROUGHNESS | MATERIAL_HAS_AO))
+        || !shaderCompiler.Finish(&skinnedProgram)) {
+        std::cout << "Failed to build the skinning program" << std::endl;
+        return;
+    }
+    glState.UseProgram(skinnedProgram.id);
+    setMaterialSamplers(skinnedProgram);
+
+    Model character(path, false, true);
+    Animation animation(path, &character);
+
+    // a grid of characters, each one starting at a different point in the clip
+    std::vector<glm::mat4> worlds;
+    std::vector<float> times;
+    int gridSize = (int)ceil(sqrt((float)characterCount));
+    for (int i = 0; i < characterCount; i++) {
+        worlds.push_back(glm::translate(glm::mat4(1.0f), glm::vec3((i % gridSize) * 3.0f, 0.0f, (i / gridSize) * -3.0f)));
+        times.push_back(i * 0.137f);
+    }
+
+    std::vector<glm::mat4> palettes;
+    BonePaletteBuffer paletteBuffer;
+
+    GLuint timerQuery;
+    glGenQueries(1, &timerQuery);
+
+    glm::mat4 benchView = glm::lookAt(glm::vec3(gridSize * 1.5f, 40.0f, 30.0f), glm::vec3(gridSize * 1.5f, 0.0f, gridSize * -1.5f), glm::vec3(0, 1, 0));
+
+    glState.Enable(GL_DEPTH_TEST);
+    glState.Enable(GL_CULL_FACE);
+    glViewport(0, 0, WIDTH, HEIGHT);
+
+    double cpuTotal = 0.0, gpuTotal = 0.0;
+    for (int frame = 0; frame < frameCount; frame++) {
+        for (int i = 0; i < characterCount; i++)
+            times[i] += 1.0f / 60.0f;
+
+        auto cpuStart = std::chrono::high_resolution_clock::now();
+        EvaluatePoses(animation, times, palettes);
+        auto cpuEnd = std::chrono::high_resolution_clock::now();
+        cpuTotal += std::chrono::duration<double, std::milli>(cpuEnd - cpuStart).count();
+
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glBeginQuery(GL_TIME_ELAPSED, timerQuery);
+
+        paletteBuffer.Upload(palettes);
+
+        glState.UseProgram(skinnedProgram.id);
+        frameUniforms.Update(benchView, projection, cameraPosition, lightPosition);
+
+        for (int i = 0; i < characterCount; i++) {
+            paletteBuffer.Bind(i);
+            skinnedProgram.SetMat4("world", worlds[i]);
+            character.Draw();
+        }
+
+        glEndQuery(GL_TIME_ELAPSED);
+
+        // waiting on the query stalls, which is fine here since every frame is measured on its own
+        GLuint64 gpuTime;
+        glGetQueryObjectui64v(timerQuery, GL_QUERY_RESULT, &gpuTime);
+        gpuTotal += gpuTime / 1000000.0;
+    }
+
+    glDeleteQueries(1, &timerQuery);
+    glDeleteProgram(skinnedProgram.id);
+    skinnedProgram.Reflect(0);
+
+    std::cout << "Skinning benchmark: " << characterCount << " characters, " << character.boneCounter << " bones, " << frameCount << " frames" << std::endl;
+    std::cout << "  CPU pose evaluation: " << cpuTotal / frameCount << " ms/frame" << std::endl;
+    std::cout << "  GPU skinning + draw: " << gpuTotal / frameCount << " ms/frame" << std::endl;
+}
+
+void benchmarkMipmaps(const char* path, int runs)
+{
+    int width, height, channels;
+    unsigned char* pixels = stbi_load(path, &width, &height, &channels, 4);
+    if (!pixels) {
+        std::cout << "Failed to load " << path << std::endl;
+        return;
+    }
+
+    const char* filterNames[] = { "box", "kaiser" };
+    std::cout << "Mipmap benchmark: " << width << "x" << height << ", " << std::thread::hardware_concurrency() << " threads, " << runs << " runs" << std::endl;
+
+    for (int filter = MIP_FILTER_BOX; filter <= MIP_FILTER_KAISER; filter++) {
+        double total = 0.0;
+        for (int run = 0; run < runs; run++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            std::vector<MipLevel> levels = GenerateMipmaps(pixels, width, height, 4, MIP_SRGB, (MipFilter)filter);
+            total += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        }
+        std::cout << "  CPU " << filterNames[filter] << " (linear light): " << total / runs << " ms" << std::endl;
+    }
+
+    // the base level is uploaded outside the timing, glFinish makes sure the driver really did the work
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glState.BindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    glFinish();
+
+    double total = 0.0;
+    for (int run = 0; run < runs; run++) {
+        auto start = std::chrono::high_resolution_clock::now();
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glFinish();
+        total += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+    std::cout << "  glGenerateMipmap (" << glGetString(GL_RENDERER) << "): " << total / runs << " ms" << std::endl;
+
+    glDeleteTextures(1, &texture);
+    glState.TextureDeleted(texture);
+    stbi_image_free(pixels);
+}
+
+// deletes a vertex array together with its index buffer and the vertex buffer of attribute 0,
+// for the geometry created here that doesn't keep its buffer names around
+void releaseVertexArray(GLuint& VAO) {
+    if (VAO == 0)
+        return;
+
+    GLint vertexBuffer = 0, indexBuffer = 0;
+    glState.BindVertexArray(VAO);
+    glGetVertexAttribiv(0, GL_VERTEX_ATTRIB_ARRAY_BUFFER_BINDING, &vertexBuffer);
+    glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &indexBuffer);
+    glState.BindVertexArray(0);
+    glDeleteVertexArrays(1, &VAO);
+    VAO = 0;
+
+    GLuint buffers[] = { (GLuint)vertexBuffer, (GLuint)indexBuffer };
+    for (GLuint buffer : buffers)
+        DeleteTrackedBuffer(buffer);
+}
+
+// prints the GPU time of the frame and of every scope in it, averaged and the 95th percentile
+void reportGpuTimes() {
+    std::vector<std::string> names = gpuProfiler.Names();
+    if (names.empty())
+        return;
+    std::cout << "GPU time (average / 95th percentile), " << gpuProfiler.dropped << " frames dropped:" << std::endl;
+    for (unsigned int i = 0; i < names.size(); i++)
+        std::cout << "  " << names[i] << ": " << gpuProfiler.Average(names[i]) << " / " << gpuProfiler.Percentile(names[i], 95.0) << " ms" << std::endl;
+}
+
+// prints the video memory use per subsystem and writes the full breakdown to gpu_memory.json
+void reportGpuMemory() {
+    std::cout << "GPU memory (used / peak):" << std::endl;
+    for (int i = 0; i < MEMORY_CATEGORY_COUNT; i++) {
+        MemoryCategory category = (MemoryCategory)i;
+        std::cout << "  " << MemoryCategoryName(category) << ": " << gpuMemory.Used(category) / 1024 << " KB / " << gpuMemory.Peak(category) / 1024 << " KB" << std::endl;
+    }
+    std::cout << "  total: " << gpuMemory.TotalUsed() / 1024 << " KB / " << gpuMemory.TotalPeak() / 1024 << " KB" << std::endl;
+
+    if (!gpuMemory.DumpJson("gpu_memory.json"))
+        std::cout << "Failed to write gpu_memory.json" << std::endl;
+}
+
+// the backpack and the terrain drawn into an offscreen target once with the index types ChooseIndexType picked
+// and once with 32 bit indices everywhere, the pixels have to match exactly. then the 16 bit limits are checked.
+bool testIndices() {
+    bool passed = true;
+
+    // 65536 vertices is the most 16 bit indices can address, the last index being 65535
+    const size_t vertexCounts[] = { 65535, 65536, 65537 };
+    const GLenum expectedTypes[] = { GL_UNSIGNED_SHORT, GL_UNSIGNED_SHORT, GL_UNSIGNED_INT };
+    for (int i = 0; i < 3; i++) {
+        if (ChooseIndexType(vertexCounts[i]) != expectedTypes[i]) {
+            std::cout << "FAIL: " << vertexCounts[i] << " vertices get the wrong index type" << std::endl;
+            passed = false;
+        }
+    }
+
+    // narrowing has to keep the largest 16 bit index intact. the element buffer binding needs a vertex array
+    GLuint limitVAO, limitEBO;
+    glGenVertexArrays(1, &limitVAO);
+    glGenBuffers(1, &limitEBO);
+    glState.BindVertexArray(limitVAO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, limitEBO);
+    const unsigned int wide[] = { 0, 1, 65534, 65535 };
+    unsigned short narrow[4] = {};
+    UploadIndexBuffer(limitEBO, wide, 4, GL_UNSIGNED_SHORT);
+    glGetBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, sizeof(narrow), narrow);
+    for (int i = 0; i < 4; i++) {
+        if (narrow[i] != wide[i]) {
+            std::cout << "FAIL: index " << wide[i] << " came back as " << narrow[i] << " after narrowing" << std::endl;
+            passed = false;
+        }
+    }
+    glState.BindVertexArray(0);
+    glState.VertexArrayDeleted(limitVAO);
+    glDeleteVertexArrays(1, &limitVAO);
+    DeleteTrackedBuffer(limitEBO);
+
+    // the scene. the streamer isn't updated in between, so both renders sample the same texture levels
+    Model model(backpackPath, false, true);
+    loadTerrainTextures();
+    GLuint terrains[2], terrainHeightmaps[2], terrainCounts[2];
+    GLenum terrainTypes[2];
+    for (int i = 0; i < 2; i++) {
+        terrains[i] = GeneratePlane("textures/heightMap.png", heightmapTexture, 4, 100.0f, 5.0f, terrainCounts[i], terrainTypes[i], terrainHeightmaps[i], terrainBounds, i == 1);
+        delete[] heightmapTexture;
+        heightmapTexture = nullptr;
+    }
+
+    GLuint FBO, colorBuffer, depthBuffer;
+    glGenFramebuffers(1, &FBO);
+    glGenRenderbuffers(1, &colorBuffer);
+    glGenRenderbuffers(1, &depthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, WIDTH, HEIGHT);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, WIDTH, HEIGHT);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+    glViewport(0, 0, WIDTH, HEIGHT);
+
+    // looking down at the backpack with the terrain behind it
+    glm::vec3 testCamera(250.0f, 220.0f, 250.0f);
+    glm::mat4 testView = glm::lookAt(testCamera, glm::vec3(100.0f, 100.0f, 100.0f), glm::vec3(0, 1, 0));
+    frameUniforms.Update(testView, projection, testCamera, lightPosition);
+    glm::mat4 backpackWorld = glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(100, 100, 100)), glm::vec3(10, 10, 10));
+
+    std::vector<unsigned char> images[2];
+    for (int pass = 0; pass < 2; pass++) {
+        // the second pass widens every index buffer to 32 bit
+        unsigned int narrowMeshes = 0;
+        for (unsigned int i = 0; i < model.meshes.size(); i++) {
+            Mesh& mesh = model.meshes[i];
+            if (ChooseIndexType(mesh.vertices.size()) == GL_UNSIGNED_SHORT)
+                narrowMeshes++;
+            mesh.SetIndexType(pass == 0 ? ChooseIndexType(mesh.vertices.size()) : GL_UNSIGNED_INT);
+        }
+        if (pass == 0)
+            std::cout << "Index test: " << narrowMeshes << " of " << model.meshes.size() << " backpack meshes and "
+                      << (terrainTypes[0] == GL_UNSIGNED_SHORT ? "the" : "not the") << " terrain use 16 bit indices" << std::endl;
+
+        glState.ColorMask(true);
+        glState.DepthMask(true);
+        glState.Enable(GL_DEPTH_TEST);
+        glState.DepthFunc(GL_LESS);
+        glState.Enable(GL_CULL_FACE);
+        glState.CullFace(GL_BACK);
+        glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    glUniform3fv(glGetUniformLocation(modelProgram, "lightDirection"), 1, glm::value_ptr(lightPosition));
-    glUniform3fv(glGetUniformLocation(modelProgram, "cameraPosition"), 1, glm::value_ptr(cameraPosition));
+        ShaderProgram& terrainProgram = terrainVariants.Get(0);
+        glState.UseProgram(terrainProgram.id);
+        terrainProgram.SetMat4("world", glm::mat4(1.0f));
+        GLuint terrainTextures[] = { terrainHeightmaps[pass], heightNormalID, dirt, sand, grass, rock, snow };
+        for (int unit = 0; unit < 7; unit++)
+            glState.BindTexture(unit, GL_TEXTURE_2D, terrainTextures[unit]);
+        glState.BindVertexArray(terrains[pass]);
+        glDrawElements(GL_TRIANGLES, terrainCounts[pass], terrainTypes[pass], 0);
+
+        auto select = [backpackWorld](unsigned int features) {
+            ShaderProgram& variant = modelVariants.Get(features);
+            glState.UseProgram(variant.id);
+            variant.SetMat4("world", backpackWorld);
+            return variant.id;
+        };
+        model.DrawVariants(select, Frustum(projection * testView * backpackWorld));
+
+        images[pass].resize((size_t)WIDTH * HEIGHT * 4);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, &images[pass][0]);
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    }
+
+    unsigned int different = 0;
+    for (size_t i = 0; i < (size_t)WIDTH * HEIGHT; i++) {
+        if (memcmp(&images[0][i * 4], &images[1][i * 4], 4) != 0)
+            different++;
+    }
+    if (different > 0) {
+        std::cout << "FAIL: " << different << " of " << WIDTH * HEIGHT << " pixels differ between 16 and 32 bit indices" << std::endl;
+        passed = false;
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &FBO);
+    glDeleteRenderbuffers(1, &colorBuffer);
+    glDeleteRenderbuffers(1, &depthBuffer);
+    model.Release();
+    for (int i = 0; i < 2; i++) {
+        releaseVertexArray(terrains[i]);
+        DeleteTrackedTexture(terrainHeightmaps[i]);
+    }
+    GLuint streamed[] = { heightNormalID, dirt, snow, sand, rock, grass };
+    for (GLuint texture : streamed)
+        textureStreamer.Release(texture);
 
+    std::cout << (passed ? "Index test passed" : "Index test failed") << std::endl;
+    return passed;
+}
 
+// creates every program twice: from source (cold, which also fills the cache) and from the cache (warm)
+void benchmarkPrograms() {
+    if (!programCache.Available()) {
+        std::cout << "The driver has no program binaries, every run compiles from source" << std::endl;
+        return;
+    }
 
-    model->Draw(modelProgram);
-}
\ No newline at end of file
+    ShaderProgram* programs[] = { &skyboxProgram, &simpleProgram, &feedbackProgram, &modelPackedProgram,
+                                  &terrainDepthProgram, &modelDepthProgram, &instancedDepthProgram,
+                                  &skyOverdrawProgram, &terrainOverdrawProgram, &modelOverdrawProgram, &instancedOverdrawProgram };
+    const char* names[] = { "cold (compiled from source)", "warm (restored from the cache)" };
+    for (int run = 0; run < 2; run++) {
+        useProgramCache = run == 1;
+        programCache.hits = programCache.misses = 0;
+
+        auto start = std::chrono::high_resolution_clock::now();
+        createShaders();
+        setupShaders();
+        // every variant, as if the draws had asked for all of them
+        for (unsigned int features = 0; features < 8; features++) {
+            modelVariants.Get(features);
+            modelInstancedVariants.Get(features);
+        }
+        terrainVariants.Get(0);
+        terrainVariants.Get(TERRAIN_VARIANT_FAR_ONLY);
+        glFinish();
+        double time = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        std::cout << "Programs " << names[run] << ": " << time << " ms, " << programCache.hits << " from the cache, " << programCache.misses << " compiled" << std::endl;
+
+        for (ShaderProgram* program : programs) {
+            glDeleteProgram(program->id);
+            program->Reflect(0);
+        }
+        terrainVariants.Release();
+        modelVariants.Release();
+        modelInstancedVariants.Release();
+    }
+    useProgramCache = true;
+}
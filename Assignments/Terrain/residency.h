@@ -0,0 +1,325 @@
+#ifndef RESIDENCY_H
+#define RESIDENCY_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "../Common/glstate.h"
+#include "../Common/model.h"
+#include "../Common/shaderprogram.h"
+#include "../Common/texstream.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <map>
+#include <vector>
+using namespace std;
+
+// decides which mip levels of the streamed textures have to be in video memory.
+// every few frames the scene is drawn into a small feedback buffer that stores, per pixel, which group
+// of textures is visible there and how fine a level it needs. the buffer is read back through a pixel
+// buffer and a fence, so the CPU only looks at it once the GPU is done and never waits.
+// the result sets the wanted level of every texture in the streamer, trimmed to fit a video memory budget.
+class TextureResidency {
+public:
+    // bytes the streamed textures may take in video memory
+    size_t budget;
+    // levels this size or smaller always stay resident, they cost little and avoid blurry pop in when turning
+    int minimumResidentSize;
+    // feedback is rendered every this many frames
+    int feedbackInterval;
+
+    TextureResidency(TextureStreamer* streamer, int screenWidth, int screenHeight, int downscale = 8)
+        : budget(256 * 1024 * 1024), minimumResidentSize(128), feedbackInterval(8), streamer(streamer),
+          width(std::max(1, screenWidth / downscale)), height(std::max(1, screenHeight / downscale)),
+          lodBias(-log2((float)downscale)), FBO(0), colorBuffer(0), depthBuffer(0), PBO(0), fence(0), feedbackProgram(nullptr), frame(0)
+    {
+        groups.push_back(TextureGroup()); // group 0 is "nothing drawn here"
+    }
+
+    // deletes the feedback targets, has to happen while the GL context is still there
+    void Release()
+    {
+        if (fence)
+            glDeleteSync(fence);
+        fence = 0;
+        if (FBO)
+            glDeleteFramebuffers(1, &FBO);
+        FBO = 0;
+        DeleteTrackedRenderbuffer(colorBuffer);
+        DeleteTrackedRenderbuffer(depthBuffer);
+        DeleteTrackedBuffer(PBO);
+    }
+
+    // a set of textures sampled by one draw. uvScales holds how often each texture repeats over the
+    // vertex uvs (the terrain tiles its layers 100 times), or is empty when all of them use the uvs as they are.
+    unsigned int Group(const vector<GLuint>& textures, const vector<float>& uvScales = vector<float>())
+    {
+        map<vector<GLuint>, unsigned int>::iterator it = groupIds.find(textures);
+        if (it != groupIds.end())
+            return it->second;
+
+        TextureGroup group;
+        group.textures = textures;
+        group.uvScales = uvScales;
+        group.uvScales.resize(textures.size(), 1.0f);
+
+        unsigned int id = (unsigned int)groups.size();
+        groups.push_back(group);
+        groupIds[textures] = id;
+        return id;
+    }
+
+    // true on the frames the scene should be drawn into the feedback buffer
+    bool WantsFeedback() const
+    {
+        return fence == 0 && frame % feedbackInterval == 0;
+    }
+
+    // binds the feedback buffer and program, the scene is then drawn with SetGroup/SetWorld or DrawModel.
+    // the camera comes from the frame uniforms, they have to be updated for the frame first
+    void BeginFeedback(ShaderProgram& program)
+    {
+        if (FBO == 0)
+            createTargets();
+
+        feedbackProgram = &program;
+        glGetIntegerv(GL_VIEWPORT, previousViewport);
+        depthTestWasEnabled = glState.IsEnabled(GL_DEPTH_TEST);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glViewport(0, 0, width, height);
+        // the passes of the last frame can leave writes masked off, blending on or another depth function
+        glState.ColorMask(true);
+        glState.DepthMask(true);
+        glState.Disable(GL_BLEND);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glState.Enable(GL_DEPTH_TEST);
+        glState.DepthFunc(GL_LESS);
+
+        glState.UseProgram(program.id);
+        program.SetFloat("lodBias", lodBias);
+    }
+
+    void SetWorld(const glm::mat4& world)
+    {
+        feedbackProgram->SetMat4("world", world);
+    }
+
+    void SetGroup(unsigned int group)
+    {
+        feedbackProgram->SetFloat("group", (float)group);
+    }
+
+    // draws every mesh of a loaded model with the group of the textures it binds. meshes whose textures
+    // were released for the packed material arrays still hide what is behind them, but want no levels
+    void DrawModel(Model* model, const glm::mat4& world)
+    {
+        if (!model->ready)
+            return;
+
+        SetWorld(world);
+        for (unsigned int i = 0; i < model->meshes.size(); i++)
+        {
+            vector<GLuint> textures;
+            for (unsigned int j = 0; j < model->meshes[i].textures.size(); j++)
+            {
+                if (model->meshes[i].textures[j].id != 0)
+                    textures.push_back(model->meshes[i].textures[j].id);
+            }
+
+            SetGroup(textures.empty() ? 0 : Group(textures));
+            model->meshes[i].DrawGeometry();
+        }
+    }
+
+    // starts the asynchronous read back and restores the default framebuffer
+    void EndFeedback()
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, PBO);
+        glReadPixels(0, 0, width, height, GL_RG, GL_FLOAT, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+        if (!depthTestWasEnabled)
+            glState.Disable(GL_DEPTH_TEST);
+    }
+
+    // call once per frame. picks up a finished read back, if there is one, and updates the wanted levels
+    void Update()
+    {
+        frame++;
+        if (fence == 0)
+            return;
+
+        GLenum status = glClientWaitSync(fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            return;
+        glDeleteSync(fence);
+        fence = 0;
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, PBO);
+        const float* pixels = (const float*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (size_t)width * height * 2 * sizeof(float), GL_MAP_READ_BIT);
+        if (pixels)
+        {
+            // finest uv lod seen for every group, in levels of a texture that covers the uvs once with one texel
+            vector<float> groupLod(groups.size(), FLT_MAX);
+            for (int i = 0; i < width * height; i++)
+            {
+                unsigned int group = (unsigned int)(pixels[i * 2] + 0.5f);
+                if (group > 0 && group < groups.size())
+                    groupLod[group] = std::min(groupLod[group], pixels[i * 2 + 1]);
+            }
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            applyFeedback(groupLod);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+private:
+    struct TextureGroup {
+        vector<GLuint> textures;
+        vector<float> uvScales;
+    };
+
+    TextureStreamer* streamer;
+    vector<TextureGroup> groups;
+    map<vector<GLuint>, unsigned int> groupIds;
+    // last wanted level of every texture, relaxes one level per round while the texture isn't seen
+    map<GLuint, int> wanted;
+
+    int width, height;
+    float lodBias;
+    GLuint FBO, colorBuffer, depthBuffer, PBO;
+    GLsync fence;
+    ShaderProgram* feedbackProgram;
+    GLint previousViewport[4];
+    bool depthTestWasEnabled;
+    unsigned int frame;
+
+    void createTargets()
+    {
+        glGenFramebuffers(1, &FBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+
+        // red: group id, green: uv lod
+        glGenRenderbuffers(1, &colorBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RG32F, width, height);
+        gpuMemory.Track(GPU_RENDERBUFFER, colorBuffer, MEMORY_OTHER, "residency feedback color");
+        gpuMemory.SetImage(GPU_RENDERBUFFER, colorBuffer, 0, TextureImageBytes(GL_RG32F, width, height));
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+
+        glGenRenderbuffers(1, &depthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        gpuMemory.Track(GPU_RENDERBUFFER, depthBuffer, MEMORY_OTHER, "residency feedback depth");
+        gpuMemory.SetImage(GPU_RENDERBUFFER, depthBuffer, 0, TextureImageBytes(GL_DEPTH_COMPONENT24, width, height));
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::RESIDENCY:: feedback framebuffer is incomplete" << std::endl;
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        glGenBuffers(1, &PBO);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, PBO);
+        gpuMemory.Track(GPU_BUFFER, PBO, MEMORY_OTHER, "residency read back");
+        TrackedBufferData(GL_PIXEL_PACK_BUFFER, PBO, (size_t)width * height * 2 * sizeof(float), nullptr, GL_STREAM_READ);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    // coarsest level a texture can be dropped to
+    int coarsestLevel(const TextureData& data) const
+    {
+        int level = 0;
+        while (level < data.levelCount - 1 && (data.levels[level].width > minimumResidentSize || data.levels[level].height > minimumResidentSize))
+            level++;
+        return level;
+    }
+
+    void applyFeedback(const vector<float>& groupLod)
+    {
+        // textures that weren't seen step one level coarser per round instead of being dropped at once,
+        // ones that were never seen at all only keep their small levels
+        for (map<GLuint, int>::iterator it = wanted.begin(); it != wanted.end(); ++it)
+            it->second++;
+        vector<GLuint> textures = streamer->Textures();
+        for (unsigned int i = 0; i < textures.size(); i++)
+        {
+            if (wanted.find(textures[i]) == wanted.end())
+                wanted[textures[i]] = INT_MAX;
+        }
+
+        for (unsigned int g = 1; g < groups.size(); g++)
+        {
+            if (groupLod[g] == FLT_MAX)
+                continue;
+
+            for (unsigned int t = 0; t < groups[g].textures.size(); t++)
+            {
+                const TextureData* data = streamer->Data(groups[g].textures[t]);
+                if (!data)
+                    continue;
+
+                float size = (float)std::max(data->levels[0].width, data->levels[0].height) * groups[g].uvScales[t];
+                int level = (int)floor(std::max(groupLod[g] + log2(size), -1.0f));
+                map<GLuint, int>::iterator it = wanted.find(groups[g].textures[t]);
+                if (it == wanted.end() || level < it->second)
+                    wanted[groups[g].textures[t]] = level;
+            }
+        }
+
+        // clamp to the valid range and add up what the wanted levels would cost
+        size_t total = 0;
+        for (map<GLuint, int>::iterator it = wanted.begin(); it != wanted.end(); ++it)
+        {
+            const TextureData* data = streamer->Data(it->first);
+            if (!data)
+                continue;
+            it->second = std::min(std::max(it->second, 0), coarsestLevel(*data));
+            total += residentSize(*data, it->second);
+        }
+
+        // over budget: keep taking the finest level of the texture with the largest one until it fits
+        while (total > budget)
+        {
+            map<GLuint, int>::iterator largest = wanted.end();
+            size_t largestSize = 0;
+            for (map<GLuint, int>::iterator it = wanted.begin(); it != wanted.end(); ++it)
+            {
+                const TextureData* data = streamer->Data(it->first);
+                if (!data || it->second >= coarsestLevel(*data))
+                    continue;
+                if (data->levels[it->second].size > largestSize)
+                {
+                    largestSize = data->levels[it->second].size;
+                    largest = it;
+                }
+            }
+            if (largest == wanted.end())
+                break;
+
+            total -= largestSize;
+            largest->second++;
+        }
+
+        for (map<GLuint, int>::iterator it = wanted.begin(); it != wanted.end(); ++it)
+            streamer->SetWantedLevel(it->first, it->second);
+    }
+
+    static size_t residentSize(const TextureData& data, int level)
+    {
+        size_t size = 0;
+        for (int i = level; i < data.levelCount; i++)
+            size += data.levels[i].size;
+        return size;
+    }
+};
+#endif
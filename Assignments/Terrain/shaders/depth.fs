@@ -0,0 +1,6 @@
+#version 330 core
+
+// the depth prepass only writes depth, the color writes are masked off
+void main()
+{
+}
@@ -0,0 +1,19 @@
+#version 330 core
+layout(location = 0) out vec2 Feedback;
+
+in vec2 TexCoords;
+
+// id of the texture group this draw samples
+uniform float group;
+// the feedback buffer is smaller than the screen, so its uv derivatives are larger by the same factor
+uniform float lodBias;
+
+void main()
+{
+    // mip level a texture of 1x1 texels over the uvs would need, the CPU adds log2 of the real size
+    vec2 dx = dFdx(TexCoords);
+    vec2 dy = dFdy(TexCoords);
+    float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-20)) + lodBias;
+
+    Feedback = vec2(group, lod);
+}
@@ -0,0 +1,7 @@
+// camera and light of the frame, shared by every program (FrameUniformBuffer in frameuniforms.h)
+layout(std140) uniform FrameUniforms {
+    mat4 view;
+    mat4 projection;
+    vec3 cameraPosition;
+    vec3 lightDirection;
+};
@@ -8,8 +8,10 @@ out vec3 Normals;
 out vec4 FragPos;
 
 uniform mat4 world;
-uniform mat4 view;
-uniform mat4 projection;
+#include "frame.glsl"
+
+// the depth prepass runs this shader too, both have to come up with the exact same depth for GL_EQUAL
+invariant gl_Position;
 
 void main()
 {
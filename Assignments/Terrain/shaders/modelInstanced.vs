@@ -0,0 +1,27 @@
+#version 330 core
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec3 aNormal;
+layout(location = 2) in vec2 aTexCoords;
+
+// per instance, filled from the InstanceBuffer
+layout(location = 7) in mat4 instanceWorld;
+layout(location = 11) in mat3 instanceNormalMatrix;
+
+out vec2 TexCoords;
+out vec3 Normals;
+out vec4 FragPos;
+
+#include "frame.glsl"
+
+// the depth prepass runs this shader too, both have to come up with the exact same depth for GL_EQUAL
+invariant gl_Position;
+
+void main()
+{
+    TexCoords = aTexCoords;
+    FragPos = instanceWorld * vec4(aPos, 1.0);
+    gl_Position = projection * view * FragPos;
+
+    // the normal matrix is precomputed per instance on the CPU
+    Normals = normalize(instanceNormalMatrix * aNormal);
+}
@@ -0,0 +1,45 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+in vec3 Normals;
+in vec4 FragPos;
+
+// every material texture of the scene lives in one of these arrays
+uniform sampler2DArray materialArrays[8];
+// array and layer of the diffuse, specular, normal, roughness and ao texture, array -1 when there is none
+uniform ivec2 material[5];
+
+#include "frame.glsl"
+#include "lighting.glsl"
+
+// sampler arrays can only be indexed with constants in glsl 3.30, hence the switch
+vec4 sampleArray(int array, vec3 coords) {
+    switch (array) {
+    case 0: return texture(materialArrays[0], coords);
+    case 1: return texture(materialArrays[1], coords);
+    case 2: return texture(materialArrays[2], coords);
+    case 3: return texture(materialArrays[3], coords);
+    case 4: return texture(materialArrays[4], coords);
+    case 5: return texture(materialArrays[5], coords);
+    case 6: return texture(materialArrays[6], coords);
+    case 7: return texture(materialArrays[7], coords);
+    }
+    return vec4(0.0);
+}
+
+vec4 sampleMaterial(int slot, vec4 fallback) {
+    if (material[slot].x < 0)
+        return fallback;
+    return sampleArray(material[slot].x, vec3(TexCoords, material[slot].y));
+}
+
+void main()
+{
+    vec4 diffuse = sampleMaterial(0, vec4(1.0));
+    vec4 specTex = sampleMaterial(1, vec4(0.0));
+    float ambientOcclusion = sampleMaterial(4, vec4(1.0)).r;
+    float roughness = sampleMaterial(3, vec4(0.5)).r;
+
+    FragColor = shadeModel(diffuse, specTex.rgb, roughness, ambientOcclusion, Normals, FragPos.rgb);
+}
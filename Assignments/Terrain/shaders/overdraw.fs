@@ -0,0 +1,9 @@
+#version 330 core
+out vec4 FragColor;
+
+// blended additively, every fragment shaded on a pixel makes it brighter.
+// one layer is dark red, ten are orange and from twenty on the pixel is close to white
+void main()
+{
+    FragColor = vec4(0.1, 0.05, 0.025, 1.0);
+}
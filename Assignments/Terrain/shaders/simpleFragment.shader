@@ -9,15 +9,15 @@ in vec3 worldPosition;
 uniform sampler2D mainTex;
 uniform sampler2D normalTex;
 
-uniform vec3 lightPosition;
-uniform vec3 cameraPosition;
+#include "frame.glsl"
 
 void main()
 {
 
-	//normal map
-	vec3 normal = texture(normalTex, uv).rgb;
-	normal = normalize(normal * 2.0 - 1.0);
+	//normal map, only x and y are stored (BC5) so z is rebuilt
+	vec3 normal;
+	normal.xy = texture(normalTex, uv).rg * 2.0 - 1.0;
+	normal.z = sqrt(max(1.0 - dot(normal.xy, normal.xy), 0.0));
 	//scale down
 	normal.rg = normal.rg * 0.75;
 	normal = normalize(normal);
@@ -25,14 +25,14 @@ void main()
 	normal = tbn * normal;
 
 
-	vec3 lightDirection = normalize(worldPosition - lightPosition);
+	vec3 lightDir = normalize(worldPosition - lightDirection);
 
 	//specular data
 	vec3 viewDir = normalize(worldPosition - cameraPosition);
-	vec3 reflDir = normalize(reflect(lightDirection, normal));
+	vec3 reflDir = normalize(reflect(lightDir, normal));
 
 	//lighting
-	float lightValue = max(-dot(normal, lightDirection), 0.0);
+	float lightValue = max(-dot(normal, lightDir), 0.0);
 	float specular = pow(max(-dot(reflDir, viewDir), 0.0), 32);
 
 	float ambientStrength = 0.4;
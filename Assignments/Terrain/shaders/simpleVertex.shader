@@ -11,7 +11,9 @@ out vec2 uv;
 out mat3 tbn;
 out vec3 worldPosition;
 
-uniform mat4 world, view, projection;
+uniform mat4 world;
+
+#include "frame.glsl"
 
 void main()
 {
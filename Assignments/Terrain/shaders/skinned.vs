@@ -0,0 +1,44 @@
+#version 330 core
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec3 aNormal;
+layout(location = 2) in vec2 aTexCoords;
+layout(location = 5) in ivec4 aBoneIDs;
+layout(location = 6) in vec4 aWeights;
+
+out vec2 TexCoords;
+out vec3 Normals;
+out vec4 FragPos;
+
+#define MAX_BONES 100
+
+// one palette per instance, bound with glBindBufferRange before the instance is drawn
+layout(std140) uniform BonePalette {
+    mat4 bones[MAX_BONES];
+};
+
+uniform mat4 world;
+#include "frame.glsl"
+
+void main()
+{
+    mat4 skin = mat4(0.0);
+    float totalWeight = 0.0;
+    for (int i = 0; i < 4; i++)
+    {
+        if (aBoneIDs[i] < 0 || aBoneIDs[i] >= MAX_BONES)
+            continue;
+        skin += bones[aBoneIDs[i]] * aWeights[i];
+        totalWeight += aWeights[i];
+    }
+    // vertices without bones stay where they are
+    if (totalWeight == 0.0)
+        skin = mat4(1.0);
+
+    TexCoords = aTexCoords;
+    FragPos = world * skin * vec4(aPos, 1.0);
+    gl_Position = projection * view * FragPos;
+
+    // the bones and the world matrix only scale uniformly, so their upper 3x3 keeps normals perpendicular
+    // to the surface and normalizing takes the scale out again, no inverse transpose needed
+    Normals = normalize(mat3(world * skin) * aNormal);
+}
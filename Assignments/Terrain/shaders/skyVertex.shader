@@ -3,11 +3,13 @@ layout (location = 0) in vec3 aPos;
 
 out vec3 TexCoords;
 
-uniform mat4 projection;
-uniform mat4 view;
+#include "frame.glsl"
 
 void main()
 {
     TexCoords = aPos;
-    gl_Position = projection * view * vec4(aPos, 1.0);
+    // only the rotation of the camera, the sky stays around it wherever it goes
+    vec4 position = projection * mat4(mat3(view)) * vec4(aPos, 1.0);
+    // z = w puts it on the far plane, drawn last with GL_LEQUAL it only shades what nothing else covered
+    gl_Position = position.xyww;
 }
\ No newline at end of file
@@ -9,8 +9,7 @@ uniform sampler2D normalTex;
 
 uniform sampler2D dirt, sand, grass, rock, snow;
 
-uniform vec3 lightDirection;
-uniform vec3 cameraPosition;
+#include "frame.glsl"
 
 vec3 lerp(vec3 a, vec3 b, float t) {
 	return a + (b - a) * t;
@@ -23,9 +22,11 @@ vec2 lerp(vec2 a, vec2 b, float t) {
 void main()
 {
 
-	//normal map
-	vec3 normal = texture(normalTex, uv).rgb;
-	normal = normalize(normal * 2.0 - 1.0);
+	//normal map, only x and y are stored (BC5) so z is rebuilt
+	vec3 normal;
+	normal.xy = texture(normalTex, uv).rg * 2.0 - 1.0;
+	normal.z = sqrt(max(1.0 - dot(normal.xy, normal.xy), 0.0));
+	normal = normalize(normal);
 	normal.gb = normal.bg;
 	normal.r = -normal.r;
 	normal.b = -normal.b;
@@ -48,6 +49,15 @@ void main()
 	float rs = clamp((y - 90) / 10, -1, 1) * 0.5 + 0.5;
 
 	float dist = length(worldPosition.xyz - cameraPosition);
+
+#ifdef TERRAIN_FAR_ONLY
+	//the whole terrain is past the blend distance, only the far layers are sampled
+	vec3 dirtColor = texture(dirt, uv * 10).rgb;
+	vec3 sandColor = texture(sand, uv * 10).rgb;
+	vec3 grassColor = texture(grass, uv * 10).rgb;
+	vec3 rockColor = texture(rock, uv * 10).rgb;
+	vec3 snowColor = texture(snow, uv * 10).rgb;
+#else
 	float uvLerp = clamp((dist - 250) / 150, -1, 1) * 0.5 + 0.5;
 
 	vec3 dirtColorClose = texture(dirt, uv * 100).rgb;
@@ -67,6 +77,7 @@ void main()
 	vec3 grassColor = lerp(grassColorClose, grassColorFar, uvLerp);
 	vec3 rockColor = lerp(rockColorClose, rockColorFar, uvLerp);
 	vec3 snowColor = lerp(snowColorClose, snowColorFar, uvLerp);
+#endif
 
 	vec3 diffuse = lerp(lerp(lerp(lerp(dirtColor, sandColor, ds), grassColor, sg), rockColor, gr), snowColor, rs);
 
@@ -6,7 +6,12 @@ layout(location = 2) in vec2 vUv;
 out vec2 uv;
 out vec3 worldPosition;
 
-uniform mat4 world, view, projection;
+uniform mat4 world;
+
+#include "frame.glsl"
+
+// the depth prepass runs this shader too, both have to come up with the exact same depth for GL_EQUAL
+invariant gl_Position;
 
 uniform sampler2D terrainTex;
 
@@ -19,7 +24,7 @@ void main()
 	//world space offsets
 	//worldPos.y += texture(terrainTex, vUv).r * 100f;
 
-	gl_Position = projection * view * world * worldPos;
+	gl_Position = projection * view * worldPos;
 	uv = vUv;
 
 	worldPosition = mat3(world) * aPos;